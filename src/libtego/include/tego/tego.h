@@ -42,10 +42,24 @@ const char* tego_error_get_message(const tego_error_t* error);
 
 typedef struct tego_context tego_context_t;
 
+/*
+ * Create a new context. Contexts share no state with each other, so
+ * several may be used in one process; each must only be used from the
+ * thread (with the Qt event loop) it was created on
+ *
+ * @param out_context : returned context, to be freed with tego_uninitialize
+ * @param error : filled on error
+ */
 void tego_initialize(
     tego_context_t** out_context,
     tego_error_t** error);
 
+/*
+ * Stop and free a context created by tego_initialize
+ *
+ * @param context : the context to free
+ * @param error : filled on error
+ */
 void tego_uninitialize(
     tego_context_t* context,
     tego_error_t** error);
@@ -315,6 +329,36 @@ void tego_user_id_get_v3_onion_service_id(
     tego_v3_onion_service_id_t** out_serviceId,
     tego_error_t** error);
 
+/*
+ * Scope a user id to one of the context's hosted identities
+ *
+ * User ids passed to the context's functions refer to users of the given
+ * identity; unscoped user ids refer to users of the identity started by
+ * tego_context_start_service. User ids passed to callbacks are already
+ * scoped to the identity the event belongs to.
+ *
+ * @param userId : user id to modify
+ * @param identity : the hosted identity's user id, or null to unscope
+ * @param error : filled on error
+ */
+void tego_user_id_set_identity(
+    tego_user_id_t* userId,
+    const tego_user_id_t* identity,
+    tego_error_t** error);
+
+/*
+ * Get the hosted identity a user id is scoped to
+ *
+ * @param userId : input user id
+ * @param out_identity : returned identity user id, left null if the user id
+ *  is not scoped to an identity
+ * @param error : filled on error
+ */
+void tego_user_id_get_identity(
+    const tego_user_id_t* userId,
+    tego_user_id_t** out_identity,
+    tego_error_t** error);
+
 //
 // contacts/user methods
 //
@@ -648,6 +692,90 @@ void tego_context_start_service(
     size_t userCount,
     tego_error_t** error);
 
+/*
+ * Host another identity in the same tego context
+ *
+ * The identity gets its own onion service and users, published through the
+ * context's tor instance. User ids of its users must be scoped to it with
+ * tego_user_id_set_identity before being passed to the context, and user
+ * ids passed to callbacks about its users are scoped to it.
+ *
+ * Must be called after tego_context_start_service.
+ *
+ * A new identity has no user id until tor has created its onion service.
+ * The new_identity_created callback then receives its private key, from
+ * which the user id can be derived with
+ * tego_ed25519_public_key_from_ed25519_private_key,
+ * tego_v3_onion_service_id_from_ed25519_public_key and
+ * tego_user_id_from_v3_onion_service_id; from then on it is also listed by
+ * tego_context_get_identities.
+ *
+ * @param context : the current tego context
+ * @param privateKey : the identity's private ed25519 key, or null to
+ *  create a new identity; the new key is then passed to the
+ *  new_identity_created callback
+ * @param userBuffer : the list of all of the identity's users
+ * @param userTypeBuffer : the types associated with the users
+ * @param userCount : the length of the user and user type buffers, must
+ *  be 0 when creating a new identity
+ * @param out_identity : returned user id of the identity, left null when
+ *  creating a new identity
+ * @param error : filled on error
+ */
+void tego_context_add_identity(
+    tego_context_t* context,
+    tego_ed25519_private_key_t const* privateKey,
+    tego_user_id_t const* const* userBuffer,
+    tego_user_type_t* const userTypeBuffer,
+    size_t userCount,
+    tego_user_id_t** out_identity,
+    tego_error_t** error);
+
+/*
+ * Stop hosting an identity added with tego_context_add_identity,
+ * removing its onion service and dropping its users
+ *
+ * @param context : the current tego context
+ * @param identity : the user id of the identity to remove
+ * @param error : filled on error
+ */
+void tego_context_remove_identity(
+    tego_context_t* context,
+    const tego_user_id_t* identity,
+    tego_error_t** error);
+
+/*
+ * Get the user ids of all the identities hosted by the context, starting
+ * with the identity started by tego_context_start_service
+ *
+ * @param context : the current tego context
+ * @param out_identitiesBuffer : destination buffer to store returned user id pointers
+ * @param identitiesBufferLength : maximum number of identities that can be
+ *  written to out_identitiesBuffer
+ * @param out_identityCount : destination to store number of user ids written
+ * @param error : filled on error
+ */
+void tego_context_get_identities(
+    const tego_context_t* context,
+    tego_user_id_t** out_identitiesBuffer,
+    size_t identitiesBufferLength,
+    size_t* out_identityCount,
+    tego_error_t** error);
+
+/*
+ * Get the current state of a hosted identity's onion service
+ *
+ * @param context : the current tego context
+ * @param identity : the user id of the identity
+ * @param out_state : destination to save state
+ * @param error : filled on error
+ */
+void tego_context_get_identity_onion_service_state(
+    const tego_context_t* context,
+    const tego_user_id_t* identity,
+    tego_host_onion_service_state_t* out_state,
+    tego_error_t** error);
+
 /*
  * Stop tego's onion service associated with the given context
  *
@@ -868,6 +996,10 @@ size_t tego_file_hash_to_string(
 /*
  * Send a text message from the host to the given user
  *
+ * Messages longer than 2000 UTF-16 code units are sent in fragments if the
+ * user's client accepts them (see tego_context_set_max_message_length), and
+ * are otherwise truncated.
+ *
  * @param context : the current tego context
  * @param user : the user to send a message to
  * @param message : utf8 text message to send
@@ -883,6 +1015,172 @@ void tego_context_send_message(
     tego_message_id_t* out_id,
     tego_error_t** error);
 
+/*
+ * Send several text messages from the host to the given user
+ *
+ * The messages are sent in order, packed into as few packets as the user's
+ * client accepts. Each message is acknowledged separately, as with
+ * tego_context_send_message.
+ *
+ * @param context : the current tego context
+ * @param user : the user to send the messages to
+ * @param messages : messageCount utf8 text messages to send
+ * @param messageLengths : length of each message not including null-terminator
+ * @param messageCount : number of messages to send
+ * @param out_ids : optional, filled with messageCount assigned message ids
+ *  for callbacks
+ * @param error : filled on error
+ */
+void tego_context_send_messages(
+    tego_context_t* context,
+    const tego_user_id_t* user,
+    const char* const* messages,
+    const size_t* messageLengths,
+    size_t messageCount,
+    tego_message_id_t* out_ids,
+    tego_error_t** error);
+
+/*
+ * Set how long messages sent with tego_context_send_message may be held to
+ * pack them into one packet with messages sent after them
+ *
+ * @param context : the current tego context
+ * @param delayMilliseconds : longest time a message is held; the default of
+ *  0 sends each message immediately
+ * @param error : filled on error
+ */
+void tego_context_set_message_batch_delay(
+    tego_context_t* context,
+    uint32_t delayMilliseconds,
+    tego_error_t** error);
+
+/*
+ * Set how long undelivered messages keep being sent
+ *
+ * A message that isn't acknowledged when its connection closes is queued
+ * and sent again once the user reconnects. With history enabled (see
+ * tego_context_set_history_directory) queued messages are written to disk
+ * before they are sent, and are sent again after a restart. When either
+ * limit is reached the message fails, and the message acknowledged callback
+ * fires with TEGO_FALSE.
+ *
+ * @param context : the current tego context
+ * @param maxAttempts : number of times a message is sent before failing,
+ *  or 0 for no limit; the default is 2. Attempts made before a restart are
+ *  not counted
+ * @param maxAgeSeconds : age of a message at which it fails if still
+ *  undelivered, or 0 (the default) for no limit
+ * @param error : filled on error
+ */
+void tego_context_set_message_retry_policy(
+    tego_context_t* context,
+    uint32_t maxAttempts,
+    uint32_t maxAgeSeconds,
+    tego_error_t** error);
+
+/*
+ * Set the longest text message accepted from users
+ *
+ * Messages longer than 2000 UTF-16 code units are sent in fragments and
+ * reassembled, and are received as a single message. The limit is offered
+ * to users' clients on connections made after it is set.
+ *
+ * @param context : the current tego context
+ * @param maxCharacters : length limit in UTF-16 code units; the default is
+ *  65536, and 2000 or less disables fragmented messages
+ * @param error : filled on error
+ */
+void tego_context_set_max_message_length(
+    tego_context_t* context,
+    uint32_t maxCharacters,
+    tego_error_t** error);
+
+/*
+ * Set how many connection attempts to users may be in progress at once
+ *
+ * Further attempts wait their turn, starting with users that have queued
+ * messages and then users with recent messages. Keeping this low avoids
+ * overloading tor when starting with many users.
+ *
+ * @param context : the current tego context
+ * @param maxConnecting : number of simultaneous connection attempts, or 0
+ *  for no limit; the default is 16
+ * @param error : filled on error
+ */
+void tego_context_set_max_connecting(
+    tego_context_t* context,
+    uint32_t maxConnecting,
+    tego_error_t** error);
+
+/*
+ * Set how long a connection to a user may go without messages or file
+ * transfers before it is closed to save resources
+ *
+ * Only connections to users whose client supports this are closed, and
+ * their client is told so it doesn't reconnect. Connections closed this way
+ * by either side leave the user online, and no user status changed callback
+ * fires. Sending a message or file to the user reconnects, and so does a
+ * probe after about 30 minutes of hibernation; if the reconnect fails
+ * within two minutes, the user goes offline. A user can therefore appear
+ * online for up to about 32 minutes after becoming unreachable. A
+ * connection is closed between one and two timeouts after its last
+ * activity. The user may also reconnect to us at any time.
+ *
+ * @param context : the current tego context
+ * @param timeoutSeconds : idle time after which connections are closed, or
+ *  0 (the default) to keep connections open
+ * @param error : filled on error
+ */
+void tego_context_set_idle_connection_timeout(
+    tego_context_t* context,
+    uint32_t timeoutSeconds,
+    tego_error_t** error);
+
+/*
+ * Set how often a keepalive is sent on each connection to a user
+ *
+ * Keepalives measure the round trip time reported in the connection stats.
+ * One that isn't answered within 30 seconds, or longer on a slow connection,
+ * is sent again right away, and a connection is closed after three go
+ * unanswered. The interval applies to connections made after it is set.
+ *
+ * @param context : the current tego context
+ * @param intervalSeconds : time between keepalives; the default is 60, and
+ *  0 disables keepalives
+ * @param error : filled on error
+ */
+void tego_context_set_keepalive_interval(
+    tego_context_t* context,
+    uint32_t intervalSeconds,
+    tego_error_t** error);
+
+/*
+ * Set limits on incoming connections to the onion service of every identity
+ *
+ * Incoming connections are refused while too many are pending, meaning they
+ * haven't yet been claimed by a user, or when they arrive faster than the
+ * accept rate allows. A pending connection is closed if it hasn't
+ * authenticated within the handshake timeout. The limits apply to existing
+ * identities and to identities added later.
+ *
+ * @param context : the current tego context
+ * @param maxPending : most pending connections per identity; the default is 32
+ * @param acceptRate : sustained connections accepted per second per identity;
+ *  the default is 4
+ * @param acceptBurst : connections accepted at once before the rate applies;
+ *  the default is 16
+ * @param handshakeTimeoutSeconds : time a connection has to authenticate,
+ *  between 1 and 15; the default is 15
+ * @param error : filled on error
+ */
+void tego_context_set_incoming_connection_limits(
+    tego_context_t* context,
+    uint32_t maxPending,
+    uint32_t acceptRate,
+    uint32_t acceptBurst,
+    uint32_t handshakeTimeoutSeconds,
+    tego_error_t** error);
+
 /*
  * Request to send a file to the given user
  *
@@ -1010,6 +1308,258 @@ void tego_context_forget_user(
     const tego_user_id_t* user,
     tego_error_t** error);
 
+//
+// Tego Connection Statistics
+//
+
+typedef enum
+{
+    tego_channel_type_control,
+    tego_channel_type_auth_hidden_service,
+    tego_channel_type_chat,
+    tego_channel_type_contact_request,
+    tego_channel_type_file_transfer,
+
+    tego_channel_type_count
+} tego_channel_type_t;
+
+// traffic counters for the connection to a user
+typedef struct
+{
+    // TEGO_TRUE if the user currently has a connection, all other
+    // fields are zero if not
+    tego_bool_t connected;
+    // bytes and packets over the lifetime of the connection, including
+    // packet headers
+    uint64_t bytes_received;
+    uint64_t bytes_sent;
+    uint64_t packets_received;
+    uint64_t packets_sent;
+    // packets per channel type, indexed by tego_channel_type_t
+    uint64_t packets_received_by_channel_type[tego_channel_type_count];
+    uint64_t packets_sent_by_channel_type[tego_channel_type_count];
+    // bytes queued for writing which have not yet been sent
+    uint64_t write_buffer_size;
+    uint32_t channels_opened;
+    uint32_t channels_closed;
+    // seconds since the connection was established
+    uint32_t age;
+    // round trip time of the most recent keepalive in milliseconds,
+    // -1 if not yet measured
+    int32_t round_trip_time;
+    // number of consecutive unanswered keepalives
+    uint32_t missed_keepalives;
+} tego_connection_stats_t;
+
+/*
+ * Get the traffic statistics for the connection to the given user
+ *
+ * @param context : the current tego context
+ * @param user : the user whose connection to query
+ * @param out_stats : destination to write statistics
+ * @param error : filled on error
+ */
+void tego_context_get_connection_stats(
+    const tego_context_t* context,
+    const tego_user_id_t* user,
+    tego_connection_stats_t* out_stats,
+    tego_error_t** error);
+
+/*
+ * Set how often the connection_stats callback is fired for each
+ * connected user
+ *
+ * @param context : the current tego context
+ * @param intervalSeconds : seconds between callbacks, 0 to disable
+ * @param error : filled on error
+ */
+void tego_context_set_connection_stats_interval(
+    tego_context_t* context,
+    uint32_t intervalSeconds,
+    tego_error_t** error);
+
+//
+// Tego Conversation History
+//
+
+/*
+ * Store conversation history on disk
+ *
+ * Each contact gets an append-only message log in a subdirectory named after
+ * its service id; contacts of identities added with tego_context_add_identity
+ * are further beneath a subdirectory named after the identity. Messages sent
+ * and received from now on are written to it, and only the most recent
+ * messages are kept in memory; no history is read from disk until it is
+ * requested.
+ *
+ * @param context : the current tego context
+ * @param directory : utf8 path of the history directory, created if needed;
+ *  NULL to stop storing history
+ * @param directoryLength : length of directory not counting the null terminator
+ * @param key : optional 32 byte key used to encrypt message text with
+ *  AES-256-GCM, may be NULL
+ * @param keyLength : length of key, 0 or 32
+ * @param error : filled on error
+ */
+void tego_context_set_history_directory(
+    tego_context_t* context,
+    const char* directory,
+    size_t directoryLength,
+    const uint8_t* key,
+    size_t keyLength,
+    tego_error_t** error);
+
+// position in a user's conversation history, see tego_context_get_messages
+typedef uint64_t tego_message_cursor_t;
+// cursor positioned after the newest stored message
+#define TEGO_MESSAGE_CURSOR_END UINT64_MAX
+
+typedef enum
+{
+    tego_message_type_text,
+    tego_message_type_file,
+} tego_message_type_t;
+
+typedef enum
+{
+    tego_message_status_received,   // sent to us by the user
+    tego_message_status_queued,     // waiting for a connection to the user
+    tego_message_status_sending,    // sent but not yet acknowledged
+    tego_message_status_delivered,  // acknowledged by the user
+    tego_message_status_error,      // rejected by the user or could not be sent
+} tego_message_status_t;
+
+// a message read from conversation history
+typedef struct
+{
+    // cursor of this message; pass it to tego_context_get_messages to
+    // continue with the messages before it
+    tego_message_cursor_t cursor;
+    tego_time_t timestamp;
+    tego_message_id_t message_id;
+    tego_message_type_t type;
+    tego_message_status_t status;
+    tego_bool_t is_outgoing;
+    // the utf8 text, or file path for file transfers, is at text_offset in
+    // the caller's text buffer and is not null terminated
+    size_t text_offset;
+    size_t text_length;
+} tego_history_message_t;
+
+/*
+ * Get a page of stored conversation history with a user
+ *
+ * Fills out_messages with up to messagesLength consecutive messages, oldest
+ * first, ending just before the message at cursor. Their text is copied back
+ * to back into textBuffer; if it does not all fit, the oldest messages are
+ * left out of the page. Earlier pages are read by passing out_nextCursor back
+ * in until it is 0.
+ *
+ * Requires history to be enabled with tego_context_set_history_directory
+ *
+ * @param context : the current tego context
+ * @param user : the user whose conversation to read
+ * @param cursor : read the messages before this one, or TEGO_MESSAGE_CURSOR_END
+ *  to read the newest messages
+ * @param out_messages : destination for messages
+ * @param messagesLength : number of messages out_messages can hold
+ * @param textBuffer : destination for message text
+ * @param textBufferSize : size of textBuffer in bytes
+ * @param out_messageCount : number of messages written to out_messages
+ * @param out_nextCursor : cursor to read the preceding page from, or 0 if
+ *  there are no older messages
+ * @param error : filled on error, including when textBuffer cannot hold the
+ *  text of a single message
+ */
+void tego_context_get_messages(
+    tego_context_t* context,
+    const tego_user_id_t* user,
+    tego_message_cursor_t cursor,
+    tego_history_message_t* out_messages,
+    size_t messagesLength,
+    char* textBuffer,
+    size_t textBufferSize,
+    size_t* out_messageCount,
+    tego_message_cursor_t* out_nextCursor,
+    tego_error_t** error);
+
+/*
+ * Find a message in stored conversation history, to read the history
+ * preceding it with tego_context_get_messages
+ *
+ * @param context : the current tego context
+ * @param user : the user whose conversation to search
+ * @param messageId : id of the message
+ * @param isOutgoing : TEGO_TRUE for a message sent by the host, TEGO_FALSE
+ *  for one received from the user
+ * @param out_cursor : the cursor of the newest matching message
+ * @param error : filled on error, including when no message matches
+ */
+void tego_context_get_message_cursor(
+    tego_context_t* context,
+    const tego_user_id_t* user,
+    tego_message_id_t messageId,
+    tego_bool_t isOutgoing,
+    tego_message_cursor_t* out_cursor,
+    tego_error_t** error);
+
+/*
+ * Find where a time falls in stored conversation history, to read the
+ * history preceding it with tego_context_get_messages
+ *
+ * @param context : the current tego context
+ * @param user : the user whose conversation to search
+ * @param timestamp : the time, in the same units as message timestamps
+ * @param out_cursor : the cursor of the oldest message at or after timestamp,
+ *  or the cursor following the newest message if none are
+ * @param error : filled on error
+ */
+void tego_context_get_message_cursor_at_time(
+    tego_context_t* context,
+    const tego_user_id_t* user,
+    tego_time_t timestamp,
+    tego_message_cursor_t* out_cursor,
+    tego_error_t** error);
+
+// a message matching a search, see tego_context_search_messages
+typedef struct
+{
+    // cursor of the message; read it with tego_context_get_messages,
+    // passing cursor + 1 and a single message buffer
+    tego_message_cursor_t cursor;
+    // relevance of the message to the query, higher is better
+    double score;
+} tego_search_result_t;
+
+/*
+ * Search stored conversation history with a user
+ *
+ * Words are case-insensitive runs of at least two letters or digits. Text
+ * messages containing every word of the query are ranked by relevance, most
+ * relevant first. Searches use an index that is kept up to date as messages
+ * are stored, and do not read the stored messages themselves.
+ *
+ * Requires history to be enabled with tego_context_set_history_directory
+ *
+ * @param context : the current tego context
+ * @param user : the user whose conversation to search
+ * @param query : utf8 search query
+ * @param queryLength : length of query not counting the null terminator
+ * @param out_results : destination for results
+ * @param resultsLength : maximum number of results to return
+ * @param out_resultCount : number of results written to out_results
+ * @param error : filled on error
+ */
+void tego_context_search_messages(
+    tego_context_t* context,
+    const tego_user_id_t* user,
+    const char* query,
+    size_t queryLength,
+    tego_search_result_t* out_results,
+    size_t resultsLength,
+    size_t* out_resultCount,
+    tego_error_t** error);
+
 //
 // Callbacks for frontend to respond to events
 // Provides no guarantees on what thread they are running on or thread safety
@@ -1294,15 +1844,56 @@ typedef void (*tego_user_status_changed_callback_t)(
 
 /*
  * Callback fired when tor creates a new onion service for
- * the host
+ * the host, or for an identity added without a key
  *
  * @param context : the current tego context
- * @param privateKey : the host's private key
+ * @param privateKey : the new identity's private key
  */
 typedef void (*tego_new_identity_created_callback_t)(
     tego_context_t* context,
     const tego_ed25519_private_key_t* privateKey);
 
+/*
+ * Callback fired periodically for each connected user when a
+ * connection stats interval has been set
+ *
+ * @param context : the current tego context
+ * @param user : the user the connection belongs to
+ * @param stats : the connection's current statistics
+ */
+typedef void (*tego_connection_stats_callback_t)(
+    tego_context_t* context,
+    const tego_user_id_t* user,
+    const tego_connection_stats_t* stats);
+
+/*
+ * Callback fired once all of the users passed to
+ * tego_context_start_service or tego_context_add_identity have been loaded
+ *
+ * Connections to the loaded users are started gradually afterwards, so
+ * their user_status_changed callbacks follow over time.
+ *
+ * @param context : the current tego context
+ * @param userCount : the number of users loaded
+ */
+typedef void (*tego_users_loaded_callback_t)(
+    tego_context_t* context,
+    size_t userCount);
+
+/*
+ * Callback fired when the state of any hosted identity's onion service
+ * changes; host_onion_service_state_changed is also fired for the
+ * identity started by tego_context_start_service
+ *
+ * @param context : the current tego context
+ * @param identity : the identity whose service changed
+ * @param state : the service's new state
+ */
+typedef void (*tego_identity_onion_service_state_changed_callback_t)(
+    tego_context_t* context,
+    const tego_user_id_t* identity,
+    tego_host_onion_service_state_t state);
+
 /*
  * Setters for various callbacks
  */
@@ -1402,6 +1993,21 @@ void tego_context_set_new_identity_created_callback(
     tego_new_identity_created_callback_t,
     tego_error_t** error);
 
+void tego_context_set_connection_stats_callback(
+    tego_context_t* context,
+    tego_connection_stats_callback_t,
+    tego_error_t** error);
+
+void tego_context_set_users_loaded_callback(
+    tego_context_t* context,
+    tego_users_loaded_callback_t,
+    tego_error_t** error);
+
+void tego_context_set_identity_onion_service_state_changed_callback(
+    tego_context_t* context,
+    tego_identity_onion_service_state_changed_callback_t,
+    tego_error_t** error);
+
 
 /*
  Destructors for various tego types
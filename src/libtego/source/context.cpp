@@ -1,19 +1,21 @@
 #include "context.hpp"
 #include "error.hpp"
-#include "globals.hpp"
 #include "tor.hpp"
 #include "user.hpp"
 #include "ed25519.hpp"
 
-using tego::g_globals;
-
 #include "tor/TorControl.h"
 #include "tor/TorManager.h"
 #include "tor/TorProcess.h"
+#include "tor/HiddenService.h"
 #include "core/UserIdentity.h"
 #include "core/ContactUser.h"
 #include "core/ConversationModel.h"
+#include "core/ConversationStore.h"
+#include "core/SearchIndex.h"
+#include "utils/CryptoKey.h"
 #include "utils/SecureRNG.h"
+#include "utils/StringUtil.h"
 
 //
 // Tego Context
@@ -24,8 +26,17 @@ tego_context::tego_context()
 , callback_queue_(this)
 , threadId(std::this_thread::get_id())
 {
-    this->torManager = Tor::TorManager::instance();
+    this->torManager = new Tor::TorManager(this);
     this->torControl = torManager->control();
+    this->connectScheduler = new Tor::ConnectScheduler(torControl);
+}
+
+tego_context::~tego_context()
+{
+    // identities remove their services from torControl as they go, so
+    // they are destroyed first; torManager owns torControl and the scheduler
+    delete this->identityManager;
+    delete this->torManager;
 }
 
 void tego_context::start_tor(const tego_tor_launch_config_t* config)
@@ -184,79 +195,85 @@ void tego_context::start_service(
     size_t userCount)
 {
     TEGO_THROW_IF_NULL(hostPrivateKey);
-    if (userCount > 0)
+    TEGO_THROW_IF_NOT_NULL(this->identityManager);
+    validateUserBuffers(userBuffer, userTypeBuffer, userCount);
+
+    this->identityManager = new IdentityManager(this, keyBlobFromPrivateKey(hostPrivateKey));
+    auto userIdentity = this->identityManager->identities().first();
+
+    this->loadUsers(userIdentity, userBuffer, userTypeBuffer, userCount);
+}
+
+void tego_context::start_service()
+{
+    TEGO_THROW_IF_NOT_NULL(this->identityManager);
+    this->identityManager = new IdentityManager(this, {});
+}
+
+std::unique_ptr<tego_user_id_t> tego_context::add_identity(
+    tego_ed25519_private_key_t const* privateKey,
+    tego_user_id_t const* const* userBuffer,
+    tego_user_type_t* const userTypeBuffer,
+    size_t userCount)
+{
+    TEGO_THROW_IF_NULL(this->identityManager);
+    validateUserBuffers(userBuffer, userTypeBuffer, userCount);
+
+    if (privateKey == nullptr)
     {
-        TEGO_THROW_IF_NULL(userBuffer);
-        TEGO_THROW_IF_NULL(userTypeBuffer);
-    }
-    else
-    {
-        TEGO_THROW_IF_NOT_NULL(userBuffer);
-        TEGO_THROW_IF_NOT_NULL(userTypeBuffer);
+        // the new key is reported through the new_identity_created callback
+        TEGO_THROW_IF_FALSE(userCount == 0);
+        this->identityManager->addIdentity(QString());
+        return {};
     }
 
-    char rawKeyBlob[TEGO_ED25519_KEYBLOB_SIZE] = {0};
-    tego_ed25519_keyblob_from_ed25519_private_key(
-        rawKeyBlob,
-        sizeof(rawKeyBlob),
-        hostPrivateKey,
-        tego::throw_on_error());
+    const auto keyBlob = keyBlobFromPrivateKey(privateKey);
+    CryptoKey key;
+    TEGO_THROW_IF_FALSE(key.loadFromKeyBlob(keyBlob.toLatin1()));
+    TEGO_THROW_IF_FALSE_MSG(
+        this->identityManager->lookupServiceId(key.torServiceID()) == nullptr,
+        "identity is already hosted by this context");
 
-    auto keyBlob = QString::fromUtf8(rawKeyBlob, TEGO_ED25519_KEYBLOB_LENGTH);
+    auto userIdentity = this->identityManager->addIdentity(keyBlob);
+    this->loadUsers(userIdentity, userBuffer, userTypeBuffer, userCount);
 
-    // our different types of users
-    QList<QString> allowedUsers;
-    QList<QString> requestingUsers;
-    QList<QString> blockedUsers;
-    QList<QString> pendingUsers;
-    QList<QString> rejectedUsers;
+    return userIdentity->toTegoUserId();
+}
 
-    for(size_t k = 0; k < userCount; k++)
-    {
-        const auto userType = userTypeBuffer[k];
-        const auto userHostname = QString::fromUtf8(userBuffer[k]->serviceId.data, TEGO_V3_ONION_SERVICE_ID_LENGTH) + ".onion";
+void tego_context::remove_identity(tego_user_id_t const* identity)
+{
+    auto userIdentity = this->lookupIdentity(identity);
+    TEGO_THROW_IF_FALSE_MSG(
+        userIdentity != this->identityManager->identities().first(),
+        "the identity started by tego_context_start_service cannot be removed");
 
-        switch(userTypeBuffer[k])
+    this->identityManager->removeIdentity(userIdentity);
+}
+
+std::vector<tego_user_id_t*> tego_context::get_identities() const
+{
+    TEGO_THROW_IF_NULL(this->identityManager);
+
+    std::vector<tego_user_id_t*> identities;
+    for(auto userIdentity : this->identityManager->identities())
+    {
+        // identities with new keys have no id until their service is created
+        if (!userIdentity->hostname().isEmpty())
         {
-            case tego_user_type_host:
-                TEGO_THROW_MSG("passed in userTypeBuffer[{}] is invalid type 'tego_user_type_host'", k);
-                break;
-            case tego_user_type_allowed:
-                allowedUsers.push_back(userHostname);
-                break;
-            case tego_user_type_requesting:
-                requestingUsers.push_back(userHostname);
-                break;
-            case tego_user_type_blocked:
-                blockedUsers.push_back(userHostname);
-                break;
-            case tego_user_type_pending:
-                pendingUsers.push_back(userHostname);
-                break;
-            case tego_user_type_rejected:
-                rejectedUsers.push_back(userHostname);
-                break;
-            default:
-                TEGO_THROW_MSG("passed in userTypeBuffer[{}] : ({}) is invalid", k, static_cast<int>(userType));
-                break;
+            identities.push_back(userIdentity->toTegoUserId().release());
         }
     }
-
-    // save off the singleton on our context
-    this->identityManager = new IdentityManager(keyBlob);
-    auto userIdentity = this->identityManager->identities().first();
-    auto contactsManager = userIdentity->getContacts();
-
-    contactsManager->addAllowedContacts(allowedUsers);
-    contactsManager->addIncomingRequests(requestingUsers);
-    contactsManager->addRejectedIncomingRequests(blockedUsers);
-    contactsManager->addOutgoingRequests(pendingUsers);
-    contactsManager->addRejectedOutgoingRequests(rejectedUsers);
+    return identities;
 }
 
-void tego_context::start_service()
+tego_host_onion_service_state_t tego_context::get_identity_onion_service_state(tego_user_id_t const* identity) const
 {
-    this->identityManager = new IdentityManager({}, {});
+    auto userIdentity = this->lookupIdentity(identity);
+    if (userIdentity->hiddenService() == nullptr)
+    {
+        return tego_host_onion_service_state_none;
+    }
+    return userIdentity->hiddenService()->state();
 }
 
 int32_t tego_context::get_tor_bootstrap_progress() const
@@ -365,6 +382,19 @@ void tego_context::update_disable_network_flag(bool disableNetwork)
     this->torControl->setConfiguration(vm);
 }
 
+void tego_context::set_identity_onion_service_state(UserIdentity* identity, tego_host_onion_service_state_t state)
+{
+    if (this->identityManager == nullptr || identity == this->identityManager->identities().value(0))
+    {
+        this->set_host_onion_service_state(state);
+    }
+
+    if (!identity->hostname().isEmpty())
+    {
+        this->callback_registry_.emit_identity_onion_service_state_changed(identity->toTegoUserId().release(), state);
+    }
+}
+
 void tego_context::set_host_onion_service_state(tego_host_onion_service_state_t state)
 {
     if (state == hostUserState)
@@ -381,10 +411,7 @@ std::unique_ptr<tego_user_id_t> tego_context::get_host_user_id() const
     TEGO_THROW_IF_NULL(this->identityManager);
     auto userIdentity = this->identityManager->identities().first();
 
-    auto hostname = userIdentity->hostname().toUtf8();
-    tego_v3_onion_service_id serviceId(hostname.data(), TEGO_V3_ONION_SERVICE_ID_LENGTH);
-
-    return std::make_unique<tego_user_id_t>(serviceId);
+    return userIdentity->toTegoUserId();
 }
 
 tego_host_onion_service_state_t tego_context::get_host_onion_service_state() const
@@ -397,9 +424,7 @@ void tego_context::send_chat_request(
     const char* message,
     size_t messageLength)
 {
-    TEGO_THROW_IF_NULL(this->identityManager);
-    auto userIdentity = this->identityManager->identities().first();
-    auto contactsManager = userIdentity->getContacts();
+    auto contactsManager = this->getIdentity(user)->getContacts();
 
     TEGO_THROW_IF_FALSE(messageLength < std::numeric_limits<int>::max());
     contactsManager->createContactRequest(
@@ -416,9 +441,7 @@ void tego_context::acknowledge_chat_request(
     logger::println("ack chat request from {}", user->serviceId.data);
     logger::println("response : {}", static_cast<int>(response));
 
-    TEGO_THROW_IF_NULL(this->identityManager);
-    auto userIdentity = this->identityManager->identities().first();
-    auto contactsManager = userIdentity->getContacts();
+    auto contactsManager = this->getIdentity(user)->getContacts();
     auto incomingRequestManager = contactsManager->incomingRequestManager();
 
     auto hostname = QString("%1.onion").arg(user->serviceId.data).toUtf8();
@@ -452,54 +475,108 @@ tego_message_id_t tego_context::send_message(
     TEGO_THROW_IF_NULL(contactUser);
     auto conversationModel = contactUser->conversation();
 
-    return conversationModel->sendMessage(QString::fromStdString(message));
+    return conversationModel->sendMessage(validUtf8(message.data(), message.size()));
 }
 
-tego_user_type_t tego_context::get_user_type(tego_user_id_t const* user) const
+std::vector<tego_message_id_t> tego_context::send_messages(
+    const tego_user_id_t* user,
+    const std::vector<std::string>& messages)
 {
-    auto contactUser = this->getContactUser(user);
-    if (contactUser != nullptr)
-    {
-        auto const status = contactUser->status();
-        switch(status)
-        {
-            case ContactUser::Online:
-            case ContactUser::Offline:
-                return tego_user_type_allowed;
-            case ContactUser::RequestPending:
-                return tego_user_type_pending;
-            case ContactUser::RequestRejected:
-                return tego_user_type_rejected;
-            default:
-                TEGO_THROW_MSG("Unknown ContactUser::Status : {}", static_cast<int>(status));
-                break;
-        }
+    TEGO_THROW_IF_NULL(user);
+
+    QList<QByteArray> texts;
+    texts.reserve(static_cast<int>(messages.size()));
+    for(const auto& message : messages)
+    {
+        TEGO_THROW_IF_FALSE(message.size() > 0);
+        texts.push_back(validUtf8(message.data(), message.size()));
     }
 
-    // next check for requesting users
-    auto userIdentity = this->identityManager->identities().first();
-    auto contactsManager = userIdentity->getContacts();
-    auto incomingRequestManager = contactsManager->incomingRequestManager();
+    auto contactUser = getContactUser(user);
+    TEGO_THROW_IF_NULL(contactUser);
+    auto conversationModel = contactUser->conversation();
 
-    auto hostname = QByteArray::fromStdString(fmt::format("{}.onion", user->serviceId.data));
+    return conversationModel->sendMessages(texts);
+}
 
-    // search for the user's serviceId on the incoming request manager
-    auto contactRequest = incomingRequestManager->requestFromHostname(hostname);
-    if (contactRequest != nullptr)
-    {
-        return tego_user_type_requesting;
-    }
+void tego_context::set_message_batch_delay(uint32_t delayMilliseconds)
+{
+    TEGO_THROW_IF_FALSE(delayMilliseconds <= static_cast<uint32_t>(std::numeric_limits<int>::max()));
 
-    // see if the user is blocked
-    if(incomingRequestManager->isHostnameRejected(hostname))
-    {
-        return tego_user_type_blocked;
+    this->messageBatchDelay = static_cast<int>(delayMilliseconds);
+}
+
+void tego_context::set_message_retry_policy(uint32_t maxAttempts, uint32_t maxAgeSeconds)
+{
+    TEGO_THROW_IF_FALSE(maxAttempts <= static_cast<uint32_t>(std::numeric_limits<int>::max()));
+    TEGO_THROW_IF_FALSE(maxAgeSeconds <= static_cast<uint32_t>(std::numeric_limits<int>::max()));
+
+    this->messageRetryAttempts = static_cast<int>(maxAttempts);
+    this->messageRetrySeconds = static_cast<int>(maxAgeSeconds);
+}
+
+void tego_context::set_max_message_length(uint32_t maxCharacters)
+{
+    TEGO_THROW_IF_FALSE(maxCharacters <= static_cast<uint32_t>(std::numeric_limits<int>::max()));
+
+    this->maxMessageCharacters = static_cast<int>(maxCharacters);
+}
+
+void tego_context::set_max_connecting(uint32_t maxConnecting)
+{
+    TEGO_THROW_IF_NULL(this->connectScheduler);
+    TEGO_THROW_IF_FALSE(maxConnecting <= static_cast<uint32_t>(std::numeric_limits<int>::max()));
+
+    this->connectScheduler->setMaxConnecting(static_cast<int>(maxConnecting));
+}
+
+void tego_context::set_idle_connection_timeout(uint32_t timeoutSeconds)
+{
+    TEGO_THROW_IF_FALSE(timeoutSeconds <= static_cast<uint32_t>(std::numeric_limits<int>::max() / 1000));
+
+    this->idleConnectionTimeout = static_cast<int>(timeoutSeconds);
+}
+
+void tego_context::set_keepalive_interval(uint32_t intervalSeconds)
+{
+    TEGO_THROW_IF_FALSE(intervalSeconds <= static_cast<uint32_t>(std::numeric_limits<int>::max() / 1000));
+
+    this->keepAliveInterval = static_cast<int>(intervalSeconds);
+}
+
+void tego_context::set_incoming_connection_limits(
+    uint32_t maxPending,
+    uint32_t acceptRate,
+    uint32_t acceptBurst,
+    uint32_t handshakeTimeoutSeconds)
+{
+    TEGO_THROW_IF_FALSE(maxPending >= 1 && maxPending <= static_cast<uint32_t>(std::numeric_limits<int>::max()));
+    TEGO_THROW_IF_FALSE(acceptRate >= 1 && acceptRate <= static_cast<uint32_t>(std::numeric_limits<int>::max()));
+    TEGO_THROW_IF_FALSE(acceptBurst >= 1 && acceptBurst <= static_cast<uint32_t>(std::numeric_limits<int>::max()));
+    TEGO_THROW_IF_FALSE(handshakeTimeoutSeconds >= 1 && handshakeTimeoutSeconds <= static_cast<uint32_t>(UserIdentity::MaxIncomingHandshakeTimeout));
+
+    this->incomingMaxPending = static_cast<int>(maxPending);
+    this->incomingAcceptRate = static_cast<int>(acceptRate);
+    this->incomingAcceptBurst = static_cast<int>(acceptBurst);
+    this->incomingHandshakeTimeout = static_cast<int>(handshakeTimeoutSeconds);
+
+    if (this->identityManager) {
+        for (auto identity : this->identityManager->identities())
+            identity->setIncomingConnectionLimits(this->incomingMaxPending, this->incomingAcceptRate, this->incomingAcceptBurst);
     }
+}
+
+tego_user_type_t tego_context::get_user_type(tego_user_id_t const* user) const
+{
+    auto contactsManager = this->getIdentity(user)->getContacts();
 
-    // finally see if the user matches the host
-    if (hostname == userIdentity->hostname().toUtf8())
+    auto type = contactsManager->userType(
+        QByteArray::fromRawData(
+            user->serviceId.data,
+            TEGO_V3_ONION_SERVICE_ID_LENGTH));
+    if (type.has_value())
     {
-        return tego_user_type_host;
+        return type.value();
     }
 
     TEGO_THROW_MSG("Unknown user with service id : '{}'", user->serviceId.data);
@@ -508,60 +585,53 @@ tego_user_type_t tego_context::get_user_type(tego_user_id_t const* user) const
 size_t tego_context::get_user_count() const
 {
     TEGO_THROW_IF_NULL(this->identityManager);
-    auto userIdentity = this->identityManager->identities().first();
-    auto contactsManager = userIdentity->getContacts();
 
-    return static_cast<size_t>(contactsManager->contacts().size());
+    size_t userCount = 0;
+    for(auto userIdentity : this->identityManager->identities())
+    {
+        userCount += static_cast<size_t>(userIdentity->getContacts()->contacts().size());
+    }
+    return userCount;
 }
 
 std::vector<tego_user_id_t*> tego_context::get_users() const
 {
     TEGO_THROW_IF_NULL(this->identityManager);
-    auto userIdentity = this->identityManager->identities().first();
-    auto contactsManager = userIdentity->getContacts();
-    auto incomingRequestManager = contactsManager->incomingRequestManager();
 
     std::vector<std::unique_ptr<tego_user_id_t>> managedUsers;
     std::vector<tego_user_id_t*> users;
 
-    // helper function to from hostname to tego_user_id_t
-    auto hostnameToTegoUserId = [](QString const& hostname) -> std::unique_ptr<tego_user_id_t>
-    {
-         // convert our hostname to just the service id raw string
-        auto serviceIdString = hostname.left(TEGO_V3_ONION_SERVICE_ID_LENGTH).toUtf8();
-        // ensure valid service id
-        auto serviceId = std::make_unique<tego_v3_onion_service_id>(serviceIdString.data(), serviceIdString.size());
-        // create user id object from service id
-        auto userId = std::make_unique<tego_user_id>(*serviceId.get());
-
-        return userId;
-    };
-
-    // first iterate through our explicit users
-    for(auto contactUser : contactsManager->contacts())
+    // user ids are scoped to the identity they belong to
+    for(auto userIdentity : this->identityManager->identities())
     {
-        auto userId = hostnameToTegoUserId(contactUser->hostname());
+        auto contactsManager = userIdentity->getContacts();
+        auto incomingRequestManager = contactsManager->incomingRequestManager();
 
-        users.push_back(userId.get());
-        managedUsers.push_back(std::move(userId));
-    }
+        auto addUser = [&](QString const& hostname)
+        {
+            auto userId = userIdentity->toTegoUserId(hostname);
 
-    // next add our implicit 'incomingContactRequest' users
-    for(auto incomingContactRequest : incomingRequestManager->requests())
-    {
-        auto userId = hostnameToTegoUserId(incomingContactRequest->hostname());
+            users.push_back(userId.get());
+            managedUsers.push_back(std::move(userId));
+        };
 
-        users.push_back(userId.get());
-        managedUsers.push_back(std::move(userId));
-    }
+        // first iterate through our explicit users
+        for(auto contactUser : contactsManager->contacts())
+        {
+            addUser(contactUser->hostname());
+        }
 
-    // next add our blocked users
-    for(auto rejectedHostname : incomingRequestManager->getRejectedHostnames())
-    {
-        auto userId = hostnameToTegoUserId(rejectedHostname);
+        // next add our implicit 'incomingContactRequest' users
+        for(auto incomingContactRequest : incomingRequestManager->requests())
+        {
+            addUser(QString::fromLatin1(incomingContactRequest->hostname()));
+        }
 
-        users.push_back(userId.get());
-        managedUsers.push_back(std::move(userId));
+        // next add our blocked users
+        for(auto rejectedHostname : incomingRequestManager->getRejectedHostnames())
+        {
+            addUser(rejectedHostname);
+        }
     }
 
     // we got this far, release these ptrs from memory management
@@ -638,25 +708,458 @@ void tego_context::cancel_file_transfer_transfer(
     TEGO_THROW_IF_NULL(contactUser);
     auto conversationModel = contactUser->conversation();
 
-    conversationModel->cancelTransfer(fileTransfer);
-}
+    conversationModel->cancelTransfer(fileTransfer);
+}
+
+namespace
+{
+    tego_connection_stats_t toTegoConnectionStats(const Protocol::Connection::Statistics& stats)
+    {
+        tego_connection_stats_t retval = {};
+        retval.connected = TEGO_TRUE;
+        retval.bytes_received = stats.bytesReceived;
+        retval.bytes_sent = stats.bytesSent;
+        retval.packets_received = stats.packetsReceived;
+        retval.packets_sent = stats.packetsSent;
+
+        constexpr static const char* channelTypes[] =
+        {
+            "control",
+            "im.ricochet.auth.hidden-service",
+            "im.ricochet.chat",
+            "im.ricochet.contact.request",
+            "im.ricochet.file-transfer",
+        };
+        static_assert(tego::countof(channelTypes) == tego_channel_type_count);
+
+        for(size_t i = 0; i < tego_channel_type_count; ++i)
+        {
+            const auto type = QString::fromLatin1(channelTypes[i]);
+            retval.packets_received_by_channel_type[i] = stats.packetsReceivedByType.value(type);
+            retval.packets_sent_by_channel_type[i] = stats.packetsSentByType.value(type);
+        }
+
+        retval.write_buffer_size = static_cast<uint64_t>(std::max<qint64>(0, stats.writeBufferSize));
+        retval.channels_opened = static_cast<uint32_t>(stats.channelsOpened);
+        retval.channels_closed = static_cast<uint32_t>(stats.channelsClosed);
+        retval.age = static_cast<uint32_t>(std::max(0, stats.age));
+        retval.round_trip_time = stats.roundTripTime;
+        retval.missed_keepalives = static_cast<uint32_t>(stats.missedKeepAlives);
+
+        return retval;
+    }
+}
+
+tego_connection_stats_t tego_context::get_connection_stats(tego_user_id_t const* user) const
+{
+    TEGO_THROW_IF_NULL(user);
+
+    auto contactUser = this->getContactUser(user);
+    TEGO_THROW_IF_NULL(contactUser);
+
+    const auto& connection = contactUser->connection();
+    if (!connection || !connection->isConnected())
+    {
+        tego_connection_stats_t retval = {};
+        retval.connected = TEGO_FALSE;
+        retval.round_trip_time = -1;
+        return retval;
+    }
+
+    return toTegoConnectionStats(connection->statistics());
+}
+
+void tego_context::set_connection_stats_interval(uint32_t intervalSeconds)
+{
+    TEGO_THROW_IF_FALSE(intervalSeconds <= static_cast<uint32_t>(std::numeric_limits<int>::max() / 1000));
+
+    if (intervalSeconds == 0)
+    {
+        this->connectionStatsTimer.reset();
+        return;
+    }
+
+    if (!this->connectionStatsTimer)
+    {
+        this->connectionStatsTimer = std::make_unique<QTimer>();
+        QObject::connect(this->connectionStatsTimer.get(), &QTimer::timeout, [this]() -> void
+        {
+            this->emitConnectionStats();
+        });
+    }
+    this->connectionStatsTimer->start(static_cast<int>(intervalSeconds) * 1000);
+}
+
+void tego_context::set_history_directory(const QString& directory, const QByteArray& key)
+{
+    this->historyDirectory = directory;
+    this->historyKey = key;
+
+    // stores are reopened with the new settings, and their undelivered
+    // messages queued to be sent; contacts without a conversation only
+    // need one if they have undelivered messages in the new directory
+    if (this->identityManager != nullptr)
+    {
+        for(auto userIdentity : identityManager->identities())
+        for(auto contactUser : userIdentity->getContacts()->contacts())
+        {
+            if (contactUser->hasConversation())
+            {
+                contactUser->conversation()->closeStore();
+                contactUser->conversation()->loadOutbox();
+            }
+            else if (ConversationModel::hasStoredOutbox(contactUser))
+            {
+                // loads the outbox when created
+                contactUser->conversation();
+            }
+        }
+    }
+}
+
+size_t tego_context::get_messages(
+    tego_user_id_t const* user,
+    tego_message_cursor_t cursor,
+    tego_history_message_t* messages,
+    size_t messagesLength,
+    char* textBuffer,
+    size_t textBufferSize,
+    tego_message_cursor_t* nextCursor)
+{
+    TEGO_THROW_IF_NULL(user);
+    TEGO_THROW_IF_FALSE(messages != nullptr || messagesLength == 0);
+    TEGO_THROW_IF_FALSE(textBuffer != nullptr || textBufferSize == 0);
+    TEGO_THROW_IF_NULL(nextCursor);
+
+    static_assert(tego_message_type_text == static_cast<int>(ConversationModel::Message));
+    static_assert(tego_message_type_file == static_cast<int>(ConversationModel::File));
+    static_assert(tego_message_status_received == static_cast<int>(ConversationModel::Received));
+    static_assert(tego_message_status_queued == static_cast<int>(ConversationModel::Queued));
+    static_assert(tego_message_status_sending == static_cast<int>(ConversationModel::Sending));
+    static_assert(tego_message_status_delivered == static_cast<int>(ConversationModel::Delivered));
+    static_assert(tego_message_status_error == static_cast<int>(ConversationModel::Error));
+
+    auto contactUser = this->getContactUser(user);
+    TEGO_THROW_IF_NULL(contactUser);
+    TEGO_THROW_IF_FALSE_MSG(!historyDirectory.isEmpty(), "Conversation history is not being stored");
+    std::unique_ptr<ConversationStore> openedStore;
+    auto store = this->getConversationStore(contactUser, openedStore);
+    if (store == nullptr)
+    {
+        *nextCursor = 0;
+        return 0;
+    }
+
+    const auto end = static_cast<qint64>(std::min(cursor, static_cast<tego_message_cursor_t>(store->count())));
+    const auto limit = static_cast<int>(std::min(messagesLength, static_cast<size_t>(std::numeric_limits<int>::max())));
+    const auto entries = store->readBefore(end, limit);
+
+    // keep the newest messages whose text fits, so the page still ends at the cursor
+    size_t first = entries.size();
+    size_t textSize = 0;
+    while (first > 0 && textSize + static_cast<size_t>(entries[first - 1].text.size()) <= textBufferSize)
+    {
+        --first;
+        textSize += static_cast<size_t>(entries[first].text.size());
+    }
+    TEGO_THROW_IF_FALSE_MSG(entries.empty() || first < entries.size(), "Text buffer is too small for message {}", entries.back().sequence);
+
+    size_t textOffset = 0;
+    for(size_t i = first; i < entries.size(); ++i)
+    {
+        const auto& entry = entries[i];
+        auto& message = messages[i - first];
+
+        message.cursor = static_cast<tego_message_cursor_t>(entry.sequence);
+        message.timestamp = static_cast<tego_time_t>(entry.time);
+        message.message_id = entry.identifier;
+        message.type = static_cast<tego_message_type_t>(entry.type);
+        message.status = static_cast<tego_message_status_t>(entry.status);
+        message.is_outgoing = entry.isOutgoing ? TEGO_TRUE : TEGO_FALSE;
+        message.text_offset = textOffset;
+        message.text_length = static_cast<size_t>(entry.text.size());
+
+        std::copy(entry.text.begin(), entry.text.end(), textBuffer + textOffset);
+        textOffset += message.text_length;
+    }
+
+    *nextCursor = (first < entries.size()) ? static_cast<tego_message_cursor_t>(entries[first].sequence) : 0;
+    return entries.size() - first;
+}
+
+tego_message_cursor_t tego_context::get_message_cursor(
+    tego_user_id_t const* user,
+    tego_message_id_t messageId,
+    bool isOutgoing)
+{
+    TEGO_THROW_IF_NULL(user);
+
+    auto contactUser = this->getContactUser(user);
+    TEGO_THROW_IF_NULL(contactUser);
+    TEGO_THROW_IF_FALSE_MSG(!historyDirectory.isEmpty(), "Conversation history is not being stored");
+    std::unique_ptr<ConversationStore> openedStore;
+    auto store = this->getConversationStore(contactUser, openedStore);
+
+    const auto sequence = (store != nullptr) ? store->find(messageId, isOutgoing) : -1;
+    TEGO_THROW_IF_FALSE_MSG(sequence >= 0, "Message {} is not in the conversation history", messageId);
+
+    return static_cast<tego_message_cursor_t>(sequence);
+}
+
+tego_message_cursor_t tego_context::get_message_cursor_at_time(
+    tego_user_id_t const* user,
+    tego_time_t timestamp)
+{
+    TEGO_THROW_IF_NULL(user);
+
+    auto contactUser = this->getContactUser(user);
+    TEGO_THROW_IF_NULL(contactUser);
+    TEGO_THROW_IF_FALSE_MSG(!historyDirectory.isEmpty(), "Conversation history is not being stored");
+    std::unique_ptr<ConversationStore> openedStore;
+    auto store = this->getConversationStore(contactUser, openedStore);
+    if (store == nullptr)
+    {
+        return 0;
+    }
+
+    const auto time = static_cast<qint64>(std::min(timestamp, static_cast<tego_time_t>(std::numeric_limits<qint64>::max())));
+    const auto sequence = store->findTime(time);
+    TEGO_THROW_IF_FALSE_MSG(sequence >= 0, "Cannot read the conversation history");
+
+    return static_cast<tego_message_cursor_t>(sequence);
+}
+
+size_t tego_context::search_messages(
+    tego_user_id_t const* user,
+    const std::string& query,
+    tego_search_result_t* results,
+    size_t resultsLength)
+{
+    TEGO_THROW_IF_NULL(user);
+    TEGO_THROW_IF_FALSE(results != nullptr || resultsLength == 0);
+
+    auto contactUser = this->getContactUser(user);
+    TEGO_THROW_IF_NULL(contactUser);
+    TEGO_THROW_IF_FALSE_MSG(!historyDirectory.isEmpty(), "Conversation history is not being stored");
+    std::unique_ptr<SearchIndex> openedIndex;
+    auto searchIndex = this->getSearchIndex(contactUser, openedIndex);
+    if (searchIndex == nullptr)
+    {
+        return 0;
+    }
+
+    const auto limit = static_cast<int>(std::min(resultsLength, static_cast<size_t>(std::numeric_limits<int>::max())));
+    const auto matches = searchIndex->search(QString::fromStdString(query), limit);
+
+    for(size_t i = 0; i < matches.size(); ++i)
+    {
+        results[i].cursor = static_cast<tego_message_cursor_t>(matches[i].sequence);
+        results[i].score = matches[i].score;
+    }
+    return matches.size();
+}
+
+//
+// tego_context private methods
+//
+
+ContactUser* tego_context::getContactUser(tego_user_id_t const* user) const
+{
+    // the service id was validated when the user id was created
+    auto contactsManager = getIdentity(user)->getContacts();
+    auto contactUser = contactsManager->lookupServiceId(
+        QByteArray::fromRawData(
+            user->serviceId.data,
+            TEGO_V3_ONION_SERVICE_ID_LENGTH));
+
+    return contactUser;
+}
+
+ConversationStore* tego_context::getConversationStore(ContactUser* contactUser, std::unique_ptr<ConversationStore>& opened) const
+{
+    if (contactUser->hasConversation())
+    {
+        return contactUser->conversation()->store();
+    }
+
+    // opening a store creates its directory, which contacts without history shouldn't get
+    const auto directory = ConversationModel::storeDirectory(contactUser);
+    if (directory.isEmpty() || !QFileInfo(directory).isDir())
+    {
+        return nullptr;
+    }
+
+    opened = std::make_unique<ConversationStore>(directory, historyKey);
+    return opened.get();
+}
+
+SearchIndex* tego_context::getSearchIndex(ContactUser* contactUser, std::unique_ptr<SearchIndex>& opened) const
+{
+    if (contactUser->hasConversation())
+    {
+        return contactUser->conversation()->searchIndex();
+    }
+
+    const auto directory = ConversationModel::storeDirectory(contactUser);
+    if (directory.isEmpty() || !QFileInfo(directory).isDir())
+    {
+        return nullptr;
+    }
+
+    opened = std::make_unique<SearchIndex>(directory + QStringLiteral("/search.idx"), historyKey);
+    return opened.get();
+}
+
+UserIdentity* tego_context::getIdentity(tego_user_id_t const* user) const
+{
+    TEGO_THROW_IF_NULL(user);
+    TEGO_THROW_IF_NULL(identityManager);
+
+    if (!user->identity.has_value())
+    {
+        return identityManager->identities().first();
+    }
+
+    auto userIdentity = identityManager->lookupServiceId(
+        QByteArray::fromRawData(
+            user->identity->data,
+            TEGO_V3_ONION_SERVICE_ID_LENGTH));
+    if (userIdentity == nullptr)
+    {
+        TEGO_THROW_MSG("Unknown identity with service id : '{}'", user->identity->data);
+    }
+    return userIdentity;
+}
+
+UserIdentity* tego_context::lookupIdentity(tego_user_id_t const* identity) const
+{
+    TEGO_THROW_IF_NULL(identity);
+    TEGO_THROW_IF_NULL(identityManager);
+
+    auto userIdentity = identityManager->lookupServiceId(
+        QByteArray::fromRawData(
+            identity->serviceId.data,
+            TEGO_V3_ONION_SERVICE_ID_LENGTH));
+    if (userIdentity == nullptr)
+    {
+        TEGO_THROW_MSG("Unknown identity with service id : '{}'", identity->serviceId.data);
+    }
+    return userIdentity;
+}
+
+QString tego_context::keyBlobFromPrivateKey(tego_ed25519_private_key_t const* privateKey)
+{
+    char rawKeyBlob[TEGO_ED25519_KEYBLOB_SIZE] = {0};
+    tego_ed25519_keyblob_from_ed25519_private_key(
+        rawKeyBlob,
+        sizeof(rawKeyBlob),
+        privateKey,
+        tego::throw_on_error());
+
+    return QString::fromUtf8(rawKeyBlob, TEGO_ED25519_KEYBLOB_LENGTH);
+}
+
+void tego_context::validateUserBuffers(
+    tego_user_id_t const* const* userBuffer,
+    tego_user_type_t* const userTypeBuffer,
+    size_t userCount)
+{
+    if (userCount > 0)
+    {
+        TEGO_THROW_IF_NULL(userBuffer);
+        TEGO_THROW_IF_NULL(userTypeBuffer);
+    }
+    else
+    {
+        TEGO_THROW_IF_NOT_NULL(userBuffer);
+        TEGO_THROW_IF_NOT_NULL(userTypeBuffer);
+    }
+
+    // checked before anything is created, so bad input leaves no state behind
+    for(size_t k = 0; k < userCount; k++)
+    {
+        TEGO_THROW_IF_NULL(userBuffer[k]);
+        const auto userType = userTypeBuffer[k];
+        if (userType == tego_user_type_host)
+        {
+            TEGO_THROW_MSG("passed in userTypeBuffer[{}] is invalid type 'tego_user_type_host'", k);
+        }
+        else if (userType < tego_user_type_host || userType > tego_user_type_rejected)
+        {
+            TEGO_THROW_MSG("passed in userTypeBuffer[{}] : ({}) is invalid", k, static_cast<int>(userType));
+        }
+    }
+}
+
+void tego_context::loadUsers(
+    UserIdentity* userIdentity,
+    tego_user_id_t const* const* userBuffer,
+    tego_user_type_t* const userTypeBuffer,
+    size_t userCount)
+{
+    // our different types of users
+    QList<QString> allowedUsers;
+    QList<QString> requestingUsers;
+    QList<QString> blockedUsers;
+    QList<QString> pendingUsers;
+    QList<QString> rejectedUsers;
+
+    for(size_t k = 0; k < userCount; k++)
+    {
+        const auto userType = userTypeBuffer[k];
+        const auto userHostname = QString::fromUtf8(userBuffer[k]->serviceId.data, TEGO_V3_ONION_SERVICE_ID_LENGTH) + ".onion";
+
+        switch(userTypeBuffer[k])
+        {
+            case tego_user_type_host:
+                TEGO_THROW_MSG("passed in userTypeBuffer[{}] is invalid type 'tego_user_type_host'", k);
+                break;
+            case tego_user_type_allowed:
+                allowedUsers.push_back(userHostname);
+                break;
+            case tego_user_type_requesting:
+                requestingUsers.push_back(userHostname);
+                break;
+            case tego_user_type_blocked:
+                blockedUsers.push_back(userHostname);
+                break;
+            case tego_user_type_pending:
+                pendingUsers.push_back(userHostname);
+                break;
+            case tego_user_type_rejected:
+                rejectedUsers.push_back(userHostname);
+                break;
+            default:
+                TEGO_THROW_MSG("passed in userTypeBuffer[{}] : ({}) is invalid", k, static_cast<int>(userType));
+                break;
+        }
+    }
+
+    auto contactsManager = userIdentity->getContacts();
+    contactsManager->loadContacts(allowedUsers, requestingUsers, blockedUsers, pendingUsers, rejectedUsers);
 
-//
-// tego_context private methods
-//
+    this->callback_registry_.emit_users_loaded(userCount);
+}
 
-ContactUser* tego_context::getContactUser(tego_user_id_t const* user) const
+void tego_context::emitConnectionStats()
 {
-    TEGO_THROW_IF_NULL(user);
-    TEGO_THROW_IF_NULL(identityManager);
+    if (this->identityManager == nullptr)
+    {
+        return;
+    }
 
-    auto contactsManager = identityManager->identities().first()->getContacts();
-    auto contactUser = contactsManager->lookupHostname(
-        QString::fromUtf8(
-            user->serviceId.data,
-            TEGO_V3_ONION_SERVICE_ID_LENGTH));
+    for(auto userIdentity : identityManager->identities())
+    for(auto contactUser : userIdentity->getContacts()->contacts())
+    {
+        const auto& connection = contactUser->connection();
+        if (!connection || !connection->isConnected())
+        {
+            continue;
+        }
 
-    return contactUser;
+        auto stats = std::make_unique<tego_connection_stats_t>(toTegoConnectionStats(connection->statistics()));
+        this->callback_registry_.emit_connection_stats(contactUser->toTegoUserId().release(), stats.release());
+    }
 }
 
 //
@@ -922,6 +1425,97 @@ extern "C"
         }, error);
     }
 
+    void tego_context_add_identity(
+        tego_context_t* context,
+        tego_ed25519_private_key_t const* privateKey,
+        tego_user_id_t const* const* userBuffer,
+        tego_user_type_t* const userTypeBuffer,
+        size_t userCount,
+        tego_user_id_t** out_identity,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+            if (out_identity != nullptr)
+            {
+                TEGO_THROW_IF_NOT_NULL(*out_identity);
+            }
+
+            auto identity = context->add_identity(
+                privateKey,
+                userBuffer,
+                userTypeBuffer,
+                userCount);
+            if (out_identity != nullptr)
+            {
+                *out_identity = identity.release();
+            }
+        }, error);
+    }
+
+    void tego_context_remove_identity(
+        tego_context_t* context,
+        const tego_user_id_t* identity,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+
+            context->remove_identity(identity);
+        }, error);
+    }
+
+    void tego_context_get_identities(
+        const tego_context_t* context,
+        tego_user_id_t** out_identitiesBuffer,
+        size_t identitiesBufferLength,
+        size_t* out_identityCount,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+            TEGO_THROW_IF_NULL(out_identitiesBuffer);
+            TEGO_THROW_IF_NULL(out_identityCount);
+
+            auto identities = context->get_identities();
+            const auto identityCount = std::min(identities.size(), identitiesBufferLength);
+            for(size_t i = 0; i < identities.size(); ++i)
+            {
+                if (i < identityCount)
+                {
+                    out_identitiesBuffer[i] = identities[i];
+                }
+                else
+                {
+                    tego_user_id_delete(identities[i]);
+                }
+            }
+            *out_identityCount = identityCount;
+        }, error);
+    }
+
+    void tego_context_get_identity_onion_service_state(
+        const tego_context_t* context,
+        const tego_user_id_t* identity,
+        tego_host_onion_service_state_t* out_state,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+            TEGO_THROW_IF_NULL(out_state);
+
+            *out_state = context->get_identity_onion_service_state(identity);
+        }, error);
+    }
+
     void tego_context_get_host_user_id(
         const tego_context_t* context,
         tego_user_id_t** out_hostUser,
@@ -1183,6 +1777,141 @@ extern "C"
         }, error);
     }
 
+    void tego_context_send_messages(
+        tego_context_t* context,
+        const tego_user_id_t* user,
+        const char* const* messages,
+        const size_t* messageLengths,
+        size_t messageCount,
+        tego_message_id_t* out_ids,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+            TEGO_THROW_IF_NULL(user);
+            TEGO_THROW_IF_FALSE(messageCount == 0 || (messages != nullptr && messageLengths != nullptr));
+
+            std::vector<std::string> texts;
+            texts.reserve(messageCount);
+            for(size_t i = 0; i < messageCount; ++i)
+            {
+                TEGO_THROW_IF_NULL(messages[i]);
+                TEGO_THROW_IF_FALSE(messageLengths[i] > 0);
+                texts.emplace_back(messages[i], messageLengths[i]);
+            }
+
+            auto ids = context->send_messages(user, texts);
+            if (out_ids != nullptr)
+            {
+                std::copy(ids.begin(), ids.end(), out_ids);
+            }
+        }, error);
+    }
+
+    void tego_context_set_message_batch_delay(
+        tego_context_t* context,
+        uint32_t delayMilliseconds,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+
+            context->set_message_batch_delay(delayMilliseconds);
+        }, error);
+    }
+
+    void tego_context_set_message_retry_policy(
+        tego_context_t* context,
+        uint32_t maxAttempts,
+        uint32_t maxAgeSeconds,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+
+            context->set_message_retry_policy(maxAttempts, maxAgeSeconds);
+        }, error);
+    }
+
+    void tego_context_set_max_message_length(
+        tego_context_t* context,
+        uint32_t maxCharacters,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+
+            context->set_max_message_length(maxCharacters);
+        }, error);
+    }
+
+    void tego_context_set_max_connecting(
+        tego_context_t* context,
+        uint32_t maxConnecting,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+
+            context->set_max_connecting(maxConnecting);
+        }, error);
+    }
+
+    void tego_context_set_idle_connection_timeout(
+        tego_context_t* context,
+        uint32_t timeoutSeconds,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+
+            context->set_idle_connection_timeout(timeoutSeconds);
+        }, error);
+    }
+
+    void tego_context_set_keepalive_interval(
+        tego_context_t* context,
+        uint32_t intervalSeconds,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+
+            context->set_keepalive_interval(intervalSeconds);
+        }, error);
+    }
+
+    void tego_context_set_incoming_connection_limits(
+        tego_context_t* context,
+        uint32_t maxPending,
+        uint32_t acceptRate,
+        uint32_t acceptBurst,
+        uint32_t handshakeTimeoutSeconds,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+
+            context->set_incoming_connection_limits(maxPending, acceptRate, acceptBurst, handshakeTimeoutSeconds);
+        }, error);
+    }
+
     void tego_context_forget_user(
         tego_context_t* context,
         const tego_user_id_t* user,
@@ -1195,4 +1924,146 @@ extern "C"
             context->forget_user(user);
         }, error);
     }
+
+    void tego_context_get_connection_stats(
+        const tego_context_t* context,
+        const tego_user_id_t* user,
+        tego_connection_stats_t* out_stats,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+            TEGO_THROW_IF_NULL(user);
+            TEGO_THROW_IF_NULL(out_stats);
+
+            *out_stats = context->get_connection_stats(user);
+        }, error);
+    }
+
+    void tego_context_set_connection_stats_interval(
+        tego_context_t* context,
+        uint32_t intervalSeconds,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+
+            context->set_connection_stats_interval(intervalSeconds);
+        }, error);
+    }
+
+    void tego_context_set_history_directory(
+        tego_context_t* context,
+        const char* directory,
+        size_t directoryLength,
+        const uint8_t* key,
+        size_t keyLength,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+            TEGO_THROW_IF_FALSE(directory != nullptr || directoryLength == 0);
+            TEGO_THROW_IF_FALSE(keyLength == 0 || (key != nullptr && keyLength == ConversationStore::KeySize));
+
+            context->set_history_directory(
+                QString::fromUtf8(directory, static_cast<int>(directoryLength)),
+                QByteArray(reinterpret_cast<const char*>(key), static_cast<int>(keyLength)));
+        }, error);
+    }
+
+    void tego_context_get_messages(
+        tego_context_t* context,
+        const tego_user_id_t* user,
+        tego_message_cursor_t cursor,
+        tego_history_message_t* out_messages,
+        size_t messagesLength,
+        char* textBuffer,
+        size_t textBufferSize,
+        size_t* out_messageCount,
+        tego_message_cursor_t* out_nextCursor,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+            TEGO_THROW_IF_NULL(out_messageCount);
+            TEGO_THROW_IF_NULL(out_nextCursor);
+
+            *out_messageCount = context->get_messages(
+                user,
+                cursor,
+                out_messages,
+                messagesLength,
+                textBuffer,
+                textBufferSize,
+                out_nextCursor);
+        }, error);
+    }
+
+    void tego_context_get_message_cursor(
+        tego_context_t* context,
+        const tego_user_id_t* user,
+        tego_message_id_t messageId,
+        tego_bool_t isOutgoing,
+        tego_message_cursor_t* out_cursor,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+            TEGO_THROW_IF_NULL(out_cursor);
+
+            *out_cursor = context->get_message_cursor(user, messageId, isOutgoing == TEGO_TRUE);
+        }, error);
+    }
+
+    void tego_context_get_message_cursor_at_time(
+        tego_context_t* context,
+        const tego_user_id_t* user,
+        tego_time_t timestamp,
+        tego_message_cursor_t* out_cursor,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+            TEGO_THROW_IF_NULL(out_cursor);
+
+            *out_cursor = context->get_message_cursor_at_time(user, timestamp);
+        }, error);
+    }
+
+    void tego_context_search_messages(
+        tego_context_t* context,
+        const tego_user_id_t* user,
+        const char* query,
+        size_t queryLength,
+        tego_search_result_t* out_results,
+        size_t resultsLength,
+        size_t* out_resultCount,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(context);
+            TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+            TEGO_THROW_IF_NULL(query);
+            TEGO_THROW_IF_NULL(out_resultCount);
+
+            *out_resultCount = context->search_messages(
+                user,
+                std::string(query, queryLength),
+                out_results,
+                resultsLength);
+        }, error);
+    }
 }
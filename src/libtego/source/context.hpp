@@ -4,9 +4,11 @@
 #include "tor.hpp"
 #include "user.hpp"
 
+#include "tor/ConnectScheduler.h"
 #include "tor/TorControl.h"
 #include "tor/TorManager.h"
 #include "core/IdentityManager.h"
+#include "protocol/ChatChannel.h"
 
 //
 // Tego Context
@@ -16,6 +18,7 @@ struct tego_context
 {
 public:
     tego_context();
+    ~tego_context();
 
     void start_tor(const tego_tor_launch_config_t* config);
     bool get_tor_daemon_configured() const;
@@ -33,6 +36,15 @@ public:
         tego_user_type_t* const userTypeBuffer,
         size_t userCount);
     void start_service();
+    std::unique_ptr<tego_user_id_t> add_identity(
+        tego_ed25519_private_key_t const* privateKey,
+        tego_user_id_t const* const* userBuffer,
+        tego_user_type_t* const userTypeBuffer,
+        size_t userCount);
+    void remove_identity(tego_user_id_t const* identity);
+    std::vector<tego_user_id_t*> get_identities() const;
+    tego_host_onion_service_state_t get_identity_onion_service_state(tego_user_id_t const* identity) const;
+    void set_identity_onion_service_state(class UserIdentity* identity, tego_host_onion_service_state_t state);
     void update_tor_daemon_config(const tego_tor_daemon_config_t* config);
     void update_disable_network_flag(bool disableNetwork);
     void save_tor_daemon_config();
@@ -49,6 +61,20 @@ public:
     tego_message_id_t send_message(
         const tego_user_id_t* user,
         const std::string& message);
+    std::vector<tego_message_id_t> send_messages(
+        const tego_user_id_t* user,
+        const std::vector<std::string>& messages);
+    void set_message_batch_delay(uint32_t delayMilliseconds);
+    void set_message_retry_policy(uint32_t maxAttempts, uint32_t maxAgeSeconds);
+    void set_max_message_length(uint32_t maxCharacters);
+    void set_max_connecting(uint32_t maxConnecting);
+    void set_idle_connection_timeout(uint32_t timeoutSeconds);
+    void set_keepalive_interval(uint32_t intervalSeconds);
+    void set_incoming_connection_limits(
+        uint32_t maxPending,
+        uint32_t acceptRate,
+        uint32_t acceptBurst,
+        uint32_t handshakeTimeoutSeconds);
     tego_user_type_t get_user_type(tego_user_id_t const* user) const;
     size_t get_user_count() const;
     std::vector<tego_user_id_t*> get_users() const;
@@ -64,6 +90,29 @@ public:
     void cancel_file_transfer_transfer(
         tego_user_id_t const* user,
         tego_file_transfer_id_t);
+    tego_connection_stats_t get_connection_stats(tego_user_id_t const* user) const;
+    void set_connection_stats_interval(uint32_t intervalSeconds);
+    void set_history_directory(const QString& directory, const QByteArray& key);
+    size_t get_messages(
+        tego_user_id_t const* user,
+        tego_message_cursor_t cursor,
+        tego_history_message_t* messages,
+        size_t messagesLength,
+        char* textBuffer,
+        size_t textBufferSize,
+        tego_message_cursor_t* nextCursor);
+    tego_message_cursor_t get_message_cursor(
+        tego_user_id_t const* user,
+        tego_message_id_t messageId,
+        bool isOutgoing);
+    tego_message_cursor_t get_message_cursor_at_time(
+        tego_user_id_t const* user,
+        tego_time_t timestamp);
+    size_t search_messages(
+        tego_user_id_t const* user,
+        const std::string& query,
+        tego_search_result_t* results,
+        size_t resultsLength);
 
     tego::callback_registry callback_registry_;
     tego::callback_queue callback_queue_;
@@ -71,11 +120,33 @@ public:
     // this 'global' (actually per tego_context) mutex
     std::mutex mutex_;
 
-    // TODO: figure out ownership of these Qt types
+    // owned by the context; nothing here is shared with other contexts
     Tor::TorManager* torManager = nullptr;
     Tor::TorControl* torControl = nullptr;
+    Tor::ConnectScheduler* connectScheduler = nullptr;
     IdentityManager* identityManager = nullptr;
 
+    // conversation history is stored beneath this directory, if set
+    QString historyDirectory;
+    QByteArray historyKey;
+
+    // undelivered messages are given up on after this many attempts or seconds, 0 for no limit
+    int messageRetryAttempts = 2;
+    int messageRetrySeconds = 0;
+
+    // settings for the connections and channels of this context, see
+    // set_message_batch_delay, set_max_message_length and set_idle_connection_timeout
+    int messageBatchDelay = 0;
+    int maxMessageCharacters = Protocol::ChatChannel::DefaultMaxMessageCharacters;
+    int idleConnectionTimeout = 0;
+    // seconds between keepalives on each connection, 0 to disable, see set_keepalive_interval
+    int keepAliveInterval = 60;
+    // admission control for incoming connections to every identity, see set_incoming_connection_limits
+    int incomingMaxPending = 32;
+    int incomingAcceptRate = 4;
+    int incomingAcceptBurst = 16;
+    int incomingHandshakeTimeout = 15;
+
     // we store the thread id that this context is associated with
     // calls which go into our qt internals must be called from the same
     // thread as the context was created on
@@ -84,8 +155,29 @@ public:
     std::thread::id threadId;
 private:
     class ContactUser* getContactUser(const tego_user_id_t*) const;
+    // the history of a contact, from its conversation if it has one; otherwise
+    // opened into opened for the duration of the call, so reading history
+    // doesn't create a conversation. null if the contact has no history yet
+    class ConversationStore* getConversationStore(class ContactUser* contactUser, std::unique_ptr<class ConversationStore>& opened) const;
+    class SearchIndex* getSearchIndex(class ContactUser* contactUser, std::unique_ptr<class SearchIndex>& opened) const;
+    // the identity a user id is scoped to, or the first identity
+    class UserIdentity* getIdentity(const tego_user_id_t* user) const;
+    // the identity whose own user id is given
+    class UserIdentity* lookupIdentity(const tego_user_id_t* identity) const;
+    static QString keyBlobFromPrivateKey(tego_ed25519_private_key_t const* privateKey);
+    static void validateUserBuffers(
+        tego_user_id_t const* const* userBuffer,
+        tego_user_type_t* const userTypeBuffer,
+        size_t userCount);
+    void loadUsers(
+        class UserIdentity* userIdentity,
+        tego_user_id_t const* const* userBuffer,
+        tego_user_type_t* const userTypeBuffer,
+        size_t userCount);
+    void emitConnectionStats();
 
     mutable std::string torVersion;
     mutable std::vector<std::string> torLogs;
     tego_host_onion_service_state_t hostUserState = tego_host_onion_service_state_none;
+    std::unique_ptr<QTimer> connectionStatsTimer;
 };
\ No newline at end of file
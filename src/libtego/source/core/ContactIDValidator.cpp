@@ -30,7 +30,6 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include "IdentityManager.h"
 #include "ContactIDValidator.h"
 #include "utils/StringUtil.h"
 
@@ -38,9 +37,9 @@
 // and segfaults, so make it thread_local to sidestep the issue for now
 static thread_local QRegularExpression regex(QStringLiteral("ricochet:([a-z2-7]{56})"));
 
-ContactIDValidator::ContactIDValidator(QObject *parent)
+ContactIDValidator::ContactIDValidator(UserIdentity *identity, QObject *parent)
     : QRegularExpressionValidator(parent)
-    , m_uniqueIdentity(identityManager->identities()[0])
+    , m_uniqueIdentity(identity)
 {
     setRegularExpression(regex);
 }
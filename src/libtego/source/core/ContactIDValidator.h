@@ -41,7 +41,8 @@ class ContactIDValidator : public QRegularExpressionValidator
     Q_DISABLE_COPY(ContactIDValidator)
 
 public:
-    ContactIDValidator(QObject *parent = 0);
+    // identity : the identity whose own id and contacts are rejected
+    explicit ContactIDValidator(UserIdentity *identity, QObject *parent = 0);
 
     static bool isValidID(const QString &text);
     static QString hostnameFromID(const QString &ID);
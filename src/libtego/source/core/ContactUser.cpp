@@ -39,14 +39,14 @@
 #include "core/OutgoingContactRequest.h"
 #include "core/ConversationModel.h"
 #include "tor/HiddenService.h"
+#include "protocol/FileChannel.h"
 #include "protocol/OutboundConnector.h"
 
 #include "ed25519.hpp"
 #include "context.hpp"
 #include "user.hpp"
-#include "globals.hpp"
 
-ContactUser::ContactUser(UserIdentity *ident, const QString& hostname, Status status, QObject *parent)
+ContactUser::ContactUser(UserIdentity *ident, const QString& hostname, Status status, QObject *parent, bool deferConnect)
     : QObject(parent)
     , identity(ident)
     , m_connection(0)
@@ -56,16 +56,41 @@ ContactUser::ContactUser(UserIdentity *ident, const QString& hostname, Status st
     , m_contactRequest(0)
     , m_conversation(0)
     , m_hostname(hostname)
+    , m_idleTimer(0)
+    , m_idleActivity(0)
+    , m_hibernateTimer(0)
+    , m_storedLastMessageRead(false)
+    , m_hibernating(false)
+    , m_waking(false)
+    , m_connectDeferred(false)
 {
     Q_ASSERT(hostname.endsWith(".onion"));
 
-    const auto serviceId = hostname.chopped(tego::static_strlen(".onion"));
-
-    m_conversation = new ConversationModel(this);
-    m_conversation->setContact(this);
+    // Messages waiting in the outbox must be queued, which needs the conversation now
+    if (ConversationModel::hasStoredOutbox(this))
+        conversation();
 
     updateStatus();
-    updateOutgoingSocket();
+    if (deferConnect && !m_conversation && m_status == Offline)
+        m_connectDeferred = true;
+    else
+        updateOutgoingSocket();
+}
+
+ConversationModel *ContactUser::conversation()
+{
+    if (!m_conversation) {
+        m_conversation = new ConversationModel(this);
+        connect(m_conversation, &ConversationModel::unreadCountChanged, this, &ContactUser::unreadCountChanged);
+        m_conversation->setContact(this);
+    }
+    return m_conversation;
+}
+
+void ContactUser::startConnecting()
+{
+    if (m_connectDeferred)
+        updateOutgoingSocket();
 }
 
 void ContactUser::createContactRequest(const QString& msg)
@@ -95,6 +120,10 @@ void ContactUser::updateStatus()
     } else if (m_connection && m_connection->isConnected()) {
         newStatus = Online;
         logger::trace();
+    } else if (m_hibernating) {
+        // Still presumed reachable; the connection was only closed for being
+        // idle, and is probed again within HibernateProbeInterval
+        newStatus = Online;
     } else if (m_status == RequestRejected) {
         newStatus = RequestRejected;
     } else {
@@ -113,10 +142,10 @@ void ContactUser::updateStatus()
         switch(newStatus)
         {
             case ContactUser::Online:
-                tego::g_globals.context->callback_registry_.emit_user_status_changed(userId.release(), tego_user_status_online);
+                identity->context->callback_registry_.emit_user_status_changed(userId.release(), tego_user_status_online);
                 break;
             case ContactUser::Offline:
-                tego::g_globals.context->callback_registry_.emit_user_status_changed(userId.release(), tego_user_status_offline);
+                identity->context->callback_registry_.emit_user_status_changed(userId.release(), tego_user_status_offline);
                 break;
             default:
 
@@ -133,7 +162,10 @@ void ContactUser::updateStatus()
 
 void ContactUser::updateOutgoingSocket()
 {
-    if (m_status != Offline && m_status != RequestPending) {
+    m_connectDeferred = false;
+
+    bool waking = m_hibernating && !m_connection;
+    if (m_status != Offline && m_status != RequestPending && !waking) {
         if (m_outgoingSocket) {
             m_outgoingSocket->disconnect(this);
             m_outgoingSocket->abort();
@@ -155,7 +187,7 @@ void ContactUser::updateOutgoingSocket()
     }
 
     if (!m_outgoingSocket) {
-        m_outgoingSocket = new Protocol::OutboundConnector(this);
+        m_outgoingSocket = new Protocol::OutboundConnector(identity->context, this);
         m_outgoingSocket->setAuthPrivateKey(identity->hiddenService()->privateKey());
         connect(m_outgoingSocket, &Protocol::OutboundConnector::ready, this,
             [this]() {
@@ -164,9 +196,183 @@ void ContactUser::updateOutgoingSocket()
         );
     }
 
+    updateConnectPriority();
     m_outgoingSocket->connectToHost(hostname(), port());
 }
 
+void ContactUser::updateConnectPriority()
+{
+    if (!m_outgoingSocket)
+        return;
+
+    // Conversations within this many days count as recent
+    const int RecentActivityDays = 7;
+
+    /* Most contacts have no conversation until there's something to show or
+     * send; a stored outbox creates one, so without it nothing is undelivered,
+     * and the time of the last message comes from the stored history. That is
+     * read once, as anything newer creates the conversation. */
+    QDateTime lastMessage;
+    if (m_conversation) {
+        lastMessage = m_conversation->lastMessageTime();
+    } else {
+        if (!m_storedLastMessageRead) {
+            m_storedLastMessage = ConversationModel::storedLastMessageTime(this);
+            m_storedLastMessageRead = true;
+        }
+        lastMessage = m_storedLastMessage;
+    }
+
+    auto priority = Tor::ConnectScheduler::LowPriority;
+    if (m_conversation && m_conversation->hasUndeliveredMessages())
+        priority = Tor::ConnectScheduler::HighPriority;
+    else if (lastMessage.isValid() && lastMessage.daysTo(QDateTime::currentDateTime()) < RecentActivityDays)
+        priority = Tor::ConnectScheduler::NormalPriority;
+
+    m_outgoingSocket->setConnectPriority(priority);
+}
+
+int ContactUser::idleTimeout() const
+{
+    return qMax(identity->context->idleConnectionTimeout, 0);
+}
+
+void ContactUser::connectionNeeded()
+{
+    startConnecting();
+
+    if (m_hibernating && !m_connection && !m_waking) {
+        qDebug() << "Reconnecting hibernating connection to" << m_hostname;
+        wake();
+    }
+
+    updateConnectPriority();
+}
+
+void ContactUser::startHibernating()
+{
+    if (m_idleTimer)
+        m_idleTimer->stop();
+    m_hibernating = true;
+    m_waking = false;
+
+    if (!m_hibernateTimer) {
+        m_hibernateTimer = new QTimer(this);
+        m_hibernateTimer->setSingleShot(true);
+        connect(m_hibernateTimer, &QTimer::timeout, this, &ContactUser::hibernateTimeout);
+    }
+
+    // Jittered so that both sides of a hibernating pair don't probe at once
+    const unsigned jitter = SecureRNG::randomInt(HibernateProbeInterval / 10 + 1);
+    m_hibernateTimer->start((HibernateProbeInterval + static_cast<int>(jitter)) * 1000);
+}
+
+void ContactUser::wake()
+{
+    m_waking = true;
+    updateOutgoingSocket();
+    // Give up on the contact being reachable if the reconnect takes too long
+    m_hibernateTimer->start(WakeTimeout * 1000);
+}
+
+void ContactUser::hibernateTimeout()
+{
+    if (!m_hibernating || m_connection)
+        return;
+
+    if (!m_waking) {
+        qDebug() << "Probing hibernating contact" << m_hostname;
+        wake();
+        return;
+    }
+
+    qDebug() << "Hibernating contact" << m_hostname << "didn't reconnect; marking offline";
+    m_hibernating = false;
+    m_waking = false;
+    updateStatus();
+}
+
+void ContactUser::startIdleTimer()
+{
+    const int timeout = idleTimeout();
+    if (timeout <= 0) {
+        if (m_idleTimer)
+            m_idleTimer->stop();
+        return;
+    }
+
+    if (!m_idleTimer) {
+        m_idleTimer = new QTimer(this);
+        connect(m_idleTimer, &QTimer::timeout, this, &ContactUser::checkIdle);
+    }
+
+    m_idleActivity = connectionActivity();
+    m_idleTimer->start(timeout * 1000);
+}
+
+/* Packets sent and received other than on the control channel, which carries
+ * keepalives that shouldn't keep the connection from hibernating */
+quint64 ContactUser::connectionActivity() const
+{
+    if (!m_connection)
+        return 0;
+
+    const auto stats = m_connection->statistics();
+    const QString control = QStringLiteral("control");
+    return stats.packetsSent + stats.packetsReceived
+        - stats.packetsSentByType.value(control) - stats.packetsReceivedByType.value(control);
+}
+
+/* Called every idleTimeout seconds while connected, so a connection is closed
+ * after between one and two timeouts without activity */
+void ContactUser::checkIdle()
+{
+    if (idleTimeout() <= 0 || !m_connection || !m_connection->isConnected() || m_status != Online) {
+        m_idleTimer->stop();
+        return;
+    }
+
+    const quint64 activity = connectionActivity();
+    if (activity != m_idleActivity) {
+        m_idleActivity = activity;
+        return;
+    }
+
+    // Without support, the peer would see a disconnect and reconnect at once
+    if (!m_connection->peerSupportsHibernate()) {
+        m_idleTimer->stop();
+        return;
+    }
+
+    // Don't interrupt anything that's in progress
+    if (m_conversation && m_conversation->hasUndeliveredMessages())
+        return;
+    for (auto channel : m_connection->findChannels<Protocol::FileChannel>()) {
+        if (channel->hasActiveTransfers())
+            return;
+    }
+
+    hibernate();
+}
+
+void ContactUser::hibernate()
+{
+    qDebug() << "Closing idle connection to" << m_hostname;
+
+    startHibernating();
+    // onDisconnected follows, and the contact stays Online without a connection
+    m_connection->hibernate();
+}
+
+void ContactUser::onPeerHibernating()
+{
+    if (m_status != Online || m_hibernating)
+        return;
+
+    qDebug() << "Contact" << m_hostname << "closed an idle connection";
+    startHibernating();
+}
+
 void ContactUser::onConnected()
 {
     if (!m_connection || !m_connection->isConnected()) {
@@ -181,10 +387,21 @@ void ContactUser::onConnected()
         m_contactRequest->sendRequest(m_connection);
     }
 
+    const bool wasHibernating = m_hibernating;
+    m_hibernating = false;
+    m_waking = false;
+    if (m_hibernateTimer)
+        m_hibernateTimer->stop();
     updateStatus();
+    // The status didn't change, so the outgoing socket used to wake isn't cleaned up otherwise
+    if (wasHibernating)
+        updateOutgoingSocket();
     if (isConnected()) {
+        startIdleTimer();
         emit connected();
         emit connectionChanged(m_connection);
+        // Picks up the connection's channels if it's created here
+        conversation();
     }
 
     if (m_status != Online && m_status != RequestPending) {
@@ -208,6 +425,9 @@ void ContactUser::onDisconnected()
         TEGO_BUG() << "onDisconnected called without a connection";
     }
 
+    if (m_idleTimer)
+        m_idleTimer->stop();
+
     updateStatus();
     emit disconnected();
     emit connectionChanged(m_connection);
@@ -421,6 +641,7 @@ void ContactUser::assignConnection(const QSharedPointer<Protocol::Connection> &c
      * effectively any time we call into protocol code, which would be dangerous.
      */
     connect(m_connection.data(), &Protocol::Connection::closed, this, &ContactUser::onDisconnected, Qt::QueuedConnection);
+    connect(m_connection.data(), &Protocol::Connection::peerHibernating, this, &ContactUser::onPeerHibernating);
 
     /* Delay the call to onConnected to allow protocol code to finish before everything
      * kicks in. In particular, this is important to allow AuthHiddenServiceChannel to
@@ -441,12 +662,5 @@ void ContactUser::clearConnection()
 
 std::unique_ptr<tego_user_id_t> ContactUser::toTegoUserId() const
 {
-    // convert our hostname to just the service id raw string
-    auto serviceIdString = this->hostname().chopped(tego::static_strlen(".onion")).toUtf8();
-    // ensure valid service id
-    auto serviceId = std::make_unique<tego_v3_onion_service_id>(serviceIdString.data(), serviceIdString.size());
-    // create user id object from service id
-    auto userId = std::make_unique<tego_user_id>(*serviceId.get());
-
-    return userId;
+    return identity->toTegoUserId(this->hostname());
 }
\ No newline at end of file
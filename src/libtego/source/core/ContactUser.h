@@ -69,13 +69,18 @@ public:
 
     UserIdentity * const identity;
 
-    explicit ContactUser(UserIdentity *identity, const QString& hostname, Status status=Offline, QObject *parent = 0);
+    /* With deferConnect, no connection attempt is made until startConnecting()
+     * or connectionNeeded() is called; used when loading many contacts at once */
+    explicit ContactUser(UserIdentity *identity, const QString& hostname, Status status=Offline, QObject *parent = 0, bool deferConnect = false);
 
     const QSharedPointer<Protocol::Connection> &connection() { return m_connection; }
     bool isConnected() const { return status() == Online; }
 
     OutgoingContactRequest *contactRequest() { return m_contactRequest; }
-    ConversationModel *conversation() { return m_conversation; }
+    /* The conversation is created on first use, when connected, or at load
+     * if the contact has undelivered messages */
+    ConversationModel *conversation();
+    bool hasConversation() const { return m_conversation != nullptr; }
 
     UserIdentity *getIdentity() const { return identity; }
 
@@ -112,6 +117,29 @@ public slots:
 
     void updateStatus();
 
+    /* Set the priority of connection attempts to this contact: contacts with
+     * undelivered messages first, then those with recent conversations */
+    void updateConnectPriority();
+
+    /* Called when a message or file is queued for this contact without a
+     * connection. Reconnects if the connection is hibernating, and raises
+     * the priority of connection attempts. */
+    void connectionNeeded();
+
+    /* Connections without chat or file traffic for this long are closed
+     * while the contact stays Online, and reopened when something is
+     * queued for the contact or after HibernateProbeInterval; 0 (the
+     * default) keeps connections open. Only connections to peers which
+     * support hibernate are closed. Configured on the identity's context. */
+    int idleTimeout() const;
+
+    // Whether the connection was closed for being idle, see idleTimeout
+    bool isHibernating() const { return m_hibernating; }
+
+    // Whether connection attempts are waiting for startConnecting
+    bool isConnectDeferred() const { return m_connectDeferred; }
+    void startConnecting();
+
 signals:
     void statusChanged();
     void connected();
@@ -120,12 +148,17 @@ signals:
 
     void nicknameChanged();
     void contactDeleted(ContactUser *user);
+    // Forwarded from the conversation, once it exists
+    void unreadCountChanged();
 
 private slots:
     void onConnected();
     void onDisconnected();
     void requestRemoved();
     void requestAccepted();
+    void checkIdle();
+    void onPeerHibernating();
+    void hibernateTimeout();
 
 private:
     QSharedPointer<Protocol::Connection> m_connection;
@@ -137,6 +170,22 @@ private:
     ConversationModel *m_conversation;
     mutable QString m_hostname;
 
+    // Created when first connected, if an idle timeout is set
+    QTimer *m_idleTimer;
+    quint64 m_idleActivity;
+    // Probes a hibernating contact, then bounds how long the probe may take
+    QTimer *m_hibernateTimer;
+    // Time of the newest stored message, read once for updateConnectPriority
+    QDateTime m_storedLastMessage;
+    bool m_storedLastMessageRead;
+    bool m_hibernating;
+    bool m_waking;
+    bool m_connectDeferred;
+    // How long a hibernating contact stays Online before it's probed
+    static const int HibernateProbeInterval = 1800;
+    // How long to wait for a reconnect before a hibernating contact is Offline
+    static const int WakeTimeout = 120;
+
     /* See ContactsManager::addContact */
     static ContactUser *addNewContact(UserIdentity *identity, const QString& contactHostname);
 
@@ -144,6 +193,11 @@ private:
     void updateOutgoingSocket();
 
     void clearConnection();
+    void startIdleTimer();
+    quint64 connectionActivity() const;
+    void hibernate();
+    void startHibernating();
+    void wake();
 };
 
 Q_DECLARE_METATYPE(ContactUser*)
@@ -30,32 +30,82 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include "error.hpp"
+
 #include "ContactsManager.h"
 #include "IncomingRequestManager.h"
 #include "OutgoingContactRequest.h"
 #include "ContactIDValidator.h"
 #include "ConversationModel.h"
 #include "protocol/ChatChannel.h"
+#include "tor/ConnectScheduler.h"
+#include "utils/StringUtil.h"
 
-ContactsManager *contactsManager = 0;
+#include "context.hpp"
 
 ContactsManager::ContactsManager(UserIdentity *id)
     : identity(id), incomingRequests(this)
 {
-    contactsManager = this;
+    // Interval between checks for room to start more deferred connections
+    const int DeferredConnectIntervalMs = 500;
+    m_deferredConnectTimer.setInterval(DeferredConnectIntervalMs);
+    connect(&m_deferredConnectTimer, &QTimer::timeout, this, &ContactsManager::startDeferredConnects);
 }
 
+void ContactsManager::loadContacts(
+    const QList<QString>& allowed,
+    const QList<QString>& requesting,
+    const QList<QString>& blocked,
+    const QList<QString>& pending,
+    const QList<QString>& rejected)
+{
+    const int count = allowed.size() + pending.size() + rejected.size();
+    pContacts.reserve(pContacts.size() + count);
+    m_serviceIdIndex.reserve(m_serviceIdIndex.size() + count);
+
+    addAllowedContacts(allowed);
+    addIncomingRequests(requesting);
+    addRejectedIncomingRequests(blocked);
+    addOutgoingRequests(pending);
+    addRejectedOutgoingRequests(rejected);
+
+    emit contactsLoaded();
+}
 
 // tego_user_type_allowed
 void ContactsManager::addAllowedContacts(const QList<QString>& userHostnames)
 {
     for(const auto& hostname : userHostnames)
     {
-        ContactUser *user = new ContactUser(identity, hostname, ContactUser::Offline, this);
+        ContactUser *user = new ContactUser(identity, hostname, ContactUser::Offline, this, true);
         connectSignals(user);
-        pContacts.append(user);
-        emit contactAdded(user);
+        insertContact(user);
+        if (user->isConnectDeferred())
+            m_deferredConnects.enqueue(user);
+    }
+
+    startDeferredConnects();
+}
+
+/* Start connecting to deferred contacts while the connect scheduler's queue
+ * is short, so that it never holds a socket for every contact at once */
+void ContactsManager::startDeferredConnects()
+{
+    auto scheduler = identity->context->connectScheduler;
+    const int limit = 2 * qMax(scheduler->maxConnecting(), int(Tor::ConnectScheduler::DefaultMaxConnecting));
+
+    while (!m_deferredConnects.isEmpty() &&
+           scheduler->connectingCount() + scheduler->waitingCount() < limit)
+    {
+        QPointer<ContactUser> user = m_deferredConnects.dequeue();
+        if (user)
+            user->startConnecting();
     }
+
+    if (m_deferredConnects.isEmpty())
+        m_deferredConnectTimer.stop();
+    else if (!m_deferredConnectTimer.isActive())
+        m_deferredConnectTimer.start();
 }
 
 // tego_user_type_requesting
@@ -90,7 +140,7 @@ void ContactsManager::addRejectedOutgoingRequests(const QList<QString>& userHost
         ContactUser *user = new ContactUser(identity, hostname, ContactUser::RequestRejected, this);
 
         connect(user, SIGNAL(contactDeleted(ContactUser*)), SLOT(contactDeleted(ContactUser*)));
-        pContacts.append(user);
+        insertContact(user);
 
         // emit contactAdded(user);
     }
@@ -104,7 +154,7 @@ ContactUser *ContactsManager::addContact(const QString& hostname)
 
     qDebug() << "Added new contact" << hostname;
 
-    pContacts.append(user);
+    insertContact(user);
     emit contactAdded(user);
 
     return user;
@@ -113,7 +163,7 @@ ContactUser *ContactsManager::addContact(const QString& hostname)
 void ContactsManager::connectSignals(ContactUser *user)
 {
     connect(user, SIGNAL(contactDeleted(ContactUser*)), SLOT(contactDeleted(ContactUser*)));
-    connect(user->conversation(), &ConversationModel::unreadCountChanged, this, &ContactsManager::onUnreadCountChanged);
+    connect(user, &ContactUser::unreadCountChanged, this, &ContactsManager::onUnreadCountChanged);
     connect(user, &ContactUser::statusChanged, [this,user]() { emit contactStatusChanged(user, user->status()); });
 }
 
@@ -144,45 +194,97 @@ ContactUser *ContactsManager::createContactRequest(const QString &contactid, con
     return user;
 }
 
+void ContactsManager::insertContact(ContactUser *user)
+{
+    pContacts.append(user);
+    m_serviceIdIndex.insert(serviceIdKey(user->hostname()), user);
+}
+
 void ContactsManager::contactDeleted(ContactUser *user)
 {
     pContacts.removeOne(user);
+
+    auto it = m_serviceIdIndex.find(serviceIdKey(user->hostname()));
+    if (it != m_serviceIdIndex.end() && *it == user)
+        m_serviceIdIndex.erase(it);
+}
+
+QByteArray ContactsManager::serviceIdKey(const QByteArray &hostname)
+{
+    QByteArray key = hostname.toLower();
+    if (key.endsWith(".onion"))
+        key.chop(tego::static_strlen(".onion"));
+    return key;
+}
+
+QByteArray ContactsManager::serviceIdKey(const QString &hostname)
+{
+    return serviceIdKey(hostname.toLatin1());
 }
 
 ContactUser *ContactsManager::lookupHostname(const QString &hostname) const
 {
-    QString ohost = ContactIDValidator::hostnameFromID(hostname);
+    // Only ricochet: IDs need the regex; hostnames and service ids are used as they are
+    QString ohost;
+    if (hostname.startsWith(QLatin1String("ricochet:")))
+        ohost = ContactIDValidator::hostnameFromID(hostname);
     if (ohost.isNull())
         ohost = hostname;
 
-    if (!ohost.endsWith(QLatin1String(".onion")))
-        ohost.append(QLatin1String(".onion"));
+    return m_serviceIdIndex.value(serviceIdKey(ohost), nullptr);
+}
 
-    for (QList<ContactUser*>::ConstIterator it = pContacts.begin(); it != pContacts.end(); ++it)
-    {
-        if (ohost.compare((*it)->hostname(), Qt::CaseInsensitive) == 0)
-            return *it;
+ContactUser *ContactsManager::lookupServiceId(const QByteArray &serviceId) const
+{
+    return m_serviceIdIndex.value(serviceId.toLower(), nullptr);
+}
+
+std::optional<tego_user_type_t> ContactsManager::userType(const QByteArray &serviceId) const
+{
+    const QByteArray key = serviceId.toLower();
+
+    if (auto user = m_serviceIdIndex.value(key, nullptr)) {
+        auto const status = user->status();
+        switch (status) {
+            case ContactUser::Online:
+            case ContactUser::Offline:
+                return tego_user_type_allowed;
+            case ContactUser::RequestPending:
+                return tego_user_type_pending;
+            case ContactUser::RequestRejected:
+                return tego_user_type_rejected;
+            default:
+                TEGO_THROW_MSG("Unknown ContactUser::Status : {}", static_cast<int>(status));
+        }
     }
 
-    return 0;
+    if (incomingRequests.requestFromServiceId(key))
+        return tego_user_type_requesting;
+
+    if (incomingRequests.isServiceIdRejected(key))
+        return tego_user_type_blocked;
+
+    if (key == serviceIdKey(identity->hostname()))
+        return tego_user_type_host;
+
+    return std::nullopt;
 }
 
 void ContactsManager::onUnreadCountChanged()
 {
-    ConversationModel *model = qobject_cast<ConversationModel*>(sender());
-    Q_ASSERT(model);
-    if (!model)
+    ContactUser *user = qobject_cast<ContactUser*>(sender());
+    Q_ASSERT(user && user->hasConversation());
+    if (!user || !user->hasConversation())
         return;
-    ContactUser *user = model->contact();
 
-    emit unreadCountChanged(user, model->unreadCount());
+    emit unreadCountChanged(user, user->conversation()->unreadCount());
 }
 
 int ContactsManager::globalUnreadCount() const
 {
     int re = 0;
     foreach (ContactUser *u, pContacts) {
-        if (u->conversation())
+        if (u->hasConversation())
             re += u->conversation()->unreadCount();
     }
     return re;
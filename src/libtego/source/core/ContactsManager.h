@@ -56,7 +56,20 @@ public:
 
     const QList<ContactUser*> &contacts() const { return pContacts; }
     ContactUser *lookupSecret(const QByteArray &secret) const;
+    /* Look up a contact by ricochet: ID, onion hostname, or service id */
     ContactUser *lookupHostname(const QString &hostname) const;
+    /* Look up a contact by its 56 character service id, without parsing or
+     * validation; for callers that already hold a validated service id */
+    ContactUser *lookupServiceId(const QByteArray &serviceId) const;
+
+    /* Classify a service id against the host, contacts, incoming requests and
+     * the blocked list in constant time; empty if the user is unknown */
+    std::optional<tego_user_type_t> userType(const QByteArray &serviceId) const;
+
+    /* Normalize an onion hostname or service id into the lower-case service
+     * id used as the key for contact and request lookups */
+    static QByteArray serviceIdKey(const QByteArray &hostname);
+    static QByteArray serviceIdKey(const QString &hostname);
 
     /* Create a new user and a contact request for that user. Use this instead of addContact.
      * Note that contactID should be an ricochet: ID. */
@@ -67,6 +80,18 @@ public:
 
     static QString hostnameFromID(const QString &ID);
 
+    /* Load the saved users of each type at startup
+     *
+     * Contacts are added without a contactAdded signal each, and connection
+     * attempts to them are started gradually as the connect scheduler has
+     * room; contactsLoaded is emitted once when done. */
+    void loadContacts(
+        const QList<QString>& allowed,
+        const QList<QString>& requesting,
+        const QList<QString>& blocked,
+        const QList<QString>& pending,
+        const QList<QString>& rejected);
+
     // tego_user_type_allowed
     void addAllowedContacts(const QList<QString>& userHostnames);
     // tego_user_type_requesting
@@ -82,6 +107,7 @@ public:
 
 signals:
     void contactAdded(ContactUser *user);
+    void contactsLoaded();
     void outgoingRequestAdded(OutgoingContactRequest *request);
 
     void unreadCountChanged(ContactUser *user, int unreadCount);
@@ -91,11 +117,18 @@ signals:
 private slots:
     void contactDeleted(ContactUser *user);
     void onUnreadCountChanged();
+    void startDeferredConnects();
 
 private:
     QList<ContactUser*> pContacts;
+    // Contacts by lower-case service id, without the .onion suffix
+    QHash<QByteArray, ContactUser*> m_serviceIdIndex;
+    // Loaded contacts that haven't started connecting yet, in load order
+    QQueue<QPointer<ContactUser>> m_deferredConnects;
+    QTimer m_deferredConnectTimer;
 
     void connectSignals(ContactUser *user);
+    void insertContact(ContactUser *user);
 };
 
 #endif // CONTACTSMANAGER_H
@@ -32,20 +32,21 @@
 
 #include "error.hpp"
 #include "file_hash.hpp"
-#include "globals.hpp"
-using tego::g_globals;
+#include "context.hpp"
 
 #include "ConversationModel.h"
+#include "UserIdentity.h"
 #include "protocol/Connection.h"
 #include "protocol/ChatChannel.h"
 #include "protocol/FileChannel.h"
 #include "utils/SecureRNG.h"
+#include "utils/StringUtil.h"
 #include "utils/Useful.h"
 
 ConversationModel::ConversationModel(QObject *parent)
     : QAbstractListModel(parent)
     , m_contact(0)
-    , messages({})
+    , messages(HistoryLimit)
     , m_unreadCount(0)
     , lastMessageId(SecureRNG::randomInt(UINT32_MAX))
 
@@ -59,31 +60,16 @@ void ConversationModel::setContact(ContactUser *contact)
 
     beginResetModel();
     messages.clear();
+    rebuildIndex();
 
     if (m_contact)
         disconnect(m_contact, 0, this, 0);
     m_contact = contact;
     if (m_contact) {
         auto connectChannel = [this](Protocol::Channel *channel) {
+            attachChannel(channel);
             if (channel->direction() == Protocol::Channel::Outbound)
-            {
-                connect(channel, &Protocol::Channel::invalidated, this, &ConversationModel::outboundChannelClosed);
                 sendQueuedMessages();
-            }
-
-            if (Protocol::ChatChannel *chat = qobject_cast<Protocol::ChatChannel*>(channel))
-            {
-                connect(chat, &Protocol::ChatChannel::messageReceived, this, &ConversationModel::messageReceived);
-                connect(chat, &Protocol::ChatChannel::messageAcknowledged, this, &ConversationModel::messageAcknowledged);
-            }
-            else if (auto fc = qobject_cast<Protocol::FileChannel*>(channel); fc != nullptr)
-            {
-                connect(fc, &Protocol::FileChannel::fileTransferRequestReceived, this, &ConversationModel::onFileTransferRequestReceived);
-                connect(fc, &Protocol::FileChannel::fileTransferAcknowledged, this, &ConversationModel::onFileTransferAcknowledged);
-                connect(fc, &Protocol::FileChannel::fileTransferRequestResponded, this, &ConversationModel::onFileTransferRequestResponded);
-                connect(fc, &Protocol::FileChannel::fileTransferProgress, this, &ConversationModel::onFileTransferProgress);
-                connect(fc, &Protocol::FileChannel::fileTransferFinished, this, &ConversationModel::onFileTransferFinished);
-            }
         };
 
         auto connectConnection = [this,connectChannel]() {
@@ -103,6 +89,39 @@ void ConversationModel::setContact(ContactUser *contact)
 
     endResetModel();
     emit contactChanged();
+
+    if (m_contact)
+        loadOutbox();
+}
+
+/* Connect to the signals of a channel on our contact's connection
+ *
+ * Outbound channels are attached as soon as their OpenChannel request has
+ * been sent, so that messages can be written behind the pending request
+ * instead of waiting a round trip for the ChannelResult, and attached again
+ * once opened; the connections are unique to make that harmless.
+ */
+void ConversationModel::attachChannel(Protocol::Channel *channel)
+{
+    if (channel->direction() == Protocol::Channel::Outbound)
+    {
+        connect(channel, &Protocol::Channel::invalidated, this, &ConversationModel::outboundChannelClosed, Qt::UniqueConnection);
+        connect(channel, &Protocol::Channel::channelRejected, this, &ConversationModel::outboundChannelRejected, Qt::UniqueConnection);
+    }
+
+    if (Protocol::ChatChannel *chat = qobject_cast<Protocol::ChatChannel*>(channel))
+    {
+        connect(chat, &Protocol::ChatChannel::messageReceived, this, &ConversationModel::messageReceived, Qt::UniqueConnection);
+        connect(chat, &Protocol::ChatChannel::messageAcknowledged, this, &ConversationModel::messageAcknowledged, Qt::UniqueConnection);
+    }
+    else if (auto fc = qobject_cast<Protocol::FileChannel*>(channel); fc != nullptr)
+    {
+        connect(fc, &Protocol::FileChannel::fileTransferRequestReceived, this, &ConversationModel::onFileTransferRequestReceived, Qt::UniqueConnection);
+        connect(fc, &Protocol::FileChannel::fileTransferAcknowledged, this, &ConversationModel::onFileTransferAcknowledged, Qt::UniqueConnection);
+        connect(fc, &Protocol::FileChannel::fileTransferRequestResponded, this, &ConversationModel::onFileTransferRequestResponded, Qt::UniqueConnection);
+        connect(fc, &Protocol::FileChannel::fileTransferProgress, this, &ConversationModel::onFileTransferProgress, Qt::UniqueConnection);
+        connect(fc, &Protocol::FileChannel::fileTransferFinished, this, &ConversationModel::onFileTransferFinished, Qt::UniqueConnection);
+    }
 }
 
 /* Get a channel of type T for a contact, if it doesn't exist create one
@@ -121,12 +140,31 @@ template<typename T> T *findOrCreateChannelForContact(ContactUser *contact, Prot
     return channel;
 }
 
+/* Whether messages can be written on an outbound channel now
+ *
+ * Until the peer accepts the channel, only its first packet is written behind
+ * the OpenChannel request; if the peer rejects the channel, anything more
+ * would arrive on a channel it doesn't have. The rest wait for channelOpened.
+ */
+static bool canSendOn(Protocol::Channel *channel)
+{
+    return channel && (channel->isOpened() || (channel->isOpenPending() && channel->packetsSent() == 0));
+}
+
+/* Whether the peer rejected one of our channels on the current connection
+ * too recently to try opening another */
+bool ConversationModel::channelsRejected() const
+{
+    return m_rejectedBy && m_rejectedBy == m_contact->connection().data()
+        && m_rejectedTime.isValid() && m_rejectedTime.elapsed() < RejectedRetryDelay * 1000;
+}
+
 
 std::tuple<tego_file_transfer_id_t, std::unique_ptr<tego_file_hash_t>, tego_file_size_t> ConversationModel::sendFile(const QString &file_uri)
 {
     logger::println("Sending file: {}", file_uri);
 
-    MessageData message(File, file_uri, QDateTime::currentDateTime(), lastMessageId++, Queued);
+    MessageData message(File, file_uri.toUtf8(), QDateTime::currentDateTime(), lastMessageId++, Queued);
     message.type = ConversationModel::MessageType::File;
 
     std::unique_ptr<tego_file_hash_t> fileHash;
@@ -146,14 +184,16 @@ std::tuple<tego_file_transfer_id_t, std::unique_ptr<tego_file_hash_t>, tego_file
 	// calculate file size
     const tego_file_size_t fileSize = static_cast<tego_file_size_t>(QFileInfo(file_uri).size());
 
-    if (m_contact->connection())
+    if (m_contact->connection() && !channelsRejected())
     {
         logger::trace();
         auto channel = findOrCreateChannelForContact<Protocol::FileChannel>(m_contact, Protocol::Channel::Outbound);
-        if (channel && channel->isOpened())
+        if (channel)
+            attachChannel(channel);
+        if (canSendOn(channel))
         {
             logger::trace();
-            if (channel->sendFileWithId(message.text, message.fileHash, QDateTime(), message.identifier))
+            if (channel->sendFileWithId(file_uri, message.fileHash, QDateTime(), message.identifier))
             {
                 logger::trace();
                 message.status = Sending;
@@ -171,44 +211,87 @@ std::tuple<tego_file_transfer_id_t, std::unique_ptr<tego_file_hash_t>, tego_file
         logger::trace();
     }
 
-    beginInsertRows(QModelIndex(), 0, 0);
-    messages.prepend(message);
-    endInsertRows();
-    prune();
+    insertMessage(0, message);
+    if (!m_contact->connection())
+        m_contact->connectionNeeded();
 
     return {message.identifier, std::move(fileHash), fileSize};
 }
 
-tego_message_id_t ConversationModel::sendMessage(const QString &text)
+tego_message_id_t ConversationModel::sendMessage(const QByteArray &text)
 {
     if (text.isEmpty())
         return 0;
 
-    MessageData message(Message, text, QDateTime::currentDateTime(), lastMessageId++, Queued);
+    return sendNewMessage(chatChannelForSending(), text);
+}
+
+std::vector<tego_message_id_t> ConversationModel::sendMessages(const QList<QByteArray> &texts)
+{
+    std::vector<tego_message_id_t> ids;
+    ids.reserve(static_cast<size_t>(texts.size()));
+
+    auto channel = chatChannelForSending();
+    if (channel)
+        channel->beginBatch();
+
+    for (const auto &text : texts)
+        ids.push_back(text.isEmpty() ? 0 : sendNewMessage(channel, text));
 
-    if (m_contact->connection())
+    if (channel)
+        channel->endBatch();
+
+    return ids;
+}
+
+/* The outbound chat channel to send new messages on, or null if they
+ * must be queued until the contact is connected */
+Protocol::ChatChannel *ConversationModel::chatChannelForSending()
+{
+    if (!m_contact->connection() || channelsRejected())
+        return nullptr;
+
+    auto channel = findOrCreateChannelForContact<Protocol::ChatChannel>(m_contact, Protocol::Channel::Outbound);
+    if (channel)
+        attachChannel(channel);
+    if (canSendOn(channel))
+        return channel;
+    return nullptr;
+}
+
+tego_message_id_t ConversationModel::sendNewMessage(Protocol::ChatChannel *channel, const QByteArray &text)
+{
+    // The message is stored and in the outbox before it is sent, so it
+    // survives a restart at any point after this
+    const MessageId identifier = lastMessageId++;
+    insertMessage(0, MessageData(Message, text, QDateTime::currentDateTime(), identifier, Queued));
+
+    // Checked for each message, as sendMessages reuses the channel; one that
+    // can't be written yet stays Queued until the channel opens
+    if (canSendOn(channel))
     {
-        auto channel = findOrCreateChannelForContact<Protocol::ChatChannel>(m_contact, Protocol::Channel::Outbound);
-        if (channel && channel->isOpened())
+        bool sent = channel->sendChatMessageWithId(text, QDateTime(), identifier);
+
+        int row = indexOfIdentifier(identifier, true);
+        if (row >= 0)
         {
-            if (channel->sendChatMessageWithId(text, QDateTime(), message.identifier))
+            MessageData &message = messageAt(row);
+            if (message.status == Queued)
             {
-                message.status = Sending;
+                message.status = sent ? Sending : Error;
+                message.attemptCount++;
+                storeStatus(message);
+                emit dataChanged(index(row, 0), index(row, 0));
             }
-            else
-            {
-                message.status = Error;
-            }
-            message.attemptCount++;
         }
     }
+    else if (!channel)
+    {
+        // Connect to the contact now that there is something to send
+        m_contact->connectionNeeded();
+    }
 
-    beginInsertRows(QModelIndex(), 0, 0);
-    messages.prepend(message);
-    endInsertRows();
-    prune();
-
-    return message.identifier;
+    return identifier;
 }
 
 void ConversationModel::acceptFile(tego_file_transfer_id_t id, const std::string& dest)
@@ -255,13 +338,19 @@ void ConversationModel::cancelTransfer(tego_file_transfer_id_t id)
             }
         }
     }
-    else if(auto it = std::find_if(messages.begin(), messages.end(), [=](auto& msg) {return msg.identifier == id;});
-            it != messages.end())
-    {
-        messages.erase(it);
-    }
     else
     {
+        for (int row = 0; row < messages.size(); row++)
+        {
+            if (messageAt(row).identifier == id)
+            {
+                beginRemoveRows(QModelIndex(), row, row);
+                messages.removeAt(offsetForRow(row));
+                rebuildIndex();
+                endRemoveRows();
+                return;
+            }
+        }
         TEGO_THROW_MSG("Tego transfer {} does not exist", id);
     }
 }
@@ -269,35 +358,49 @@ void ConversationModel::cancelTransfer(tego_file_transfer_id_t id)
 
 void ConversationModel::sendQueuedMessages()
 {
-    if (!m_contact->connection())
+    if (!m_contact->connection() || channelsRejected())
         return;
 
+    // Both OpenChannel requests are written back to back, and the oldest queued
+    // message of each kind follows immediately rather than waiting for the
+    // ChannelResult; see canSendOn.
     auto chat_channel = findOrCreateChannelForContact<Protocol::ChatChannel>(m_contact, Protocol::Channel::Outbound);
     auto file_channel = findOrCreateChannelForContact<Protocol::FileChannel>(m_contact, Protocol::Channel::Outbound);
+    if (chat_channel)
+        attachChannel(chat_channel);
+    if (file_channel)
+        attachChannel(file_channel);
 
     // sendQueuedMessages is called at channelOpened
 
+    // Queued chat messages go out together, in as few packets as the peer allows
+    if (chat_channel)
+        chat_channel->beginBatch();
+
     // Iterate backwards, from oldest to newest messages
     for (int i = messages.size() - 1; i >= 0; i--)
     {
-        auto& m = messages[i];
-        if (m.status == Queued) {
+        auto& m = messageAt(i);
+        if (m.status == Queued && retryExpired(m)) {
+            qDebug() << "Queued message has expired under the retry policy. Marking as error.";
+            failMessage(i);
+        } else if (m.status == Queued) {
             qDebug() << "Sending queued chat message";
             bool attempted = false;
             switch (m.type)
             {
                 case ConversationModel::MessageType::Message:
-                    if (chat_channel->isOpened())
+                    if (canSendOn(chat_channel))
                     {
                         m.status = chat_channel->sendChatMessageWithId(m.text, m.time, m.identifier) ? Sending : Error;
                         attempted = true;
                     }
                     break;
                 case ConversationModel::MessageType::File:
-                    if (file_channel->isOpened())
+                    if (canSendOn(file_channel))
                     {
                         logger::println("Attempted to send queued file: {}", m.text);
-                        m.status = file_channel->sendFileWithId(m.text, m.fileHash, m.time, m.identifier) ? Sending : Error;
+                        m.status = file_channel->sendFileWithId(QString::fromUtf8(m.text), m.fileHash, m.time, m.identifier) ? Sending : Error;
                         attempted = true;
                     }
                     break;
@@ -309,26 +412,27 @@ void ConversationModel::sendQueuedMessages()
             if (attempted)
             {
                 m.attemptCount++;
+                storeStatus(m);
                 emit dataChanged(index(i, 0), index(i, 0));
             }
         }
     }
+
+    if (chat_channel)
+        chat_channel->endBatch();
 }
 
-void ConversationModel::messageReceived(const QString &text, const QDateTime &time, MessageId id)
+void ConversationModel::messageReceived(const QByteArray &text, const QDateTime &time, MessageId id)
 {
     // In rare cases an outgoing acknowledgement packet can be lost which
     // causes the other party to resend the message. Discard the duplicate.
     // We don't need to resend the old acknowledgement packet because
-    // it is identical to the one for the duplicate message.
-    for (int i = 0; i < messages.size() && i < 5; i++) {
-        if (messages[i].status == Delivered) {
-            break;
-        }
-        if (messages[i].identifier == id && messages[i].text == text) {
-            qDebug() << "duplicate incoming message" << id;
-            return;
-        }
+    // it is identical to the one for the duplicate message. Duplicates
+    // within a channel are already caught by ChatChannel's sequences; this
+    // catches a message sent again on a new connection.
+    if (int row = indexOfIdentifier(id, false); row >= 0 && messageAt(row).text == text) {
+        qDebug() << "duplicate incoming message" << id;
+        return;
     }
 
     // To preserve conversation flow despite potentially high latency, incoming messages
@@ -336,32 +440,28 @@ void ConversationModel::messageReceived(const QString &text, const QDateTime &ti
     // the peer hadn't seen any unacknowledged message when this message was sent.
     int row = 0;
     for (int i = 0; i < messages.size() && i < 5; i++) {
-        if (messages[i].status != Sending && messages[i].status != Queued) {
+        const MessageData &message = messageAt(i);
+        if (message.status != Sending && message.status != Queued) {
             row = i;
             break;
         }
     }
 
-    beginInsertRows(QModelIndex(), row, row);
-    MessageData message(Message, text, time, id, Received);
-    messages.insert(row, message);
-    endInsertRows();
-    prune();
+    insertMessage(row, MessageData(Message, text, time, id, Received));
 
     m_unreadCount++;
     emit unreadCountChanged();
 
     {
-        // convert QString to raw utf8
-        auto utf8Text = text.toUtf8();
-        auto rawText = std::make_unique<char[]>(static_cast<unsigned int>(utf8Text.size()) + 1u);
-        std::copy(utf8Text.begin(), utf8Text.end(), rawText.get());
+        // the callback takes ownership of a null-terminated copy of the utf8 text
+        auto rawText = std::make_unique<char[]>(static_cast<size_t>(text.size()) + 1u);
+        std::copy(text.begin(), text.end(), rawText.get());
 
         auto userId = this->m_contact->toTegoUserId();
 
         logger::println("Received Message : {}", rawText.get());
 
-        g_globals.context->callback_registry_.emit_message_received(userId.release(), static_cast<tego_time_t>(time.toMSecsSinceEpoch()), id, rawText.release(), static_cast<size_t>(utf8Text.size()));
+        context()->callback_registry_.emit_message_received(userId.release(), static_cast<tego_time_t>(time.toMSecsSinceEpoch()), id, rawText.release(), static_cast<size_t>(text.size()));
     }
 }
 
@@ -371,12 +471,29 @@ void ConversationModel::messageAcknowledged(MessageId id, bool accepted)
     if (row < 0)
         return;
 
-    MessageData &data = messages[row];
+    MessageData &data = messageAt(row);
+    // A late or duplicate acknowledgement mustn't override a message that has
+    // since been requeued, failed or delivered
+    if (data.status != Sending)
+        return;
     data.status = accepted ? Delivered : Error;
+    storeStatus(data);
     emit dataChanged(index(row, 0), index(row, 0));
 
     auto userId = this->contact()->toTegoUserId();
-    g_globals.context->callback_registry_.emit_message_acknowledged(userId.release(), id, (accepted ? TEGO_TRUE : TEGO_FALSE));
+    context()->callback_registry_.emit_message_acknowledged(userId.release(), id, (accepted ? TEGO_TRUE : TEGO_FALSE));
+}
+
+// Emitted before the channel is invalidated, so outboundChannelClosed knows not to retry at once
+void ConversationModel::outboundChannelRejected()
+{
+    auto channel = qobject_cast<Protocol::Channel*>(sender());
+    if (!channel)
+        return;
+
+    qDebug() << "Peer rejected outbound" << channel->type() << "channel; queued messages will wait";
+    m_rejectedBy = channel->connection();
+    m_rejectedTime.start();
 }
 
 void ConversationModel::outboundChannelClosed()
@@ -384,21 +501,28 @@ void ConversationModel::outboundChannelClosed()
     // Any messages that are Sending are moved back to Queued, so they
     // will be re-sent when we reconnect.
     for (int i = 0; i < messages.size(); i++) {
-        if (messages[i].status != Sending)
+        MessageData &message = messageAt(i);
+        if (message.status != Sending)
+            continue;
+        if (retryExpired(message)) {
+            qDebug() << "Outbound chat channel closed, and unacknowledged message has used up its retry policy. Marking as error.";
+            failMessage(i);
             continue;
-        if (messages[i].attemptCount >= 2) {
-            qDebug() << "Outbound chat channel closed, and unacknowledged message has been tried twice already. Marking as error.";
-            messages[i].status = Error;
-        } else {
-            qDebug() << "Outbound chat channel closed, putting unacknowledged chat message back in queue";
-            messages[i].status = Queued;
         }
+
+        qDebug() << "Outbound chat channel closed, putting unacknowledged chat message back in queue";
+        message.status = Queued;
+        storeStatus(message);
         emit dataChanged(index(i, 0), index(i, 0));
     }
 
-    // Try to reopen the channel if we're still connected
+    // Try to reopen the channel if we're still connected; after a rejection,
+    // wait rather than have the peer reject each attempt in turn
     if (m_contact && m_contact->connection() && m_contact->connection()->isConnected()) {
-        metaObject()->invokeMethod(this, "sendQueuedMessages", Qt::QueuedConnection);
+        if (channelsRejected())
+            QTimer::singleShot(RejectedRetryDelay * 1000, this, &ConversationModel::sendQueuedMessages);
+        else
+            metaObject()->invokeMethod(this, "sendQueuedMessages", Qt::QueuedConnection);
     }
 }
 
@@ -409,11 +533,182 @@ void ConversationModel::clear()
 
     beginRemoveRows(QModelIndex(), 0, messages.size()-1);
     messages.clear();
+    rebuildIndex();
     endRemoveRows();
 
     resetUnreadCount();
 }
 
+QString ConversationModel::storeDirectory(const ContactUser *contact)
+{
+    const tego_context *context = contact->identity->context;
+    if (context->historyDirectory.isEmpty())
+        return QString();
+
+    QString serviceId = contact->hostname();
+    serviceId.chop(static_strlen(".onion"));
+
+    // Identities other than the first keep their contacts' history apart
+    QString directory = context->historyDirectory;
+    if (contact->identity->uniqueID != 0)
+        directory += QLatin1Char('/') + contact->identity->hostname().left(TEGO_V3_ONION_SERVICE_ID_LENGTH);
+    return directory + QLatin1Char('/') + serviceId;
+}
+
+bool ConversationModel::hasStoredOutbox(const ContactUser *contact)
+{
+    const QString directory = storeDirectory(contact);
+    return !directory.isEmpty() && Outbox::hasPending(directory + QStringLiteral("/outbox"));
+}
+
+QDateTime ConversationModel::storedLastMessageTime(const ContactUser *contact)
+{
+    const QString directory = storeDirectory(contact);
+    // Opening a store creates its directory, which contacts without history shouldn't get
+    if (directory.isEmpty() || !QFileInfo(directory).isDir())
+        return QDateTime();
+
+    const qint64 time = ConversationStore(directory, QByteArray()).newestTime();
+    return time < 0 ? QDateTime() : QDateTime::fromMSecsSinceEpoch(time);
+}
+
+ConversationStore *ConversationModel::store()
+{
+    if (!m_store && m_contact && !context()->historyDirectory.isEmpty()) {
+        m_store = std::make_unique<ConversationStore>(
+            storeDirectory(m_contact),
+            context()->historyKey);
+        m_searchIndex = std::make_unique<SearchIndex>(
+            m_store->directory() + QStringLiteral("/search.idx"),
+            context()->historyKey);
+        m_outbox = std::make_unique<Outbox>(m_store->directory() + QStringLiteral("/outbox"));
+
+        // Records are written before the message is appended, so a crash in
+        // between leaves records for sequences that were never stored
+        std::vector<qint64> unstored;
+        for (auto it = m_outbox->pending().lower_bound(m_store->count()); it != m_outbox->pending().end(); ++it)
+            unstored.push_back(*it);
+        for (qint64 sequence : unstored)
+            m_outbox->remove(sequence);
+    }
+    return m_store.get();
+}
+
+SearchIndex *ConversationModel::searchIndex()
+{
+    store();
+    return m_searchIndex.get();
+}
+
+void ConversationModel::closeStore()
+{
+    m_outbox.reset();
+    m_searchIndex.reset();
+    m_store.reset();
+
+    // Sequences refer to the closed store, and would be wrong in the next one
+    for (int i = 0; i < messages.size(); i++)
+        messages[i].storeSequence = -1;
+}
+
+void ConversationModel::storeStatus(const MessageData &message)
+{
+    if (!m_store || message.storeSequence < 0)
+        return;
+
+    m_store->setStatus(message.storeSequence, static_cast<quint8>(message.status));
+    if (message.type == Message && (message.status == Delivered || message.status == Error))
+        m_outbox->remove(message.storeSequence);
+}
+
+void ConversationModel::loadOutbox()
+{
+    ConversationStore *store = this->store();
+    if (!store)
+        return;
+
+    // Each message is older than those loaded before it, so they go to the bottom, newest first
+    const std::set<qint64> pending = m_outbox->pending();
+    for (auto it = pending.rbegin(); it != pending.rend(); ++it) {
+        const std::vector<ConversationStore::Entry> entries = store->readBefore(*it + 1, 1);
+        if (entries.empty() || entries.front().sequence != *it) {
+            qWarning() << "Cannot read message" << *it << "from the outbox of" << m_contact->hostname();
+            continue;
+        }
+
+        const ConversationStore::Entry &entry = entries.front();
+        if (!entry.isOutgoing || entry.type != Message) {
+            TEGO_BUG() << "Outbox refers to a message that isn't an outgoing chat message";
+            m_outbox->remove(*it);
+            continue;
+        }
+        if (indexOfIdentifier(entry.identifier, true) >= 0)
+            continue;
+
+        MessageData message(Message, entry.text, QDateTime::fromMSecsSinceEpoch(entry.time), entry.identifier, Queued);
+        message.storeSequence = entry.sequence;
+        // Attempts aren't stored, but a message that was being sent has had one
+        if (entry.status == Sending)
+            message.attemptCount = 1;
+        insertMessage(messages.size(), message);
+    }
+
+    sendQueuedMessages();
+    if (!m_contact->connection())
+        m_contact->connectionNeeded();
+}
+
+bool ConversationModel::retryExpired(const MessageData &message) const
+{
+    const int maxAttempts = context()->messageRetryAttempts;
+    const int maxAge = context()->messageRetrySeconds;
+    if (maxAttempts > 0 && message.attemptCount >= maxAttempts)
+        return true;
+    if (maxAge > 0 && message.time.secsTo(QDateTime::currentDateTime()) >= maxAge)
+        return true;
+    return false;
+}
+
+/* Give up on sending an outgoing message, and tell the frontend */
+void ConversationModel::failMessage(int row)
+{
+    MessageData &message = messageAt(row);
+    message.status = Error;
+    storeStatus(message);
+    emit dataChanged(index(row, 0), index(row, 0));
+
+    if (message.type == Message) {
+        auto userId = this->contact()->toTegoUserId();
+        context()->callback_registry_.emit_message_acknowledged(userId.release(), message.identifier, TEGO_FALSE);
+    }
+}
+
+bool ConversationModel::hasUndeliveredMessages() const
+{
+    for (int i = 0; i < messages.size(); i++) {
+        if (messages[i].status == Queued || messages[i].status == Sending)
+            return true;
+    }
+    return false;
+}
+
+QDateTime ConversationModel::lastMessageTime() const
+{
+    QDateTime stored;
+    if (m_store) {
+        const qint64 time = m_store->newestTime();
+        if (time >= 0)
+            stored = QDateTime::fromMSecsSinceEpoch(time);
+    } else if (m_contact) {
+        stored = storedLastMessageTime(m_contact);
+    }
+
+    if (messages.isEmpty())
+        return stored;
+    const QDateTime &latest = messages.last().time;
+    return (stored.isValid() && stored > latest) ? stored : latest;
+}
+
 void ConversationModel::resetUnreadCount()
 {
     if (m_unreadCount == 0)
@@ -444,7 +739,7 @@ void ConversationModel::onFileTransferRequestReceived(tego_file_transfer_id_t id
     // filehash
     auto heapHash = std::make_unique<tego_file_hash_t>(hash);
 
-    g_globals.context->callback_registry_.emit_file_transfer_request_received(
+    context()->callback_registry_.emit_file_transfer_request_received(
         userId.release(),
         id,
         rawFilename.release(),
@@ -459,12 +754,17 @@ void ConversationModel::onFileTransferAcknowledged(tego_file_transfer_id_t id, b
     if (row < 0)
         return;
 
-    MessageData &data = messages[row];
+    MessageData &data = messageAt(row);
+    // A late or duplicate acknowledgement mustn't override a message that has
+    // since been requeued, failed or delivered
+    if (data.status != Sending)
+        return;
     data.status = accepted ? Delivered : Error;
+    storeStatus(data);
     emit dataChanged(index(row, 0), index(row, 0));
 
     auto userId = this->contact()->toTegoUserId();
-    g_globals.context->callback_registry_.emit_file_transfer_request_acknowledged(
+    context()->callback_registry_.emit_file_transfer_request_acknowledged(
         userId.release(),
         id,
         accepted ? TEGO_TRUE : TEGO_FALSE);
@@ -473,7 +773,7 @@ void ConversationModel::onFileTransferAcknowledged(tego_file_transfer_id_t id, b
 void ConversationModel::onFileTransferRequestResponded(tego_file_transfer_id_t id, tego_file_transfer_response_t response)
 {
     auto userId = this->contact()->toTegoUserId();
-    g_globals.context->callback_registry_.emit_file_transfer_request_response_received(
+    context()->callback_registry_.emit_file_transfer_request_response_received(
         userId.release(),
         id,
         response);
@@ -482,7 +782,7 @@ void ConversationModel::onFileTransferRequestResponded(tego_file_transfer_id_t i
 void ConversationModel::onFileTransferProgress(tego_file_transfer_id_t id, tego_file_transfer_direction_t direction, uint64_t bytesTransmitted, uint64_t bytesTotal)
 {
     auto userId = this->contact()->toTegoUserId();
-    g_globals.context->callback_registry_.emit_file_transfer_progress(
+    context()->callback_registry_.emit_file_transfer_progress(
         userId.release(),
         id,
         direction,
@@ -493,7 +793,7 @@ void ConversationModel::onFileTransferProgress(tego_file_transfer_id_t id, tego_
 void ConversationModel::onFileTransferFinished(tego_file_transfer_id_t id, tego_file_transfer_direction_t direction, tego_file_transfer_result_t result)
 {
     auto userId = this->contact()->toTegoUserId();
-    g_globals.context->callback_registry_.emit_file_transfer_complete(
+    context()->callback_registry_.emit_file_transfer_complete(
         userId.release(),
         id,
         direction,
@@ -524,10 +824,10 @@ QVariant ConversationModel::data(const QModelIndex &index, int role) const
     if (!index.isValid() || index.row() >= messages.size())
         return QVariant();
 
-    const MessageData &message = messages[index.row()];
+    const MessageData &message = messageAt(index.row());
 
     switch (role) {
-        case Qt::DisplayRole: return message.text;
+        case Qt::DisplayRole: return QString::fromUtf8(message.text);
         case TimestampRole: return message.time;
         case IsOutgoingRole: return message.status != Received;
         case StatusRole: return message.status;
@@ -536,19 +836,19 @@ QVariant ConversationModel::data(const QModelIndex &index, int role) const
             if (m_contact->status() == ContactUser::Online)
                 return QString();
             if (index.row() < messages.size() - 1) {
-                const MessageData &next = messages[index.row()+1];
+                const MessageData &next = messageAt(index.row()+1);
                 if (next.status != Received && next.status != Delivered)
                     return QString();
             }
             for (int i = 0; i <= index.row(); i++) {
-                if (messages[i].status == Received || messages[i].status == Delivered)
+                if (messageAt(i).status == Received || messageAt(i).status == Delivered)
                     return QString();
             }
             return QStringLiteral("offline");
         }
         case TimespanRole: {
             if (index.row() < messages.size() - 1)
-                return messages[index.row() + 1].time.secsTo(messages[index.row()].time);
+                return messageAt(index.row() + 1).time.secsTo(messageAt(index.row()).time);
             else
                 return -1;
         }
@@ -557,23 +857,139 @@ QVariant ConversationModel::data(const QModelIndex &index, int role) const
     return QVariant();
 }
 
+tego_context *ConversationModel::context() const
+{
+    return m_contact->identity->context;
+}
+
 int ConversationModel::indexOfIdentifier(MessageId identifier, bool isOutgoing) const
 {
-    for (int i = 0; i < messages.size(); i++) {
-        if (messages[i].identifier == identifier && (messages[i].status != Received) == isOutgoing)
-            return i;
+    auto it = m_identifierIndex.constFind(identifierKey(identifier, isOutgoing));
+    if (it == m_identifierIndex.constEnd())
+        return -1;
+
+    int row = rowForSequence(*it);
+    if (row < 0 || row >= messages.size() || messageAt(row).identifier != identifier) {
+        TEGO_BUG() << "Message index is out of sync for identifier" << identifier;
+        return -1;
     }
-    return -1;
+    return row;
+}
+
+quint64 ConversationModel::identifierKey(MessageId identifier, bool isOutgoing)
+{
+    // Incoming and outgoing identifiers are chosen independently by each peer and may collide
+    return (quint64(isOutgoing ? 1 : 0) << 32) | quint64(identifier);
+}
+
+ConversationModel::MessageData &ConversationModel::messageAt(int row)
+{
+    return messages[offsetForRow(row)];
+}
+
+const ConversationModel::MessageData &ConversationModel::messageAt(int row) const
+{
+    return messages[offsetForRow(row)];
+}
+
+// Rows are ordered newest first, the ring buffer is ordered oldest first
+int ConversationModel::offsetForRow(int row) const
+{
+    return messages.size() - 1 - row;
+}
+
+int ConversationModel::rowForSequence(qint64 sequence) const
+{
+    return offsetForRow(static_cast<int>(sequence - messages.firstSequence()));
+}
+
+qint64 ConversationModel::sequenceForRow(int row) const
+{
+    return messages.firstSequence() + offsetForRow(row);
 }
 
-void ConversationModel::prune()
+/* Insert a message at row, evicting the oldest message if the history is full
+ *
+ * The message is also appended to the store, where evicted messages remain
+ * available. */
+void ConversationModel::insertMessage(int row, MessageData message)
 {
-    const int history_limit = 1000;
-    if (messages.size() > history_limit) {
-        beginRemoveRows(QModelIndex(), history_limit, messages.size()-1);
-        while (messages.size() > history_limit) {
-            messages.removeLast();
+    // Messages loaded from the store already have a sequence
+    ConversationStore *store = message.storeSequence < 0 ? this->store() : nullptr;
+    if (store) {
+        // An undelivered message goes in the outbox before it's stored, so
+        // there is no point where a crash would lose it; the record is
+        // dropped if the message can't be stored
+        const bool pending = message.type == Message && (message.status == Queued || message.status == Sending);
+        const qint64 sequence = store->count();
+        if (pending)
+            m_outbox->add(sequence);
+
+        message.storeSequence = store->append(
+            message.time.toMSecsSinceEpoch(),
+            message.identifier,
+            static_cast<quint8>(message.type),
+            static_cast<quint8>(message.status),
+            message.status != Received,
+            message.text);
+
+        if (pending && message.storeSequence != sequence) {
+            m_outbox->remove(sequence);
+            if (message.storeSequence >= 0) {
+                TEGO_BUG() << "Message was stored with sequence" << message.storeSequence << "instead of" << sequence;
+                m_outbox->add(message.storeSequence);
+            }
         }
+        if (message.storeSequence >= 0 && message.type == Message)
+            m_searchIndex->add(message.storeSequence, QString::fromUtf8(message.text));
+    }
+
+    if (messages.isFull()) {
+        const int last = messages.size() - 1;
+        if (row > last)
+            return;
+
+        beginRemoveRows(QModelIndex(), last, last);
+        const MessageData &oldest = messages.first();
+        auto it = m_identifierIndex.find(identifierKey(oldest.identifier, oldest.status != Received));
+        if (it != m_identifierIndex.end() && *it == messages.firstSequence())
+            m_identifierIndex.erase(it);
+        messages.removeFirst();
         endRemoveRows();
     }
+
+    beginInsertRows(QModelIndex(), row, row);
+    messages.insert(messages.size() - row, message);
+    indexInsertedRow(row);
+    endInsertRows();
+}
+
+/* Update the index after a message was inserted at row
+ *
+ * Older messages keep their sequence numbers. The newer messages above the
+ * inserted row each move up by one; messages are only inserted near the top,
+ * so this touches a handful of entries at most.
+ */
+void ConversationModel::indexInsertedRow(int row)
+{
+    for (int i = 0; i < row; i++) {
+        auto it = m_identifierIndex.find(identifierKey(messageAt(i).identifier, messageAt(i).status != Received));
+        // Sequence number of this message before the insert
+        if (it != m_identifierIndex.end() && *it == sequenceForRow(i) - 1)
+            *it = sequenceForRow(i);
+    }
+
+    const MessageData &message = messageAt(row);
+    m_identifierIndex.insert(identifierKey(message.identifier, message.status != Received), sequenceForRow(row));
+}
+
+void ConversationModel::rebuildIndex()
+{
+    m_identifierIndex.clear();
+
+    // Iterate from oldest to newest, so the newest duplicate wins
+    for (int i = messages.size() - 1; i >= 0; i--) {
+        const MessageData &message = messageAt(i);
+        m_identifierIndex.insert(identifierKey(message.identifier, message.status != Received), sequenceForRow(i));
+    }
 }
@@ -34,8 +34,12 @@
 #define CONVERSATIONMODEL_H
 
 #include "core/ContactUser.h"
+#include "core/ConversationStore.h"
+#include "core/Outbox.h"
+#include "core/SearchIndex.h"
 #include "protocol/ChatChannel.h"
 #include "protocol/FileChannel.h"
+#include "utils/RingBuffer.h"
 
 class ConversationModel : public QAbstractListModel
 {
@@ -78,7 +82,10 @@ public:
     virtual QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const;
 
     std::tuple<tego_file_transfer_id_t, std::unique_ptr<tego_file_hash_t>, tego_file_size_t> sendFile(const QString &file_url);
-    tego_message_id_t sendMessage(const QString &text);
+    // Messages are well-formed UTF-8
+    tego_message_id_t sendMessage(const QByteArray &text);
+    // Send several messages together, batched into as few packets as the peer allows
+    std::vector<tego_message_id_t> sendMessages(const QList<QByteArray> &texts);
 
     void acceptFile(tego_file_transfer_id_t id, const std::string& dest);
     void rejectFile(tego_file_transfer_id_t id);
@@ -86,13 +93,43 @@ public:
 
     void clear();
 
+    // Whether any outgoing messages are waiting to be sent or acknowledged
+    bool hasUndeliveredMessages() const;
+    /* Time of the newest message, in memory or stored, or a null QDateTime if
+     * there are none; history isn't loaded at startup, so the store is checked */
+    QDateTime lastMessageTime() const;
+
+    /* The contact's on-disk history, or null if history is not being stored
+     *
+     * The store is opened on first use. Messages older than those kept in
+     * memory are only available from here. */
+    ConversationStore *store();
+    // Index of the stored messages' text, or null if history is not being stored
+    SearchIndex *searchIndex();
+    void closeStore();
+    /* Queue the undelivered messages in the store's outbox to be sent again
+     *
+     * Called when the contact is set, and when the history directory changes.
+     * Messages that are already loaded are skipped. */
+    void loadOutbox();
+
+    // Directory of the contact's stored history, or empty if history is not being stored
+    static QString storeDirectory(const ContactUser *contact);
+    /* Whether the contact's stored outbox may hold undelivered messages; checked
+     * without opening the store, to decide whether a conversation is needed yet */
+    static bool hasStoredOutbox(const ContactUser *contact);
+    /* Time of the newest message in the contact's stored history, or a null
+     * QDateTime; read from the index without creating a conversation */
+    static QDateTime storedLastMessageTime(const ContactUser *contact);
+
 signals:
     void contactChanged();
     void unreadCountChanged();
 
 private slots:
-    void messageReceived(const QString &text, const QDateTime &time, MessageId id);
+    void messageReceived(const QByteArray &text, const QDateTime &time, MessageId id);
     void messageAcknowledged(MessageId id, bool accepted);
+    void outboundChannelRejected();
     void outboundChannelClosed();
     void sendQueuedMessages();
     void onContactStatusChanged();
@@ -106,29 +143,67 @@ private slots:
 private:
     struct MessageData {
         MessageType type;
-        QString text;
+        // UTF-8 message text, or path of a file to send
+        QByteArray text;
         tego_file_hash_t fileHash;
         QDateTime time;
         MessageId identifier;
         MessageStatus status;
-        quint8 attemptCount;
+        int attemptCount;
+        // Sequence in the store, or -1 if it was not stored
+        qint64 storeSequence;
 
-        MessageData(MessageType m_type, const QString &contents, const QDateTime &t, MessageId id, MessageStatus stat)
-            : type(m_type), text(contents), time(t), identifier(id), status(stat), attemptCount(0)
+        MessageData(MessageType m_type, const QByteArray &contents, const QDateTime &t, MessageId id, MessageStatus stat)
+            : type(m_type), text(contents), time(t), identifier(id), status(stat), attemptCount(0), storeSequence(-1)
         {
         }
     };
 
+    static const int HistoryLimit = 1000;
+    // Seconds before opening channels again on a connection where the peer rejected one
+    static const int RejectedRetryDelay = 30;
+
     ContactUser *m_contact;
-    QList<MessageData> messages;
+    // Ordered oldest first; rows are the reverse, see offsetForRow
+    RingBuffer<MessageData> messages;
     int m_unreadCount;
 
+    /* Index from identifier and direction to the ring buffer sequence number
+     * of the newest matching message. Sequence numbers are unchanged by
+     * adding or evicting messages; use rowForSequence to convert one to a row. */
+    QHash<quint64,qint64> m_identifierIndex;
+
+    std::unique_ptr<ConversationStore> m_store;
+    std::unique_ptr<SearchIndex> m_searchIndex;
+    std::unique_ptr<Outbox> m_outbox;
+
+    // Connection on which the peer last rejected an outbound channel, and when
+    QPointer<Protocol::Connection> m_rejectedBy;
+    QElapsedTimer m_rejectedTime;
+
     // The peer might use recent message IDs between connections to handle
     // re-send. Start at a random ID to reduce chance of collisions, then increment
     MessageId lastMessageId;
 
+    // The context of the contact's identity
+    tego_context *context() const;
     int indexOfIdentifier(MessageId identifier, bool isOutgoing) const;
-    void prune();
+    static quint64 identifierKey(MessageId identifier, bool isOutgoing);
+    MessageData &messageAt(int row);
+    const MessageData &messageAt(int row) const;
+    int offsetForRow(int row) const;
+    int rowForSequence(qint64 sequence) const;
+    qint64 sequenceForRow(int row) const;
+    void insertMessage(int row, MessageData message);
+    void storeStatus(const MessageData &message);
+    bool retryExpired(const MessageData &message) const;
+    void failMessage(int row);
+    void indexInsertedRow(int row);
+    void rebuildIndex();
+    void attachChannel(Protocol::Channel *channel);
+    bool channelsRejected() const;
+    Protocol::ChatChannel *chatChannelForSending();
+    tego_message_id_t sendNewMessage(Protocol::ChatChannel *channel, const QByteArray &text);
 };
 
 #endif
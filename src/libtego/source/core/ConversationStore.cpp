@@ -0,0 +1,390 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2026, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ConversationStore.h"
+#include "utils/SecureRNG.h"
+#include "utils/Useful.h"
+
+namespace
+{
+    constexpr quint8 OutgoingFlag = 0x01;
+    // Byte offset of the status within an index entry
+    constexpr qint64 StatusOffset = 13;
+}
+
+ConversationStore::ConversationStore(const QString &directory, const QByteArray &key)
+    : m_directory(directory)
+    , m_key(key)
+    , m_count(0)
+    , m_openSegment(-1)
+    , m_mapped(0)
+{
+    Q_ASSERT(m_key.isEmpty() || m_key.size() == KeySize);
+
+    if (!QDir().mkpath(m_directory)) {
+        qWarning() << "Cannot create conversation history directory" << m_directory;
+        return;
+    }
+
+    // Segments are numbered, so only the newest index is needed for the count
+    qint64 newest = -1;
+    const QStringList indexes = QDir(m_directory).entryList(QStringList() << QStringLiteral("*.idx"), QDir::Files);
+    for (const QString &name : indexes) {
+        bool ok = false;
+        const qint64 segment = QFileInfo(name).completeBaseName().toLongLong(&ok, 16);
+        if (ok && segment > newest)
+            newest = segment;
+    }
+
+    if (newest >= 0) {
+        // A partially written entry at the end is ignored, and overwritten by the next append
+        const qint64 entries = QFileInfo(segmentPath(newest, QStringLiteral("idx"))).size() / IndexEntrySize;
+        m_count = newest * SegmentLength + qMin(entries, SegmentLength);
+    }
+}
+
+qint64 ConversationStore::append(qint64 time, quint32 identifier, quint8 type, quint8 status, bool isOutgoing, const QByteArray &text)
+{
+    const qint64 sequence = m_count;
+    if (!openSegment(sequence / SegmentLength))
+        return -1;
+
+    const QByteArray record = m_key.isEmpty() ? text : seal(text, sequence);
+    if (!m_key.isEmpty() && record.isEmpty())
+        return -1;
+
+    const qint64 offset = m_log.size();
+    if (offset + record.size() > std::numeric_limits<quint32>::max()) {
+        qWarning() << "Conversation history segment is full in" << m_directory;
+        return -1;
+    }
+
+    IndexEntry entry;
+    entry.time = time;
+    entry.identifier = identifier;
+    entry.type = type;
+    entry.status = status;
+    entry.flags = isOutgoing ? OutgoingFlag : 0;
+    entry.offset = static_cast<quint32>(offset);
+    entry.size = static_cast<quint32>(record.size());
+
+    // The log is written before the index, so an index entry always refers
+    // to a complete record
+    if (!m_log.seek(offset) || m_log.write(record) != record.size() || !m_log.flush()
+        || !m_index.seek((sequence % SegmentLength) * IndexEntrySize)
+        || m_index.write(encodeIndexEntry(entry)) != IndexEntrySize || !m_index.flush())
+    {
+        qWarning() << "Failed writing conversation history to" << m_directory << m_log.errorString() << m_index.errorString();
+        return -1;
+    }
+
+    m_count++;
+    // Only extend the map once it exists, so a store that's never searched doesn't build it
+    if (m_mapped == sequence && m_mapped > 0) {
+        m_sequences.insert(sequenceKey(identifier, isOutgoing), sequence);
+        m_mapped = m_count;
+    }
+    return sequence;
+}
+
+bool ConversationStore::setStatus(qint64 sequence, quint8 status)
+{
+    if (sequence < 0 || sequence >= m_count)
+        return false;
+
+    const qint64 segment = sequence / SegmentLength;
+    const qint64 position = (sequence % SegmentLength) * IndexEntrySize + StatusOffset;
+    const char data = static_cast<char>(status);
+
+    if (segment == m_openSegment)
+        return m_index.seek(position) && m_index.write(&data, 1) == 1 && m_index.flush();
+
+    QFile index(segmentPath(segment, QStringLiteral("idx")));
+    return index.open(QIODevice::ReadWrite) && index.seek(position) && index.write(&data, 1) == 1 && index.flush();
+}
+
+std::vector<ConversationStore::Entry> ConversationStore::readBefore(qint64 sequence, int limit) const
+{
+    std::vector<Entry> result;
+    const qint64 end = qBound<qint64>(0, sequence, m_count);
+    const qint64 first = qMax<qint64>(0, end - qMax(limit, 0));
+    result.reserve(static_cast<size_t>(end - first));
+
+    // Each segment costs one read of its index and one of its log
+    for (qint64 begin = first; begin < end; ) {
+        const qint64 segment = begin / SegmentLength;
+        const qint64 segmentEnd = qMin(end, (segment + 1) * SegmentLength);
+
+        const std::vector<IndexEntry> entries = readIndex(begin, segmentEnd);
+        if (static_cast<qint64>(entries.size()) != segmentEnd - begin) {
+            qWarning() << "Conversation history index is truncated in" << m_directory;
+            break;
+        }
+
+        const qint64 logBegin = entries.front().offset;
+        const qint64 logEnd = qint64(entries.back().offset) + entries.back().size;
+        QFile log(segmentPath(segment, QStringLiteral("log")));
+        QByteArray records;
+        if (log.open(QIODevice::ReadOnly) && log.seek(logBegin))
+            records = log.read(logEnd - logBegin);
+        if (records.size() != logEnd - logBegin) {
+            qWarning() << "Conversation history log is truncated in" << m_directory;
+            break;
+        }
+
+        for (size_t i = 0; i < entries.size(); i++) {
+            const IndexEntry &indexEntry = entries[i];
+
+            Entry entry;
+            entry.sequence = begin + static_cast<qint64>(i);
+            entry.time = indexEntry.time;
+            entry.identifier = indexEntry.identifier;
+            entry.type = indexEntry.type;
+            entry.status = indexEntry.status;
+            entry.isOutgoing = (indexEntry.flags & OutgoingFlag) != 0;
+
+            const QByteArray record = records.mid(static_cast<int>(indexEntry.offset - logBegin), static_cast<int>(indexEntry.size));
+            if (m_key.isEmpty())
+                entry.text = record;
+            else if (!unseal(record, entry.sequence, entry.text))
+                qWarning() << "Cannot decrypt conversation history message" << entry.sequence << "in" << m_directory;
+
+            result.push_back(std::move(entry));
+        }
+
+        begin = segmentEnd;
+    }
+
+    return result;
+}
+
+qint64 ConversationStore::find(quint32 identifier, bool isOutgoing) const
+{
+    mapSequences();
+    return m_sequences.value(sequenceKey(identifier, isOutgoing), -1);
+}
+
+qint64 ConversationStore::newestTime() const
+{
+    if (m_count == 0)
+        return -1;
+
+    const std::vector<IndexEntry> entries = readIndex(m_count - 1, m_count);
+    return entries.empty() ? -1 : entries.front().time;
+}
+
+qint64 ConversationStore::findTime(qint64 time) const
+{
+    qint64 low = 0;
+    qint64 high = m_count;
+    while (low < high) {
+        const qint64 middle = low + (high - low) / 2;
+        const std::vector<IndexEntry> entries = readIndex(middle, middle + 1);
+        if (entries.empty()) {
+            qWarning() << "Conversation history index is truncated in" << m_directory;
+            return -1;
+        }
+
+        if (entries.front().time < time)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/* Add the messages which aren't in m_sequences yet, one segment's index at a time */
+void ConversationStore::mapSequences() const
+{
+    while (m_mapped < m_count) {
+        const qint64 begin = m_mapped;
+        const qint64 end = qMin(m_count, (begin / SegmentLength + 1) * SegmentLength);
+        const std::vector<IndexEntry> entries = readIndex(begin, end);
+        if (static_cast<qint64>(entries.size()) != end - begin) {
+            // Try again on the next lookup rather than leave a gap in the map
+            qWarning() << "Conversation history index is truncated in" << m_directory;
+            return;
+        }
+
+        // Later messages replace earlier ones with the same identifier
+        for (size_t i = 0; i < entries.size(); i++)
+            m_sequences.insert(sequenceKey(entries[i].identifier, (entries[i].flags & OutgoingFlag) != 0), begin + static_cast<qint64>(i));
+        m_mapped = end;
+    }
+}
+
+QString ConversationStore::segmentPath(qint64 segment, const QString &suffix) const
+{
+    return QStringLiteral("%1/%2.%3").arg(m_directory).arg(segment, 8, 16, QLatin1Char('0')).arg(suffix);
+}
+
+bool ConversationStore::openSegment(qint64 segment)
+{
+    if (segment == m_openSegment)
+        return true;
+
+    m_log.close();
+    m_index.close();
+    m_openSegment = -1;
+
+    m_log.setFileName(segmentPath(segment, QStringLiteral("log")));
+    m_index.setFileName(segmentPath(segment, QStringLiteral("idx")));
+    if (!m_log.open(QIODevice::ReadWrite) || !m_index.open(QIODevice::ReadWrite)) {
+        qWarning() << "Cannot open conversation history segment" << m_log.fileName() << m_log.errorString() << m_index.errorString();
+        m_log.close();
+        m_index.close();
+        return false;
+    }
+
+    m_openSegment = segment;
+    return true;
+}
+
+/* Read the index entries for sequences first to end, which must be in one segment */
+std::vector<ConversationStore::IndexEntry> ConversationStore::readIndex(qint64 first, qint64 end) const
+{
+    Q_ASSERT(first / SegmentLength == (end - 1) / SegmentLength);
+
+    std::vector<IndexEntry> entries;
+    QFile index(segmentPath(first / SegmentLength, QStringLiteral("idx")));
+    if (!index.open(QIODevice::ReadOnly) || !index.seek((first % SegmentLength) * IndexEntrySize))
+        return entries;
+
+    const QByteArray data = index.read((end - first) * IndexEntrySize);
+    entries.reserve(static_cast<size_t>(data.size() / IndexEntrySize));
+    for (int i = 0; i + IndexEntrySize <= data.size(); i += IndexEntrySize)
+        entries.push_back(decodeIndexEntry(data.constData() + i));
+    return entries;
+}
+
+/* Index entries are 24 bytes, little endian:
+ *   0: time, qint64 msecs since epoch
+ *   8: identifier, quint32
+ *  12: type, quint8
+ *  13: status, quint8
+ *  14: flags, quint8
+ *  15: reserved
+ *  16: offset of the record in the log, quint32
+ *  20: size of the record, quint32
+ */
+QByteArray ConversationStore::encodeIndexEntry(const IndexEntry &entry)
+{
+    QByteArray data(IndexEntrySize, 0);
+    uchar *p = reinterpret_cast<uchar*>(data.data());
+    qToLittleEndian<qint64>(entry.time, p);
+    qToLittleEndian<quint32>(entry.identifier, p + 8);
+    p[12] = entry.type;
+    p[StatusOffset] = entry.status;
+    p[14] = entry.flags;
+    qToLittleEndian<quint32>(entry.offset, p + 16);
+    qToLittleEndian<quint32>(entry.size, p + 20);
+    return data;
+}
+
+ConversationStore::IndexEntry ConversationStore::decodeIndexEntry(const char *data)
+{
+    const uchar *p = reinterpret_cast<const uchar*>(data);
+    IndexEntry entry;
+    entry.time = qFromLittleEndian<qint64>(p);
+    entry.identifier = qFromLittleEndian<quint32>(p + 8);
+    entry.type = p[12];
+    entry.status = p[StatusOffset];
+    entry.flags = p[14];
+    entry.offset = qFromLittleEndian<quint32>(p + 16);
+    entry.size = qFromLittleEndian<quint32>(p + 20);
+    return entry;
+}
+
+/* Encrypt text into a record of nonce, ciphertext and tag
+ *
+ * The sequence is authenticated along with the text, so that records cannot
+ * be moved around in the history without being detected.
+ */
+QByteArray ConversationStore::seal(const QByteArray &text, qint64 sequence) const
+{
+    uchar aad[sizeof(qint64)];
+    qToLittleEndian<qint64>(sequence, aad);
+
+    QByteArray record(NonceSize + text.size() + TagSize, Qt::Uninitialized);
+    SecureRNG::random(record.data(), NonceSize);
+
+    const uchar *key = reinterpret_cast<const uchar*>(m_key.constData());
+    const uchar *nonce = reinterpret_cast<const uchar*>(record.constData());
+    uchar *out = reinterpret_cast<uchar*>(record.data()) + NonceSize;
+
+    std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> ctx(EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free);
+    int length = 0;
+    if (!ctx
+        || EVP_EncryptInit_ex(ctx.get(), EVP_aes_256_gcm(), nullptr, key, nonce) != 1
+        || EVP_EncryptUpdate(ctx.get(), nullptr, &length, aad, sizeof(aad)) != 1
+        || EVP_EncryptUpdate(ctx.get(), out, &length, reinterpret_cast<const uchar*>(text.constData()), text.size()) != 1
+        || EVP_EncryptFinal_ex(ctx.get(), out + length, &length) != 1
+        || EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_GET_TAG, TagSize, out + text.size()) != 1)
+    {
+        TEGO_BUG() << "Failed to encrypt conversation history";
+        return QByteArray();
+    }
+
+    return record;
+}
+
+bool ConversationStore::unseal(const QByteArray &record, qint64 sequence, QByteArray &text) const
+{
+    if (record.size() < NonceSize + TagSize)
+        return false;
+
+    uchar aad[sizeof(qint64)];
+    qToLittleEndian<qint64>(sequence, aad);
+
+    const int textSize = record.size() - NonceSize - TagSize;
+    const uchar *key = reinterpret_cast<const uchar*>(m_key.constData());
+    const uchar *nonce = reinterpret_cast<const uchar*>(record.constData());
+    const uchar *in = nonce + NonceSize;
+
+    QByteArray plain(textSize, Qt::Uninitialized);
+    uchar *out = reinterpret_cast<uchar*>(plain.data());
+
+    std::unique_ptr<EVP_CIPHER_CTX, decltype(&EVP_CIPHER_CTX_free)> ctx(EVP_CIPHER_CTX_new(), EVP_CIPHER_CTX_free);
+    int length = 0;
+    if (!ctx
+        || EVP_DecryptInit_ex(ctx.get(), EVP_aes_256_gcm(), nullptr, key, nonce) != 1
+        || EVP_DecryptUpdate(ctx.get(), nullptr, &length, aad, sizeof(aad)) != 1
+        || EVP_DecryptUpdate(ctx.get(), out, &length, in, textSize) != 1
+        || EVP_CIPHER_CTX_ctrl(ctx.get(), EVP_CTRL_GCM_SET_TAG, TagSize, const_cast<uchar*>(in + textSize)) != 1
+        || EVP_DecryptFinal_ex(ctx.get(), out + length, &length) != 1)
+    {
+        return false;
+    }
+
+    text = plain;
+    return true;
+}
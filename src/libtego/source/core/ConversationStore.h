@@ -0,0 +1,137 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2026, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CONVERSATIONSTORE_H
+#define CONVERSATIONSTORE_H
+
+/* Append-only on-disk message history for one contact
+ *
+ * Messages are numbered by sequence from zero, and stored in segments of
+ * SegmentLength messages. Each segment is a pair of files: a log holding the
+ * message text, and an index with a fixed size entry per message holding its
+ * time, identifier, type, status and location in the log. The status is the
+ * only thing ever rewritten.
+ *
+ * Opening a store only looks at the size of the newest index, and messages
+ * are read a page at a time, so no history is loaded until it is asked for.
+ * The first lookup by identifier reads every index once to build a map of
+ * identifiers to sequences, which is kept up to date by later appends.
+ * Lookups by time binary search the indexes, reading one entry per step.
+ *
+ * If a key is given the message text is encrypted with AES-256-GCM. The
+ * index is not encrypted.
+ */
+class ConversationStore
+{
+    Q_DISABLE_COPY(ConversationStore)
+
+public:
+    struct Entry
+    {
+        qint64 sequence;
+        qint64 time; // msecs since epoch
+        quint32 identifier;
+        quint8 type;
+        quint8 status;
+        bool isOutgoing;
+        QByteArray text; // utf8
+    };
+
+    static constexpr int KeySize = 32;
+    static constexpr qint64 SegmentLength = 4096;
+
+    ConversationStore(const QString &directory, const QByteArray &key);
+
+    QString directory() const { return m_directory; }
+    // Number of messages stored, which is also the sequence of the next one
+    qint64 count() const { return m_count; }
+
+    /* Append a message and return its sequence, or -1 on failure */
+    qint64 append(qint64 time, quint32 identifier, quint8 type, quint8 status, bool isOutgoing, const QByteArray &text);
+    bool setStatus(qint64 sequence, quint8 status);
+
+    /* Read up to limit messages preceding sequence, oldest first */
+    std::vector<Entry> readBefore(qint64 sequence, int limit) const;
+    /* Sequence of the newest message with this identifier and direction, or -1 */
+    qint64 find(quint32 identifier, bool isOutgoing) const;
+    /* Time of the newest message, or -1 if there are none; reads one index entry */
+    qint64 newestTime() const;
+    /* Sequence of the oldest message at or after time, count() if there is
+     * none, or -1 if the index can't be read. Messages are stored in the order
+     * they were added, so times only go backwards if the clock was set back,
+     * and then the result is a message near that time. */
+    qint64 findTime(qint64 time) const;
+
+private:
+    static constexpr int IndexEntrySize = 24;
+    static constexpr int NonceSize = 12;
+    static constexpr int TagSize = 16;
+
+    struct IndexEntry
+    {
+        qint64 time;
+        quint32 identifier;
+        quint8 type;
+        quint8 status;
+        quint8 flags;
+        quint32 offset;
+        quint32 size;
+    };
+
+    QString m_directory;
+    QByteArray m_key;
+    qint64 m_count;
+
+    // Files of the segment currently being appended to
+    qint64 m_openSegment;
+    QFile m_log;
+    QFile m_index;
+
+    // Newest sequence of each identifier and direction, for sequences below m_mapped
+    mutable QHash<quint64,qint64> m_sequences;
+    mutable qint64 m_mapped;
+
+    static quint64 sequenceKey(quint32 identifier, bool isOutgoing) { return (quint64(identifier) << 1) | (isOutgoing ? 1 : 0); }
+    void mapSequences() const;
+
+    QString segmentPath(qint64 segment, const QString &suffix) const;
+    bool openSegment(qint64 segment);
+    std::vector<IndexEntry> readIndex(qint64 first, qint64 end) const;
+
+    static QByteArray encodeIndexEntry(const IndexEntry &entry);
+    static IndexEntry decodeIndexEntry(const char *data);
+
+    QByteArray seal(const QByteArray &text, qint64 sequence) const;
+    bool unseal(const QByteArray &record, qint64 sequence, QByteArray &text) const;
+};
+
+#endif // CONVERSATIONSTORE_H
@@ -34,27 +34,24 @@
 #include "ContactIDValidator.h"
 #include "ContactUser.h"
 #include "core/OutgoingContactRequest.h"
+#include "UserIdentity.h"
+#include "utils/Useful.h"
 
-IdentityManager *identityManager = 0;
-
-IdentityManager::IdentityManager(const QString& serviceID, QObject *parent)
-    : QObject(parent), highestID(-1)
+IdentityManager::IdentityManager(tego_context *context, const QString& serviceID, QObject *parent)
+    : QObject(parent), m_context(context), highestID(-1)
 {
-    identityManager = this;
-
     if (serviceID.isEmpty())
     {
         createIdentity();
     }
     else
     {
-        addIdentity(new UserIdentity(0, serviceID, this));
+        addIdentity(new UserIdentity(m_context, 0, serviceID, this));
     }
 }
 
 IdentityManager::~IdentityManager()
 {
-    identityManager = 0;
 }
 
 void IdentityManager::addIdentity(UserIdentity *identity)
@@ -70,9 +67,36 @@ void IdentityManager::addIdentity(UserIdentity *identity)
             SLOT(onIncomingRequestRemoved(IncomingContactRequest*)));
 }
 
+UserIdentity *IdentityManager::addIdentity(const QString& serviceID)
+{
+    if (serviceID.isEmpty())
+        return createIdentity();
+
+    UserIdentity *identity = new UserIdentity(m_context, highestID + 1, serviceID, this);
+    addIdentity(identity);
+    return identity;
+}
+
+void IdentityManager::removeIdentity(UserIdentity *identity)
+{
+    if (m_identities.isEmpty() || identity == m_identities.first()) {
+        TEGO_BUG() << "Cannot remove the first identity";
+        return;
+    }
+
+    if (!m_identities.removeOne(identity))
+        return;
+
+    qDebug() << "Removing identity" << identity->hostname();
+    identity->disconnect(this);
+    identity->contacts.disconnect(this);
+    identity->contacts.incomingRequests.disconnect(this);
+    identity->deleteLater();
+}
+
 UserIdentity *IdentityManager::createIdentity()
 {
-    UserIdentity *identity = UserIdentity::createIdentity(++highestID);
+    UserIdentity *identity = UserIdentity::createIdentity(m_context, ++highestID, this);
     if (!identity)
         return identity;
 
@@ -99,6 +123,17 @@ UserIdentity *IdentityManager::lookupHostname(const QString &hostname) const
     return 0;
 }
 
+UserIdentity *IdentityManager::lookupServiceId(const QByteArray &serviceId) const
+{
+    const QByteArray key = serviceId.toLower();
+    for (UserIdentity *identity : m_identities) {
+        if (ContactsManager::serviceIdKey(identity->hostname()) == key)
+            return identity;
+    }
+
+    return 0;
+}
+
 UserIdentity *IdentityManager::lookupUniqueID(int uniqueID) const
 {
     for (QList<UserIdentity*>::ConstIterator it = m_identities.begin(); it != m_identities.end(); ++it)
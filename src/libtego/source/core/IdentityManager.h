@@ -33,7 +33,11 @@
 #ifndef IDENTITYMANAGER_H
 #define IDENTITYMANAGER_H
 
-// TODO: this needs to go entirely, we do not have multiple simultaneous UserIdentity objects
+/* Holds the identities hosted by a context
+ *
+ * The first identity is the one given when the manager is created; more can
+ * be added and removed while running. Each has its own onion service, all
+ * published through the context's tor instance. */
 class IdentityManager : public QObject
 {
     Q_OBJECT
@@ -41,14 +45,20 @@ class IdentityManager : public QObject
 
 public:
     // serviceID : string ED25519-V3 keyblob pulled from config.json, or empty string to create one
-    explicit IdentityManager(const QString& serviceID, QObject *parent = 0);
+    IdentityManager(tego_context *context, const QString& serviceID, QObject *parent = 0);
     ~IdentityManager();
 
     const QList<class UserIdentity*> &identities() const { return m_identities; }
     class UserIdentity *lookupHostname(const QString &hostname) const;
     class UserIdentity *lookupUniqueID(int uniqueID) const;
+    // Look up an identity by its 56 character service id
+    class UserIdentity *lookupServiceId(const QByteArray &serviceId) const;
 
     class UserIdentity *createIdentity();
+    // serviceID : ED25519-V3 keyblob of the identity's key, or empty to create one
+    class UserIdentity *addIdentity(const QString& serviceID);
+    // Remove and delete an identity other than the first, with its contacts
+    void removeIdentity(class UserIdentity *identity);
 
 signals:
     void contactDeleted(class ContactUser *user, class UserIdentity *identity);
@@ -62,12 +72,11 @@ private slots:
     void onIncomingRequestRemoved(class IncomingContactRequest *request);
 
 private:
+    tego_context * const m_context;
     QList<class UserIdentity*> m_identities;
     int highestID;
 
     void addIdentity(class UserIdentity *identity);
 };
 
-extern class IdentityManager* identityManager;
-
 #endif // IDENTITYMANAGER_H
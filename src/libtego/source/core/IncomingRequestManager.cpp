@@ -36,6 +36,7 @@
 #include "ContactUser.h"
 #include "OutgoingContactRequest.h"
 #include "ContactIDValidator.h"
+#include "UserIdentity.h"
 #include "utils/Useful.h"
 #include "protocol/Connection.h"
 #include "protocol/ContactRequestChannel.h"
@@ -43,7 +44,6 @@
 #include "ed25519.hpp"
 #include "context.hpp"
 #include "user.hpp"
-#include "globals.hpp"
 
 IncomingRequestManager::IncomingRequestManager(ContactsManager *c)
     : QObject(c), contacts(c)
@@ -55,14 +55,7 @@ IncomingRequestManager::IncomingRequestManager(ContactsManager *c)
     connect(this, &IncomingRequestManager::requestAdded, [self=this](IncomingContactRequest* request) -> void
     {
         // convert the hostname to user id
-        const auto hostname = request->hostname();
-        auto serviceIdRaw = hostname.chopped(tego::static_strlen(".onion"));
-
-        std::unique_ptr<tego_v3_onion_service_id_t> serviceId;
-        tego_v3_onion_service_id_from_string(tego::out(serviceId), serviceIdRaw.data(), static_cast<size_t>(serviceIdRaw.size()), tego::throw_on_error());
-
-        std::unique_ptr<tego_user_id_t> userId;
-        tego_user_id_from_v3_onion_service_id(tego::out(userId), serviceId.get(), tego::throw_on_error());
+        auto userId = self->contacts->identity->toTegoUserId(QString::fromLatin1(request->hostname()));
 
         auto message = request->message().toUtf8();
 
@@ -70,7 +63,7 @@ IncomingRequestManager::IncomingRequestManager(ContactsManager *c)
         auto rawMessage = std::make_unique<char[]>(messageLength + 1);
         std::copy(message.begin(), message.end(), rawMessage.get());
 
-        tego::g_globals.context->callback_registry_.emit_chat_request_received(userId.release(), rawMessage.release(), messageLength);
+        self->contacts->identity->context->callback_registry_.emit_chat_request_received(userId.release(), rawMessage.release(), messageLength);
 
         logger::trace();
     });
@@ -93,7 +86,7 @@ void IncomingRequestManager::loadRequests(const QList<QString> userHostnames)
     for(const auto& hostname : userHostnames)
     {
         IncomingContactRequest* request = new IncomingContactRequest(this, hostname.toUtf8());
-        m_requests.append(request);
+        insertRequest(request);
         emit requestAdded(request);
     }
 }
@@ -107,17 +100,24 @@ QList<QObject*> IncomingRequestManager::requestObjects() const
     return re;
 }
 
-IncomingContactRequest *IncomingRequestManager::requestFromHostname(const QByteArray &hostname)
+IncomingContactRequest *IncomingRequestManager::requestFromHostname(const QByteArray &hostname) const
 {
     Q_ASSERT(hostname.endsWith(".onion"));
 
     Q_ASSERT(hostname == hostname.toLower());
 
-    for (QList<IncomingContactRequest*>::ConstIterator it = m_requests.begin(); it != m_requests.end(); ++it)
-        if ((*it)->hostname() == hostname)
-            return *it;
+    return requestFromServiceId(ContactsManager::serviceIdKey(hostname));
+}
 
-    return 0;
+IncomingContactRequest *IncomingRequestManager::requestFromServiceId(const QByteArray &serviceId) const
+{
+    return m_requestIndex.value(serviceId, nullptr);
+}
+
+void IncomingRequestManager::insertRequest(IncomingContactRequest *request)
+{
+    m_requests.append(request);
+    m_requestIndex.insert(ContactsManager::serviceIdKey(request->hostname()), request);
 }
 
 void IncomingRequestManager::requestReceived()
@@ -143,7 +143,7 @@ void IncomingRequestManager::requestReceived()
         return;
     }
 
-    if (identityManager->lookupHostname(hostname)) {
+    if (contacts->identity->context->identityManager->lookupHostname(hostname)) {
         qDebug() << "Rejecting contact request from a local identity (which shouldn't have been allowed)";
         channel->setResponseStatus(Response::Error);
         return;
@@ -175,32 +175,43 @@ void IncomingRequestManager::requestReceived()
 
     request->save();
     if (newRequest) {
-        m_requests.append(request);
+        insertRequest(request);
         emit requestAdded(request);
     }
 }
 
 void IncomingRequestManager::removeRequest(IncomingContactRequest *request)
 {
-    if (m_requests.removeOne(request))
+    if (m_requests.removeOne(request)) {
+        m_requestIndex.remove(ContactsManager::serviceIdKey(request->hostname()));
         emit requestRemoved(request);
+    }
 
     request->deleteLater();
 }
 
 void IncomingRequestManager::addRejectedHost(const QByteArray &hostname)
 {
-    this->rejectedHosts.insert(hostname);
+    this->rejectedHosts.insert(ContactsManager::serviceIdKey(hostname));
 }
 
 bool IncomingRequestManager::isHostnameRejected(const QByteArray &hostname) const
 {
-    return this->rejectedHosts.contains(hostname);
+    return isServiceIdRejected(ContactsManager::serviceIdKey(hostname));
+}
+
+bool IncomingRequestManager::isServiceIdRejected(const QByteArray &serviceId) const
+{
+    return this->rejectedHosts.contains(serviceId);
 }
 
 QList<QByteArray> IncomingRequestManager::getRejectedHostnames() const
 {
-    return this->rejectedHosts.values();
+    QList<QByteArray> hostnames;
+    hostnames.reserve(this->rejectedHosts.size());
+    for (const auto &serviceId : this->rejectedHosts)
+        hostnames.append(serviceId + ".onion");
+    return hostnames;
 }
 
 IncomingContactRequest::IncomingContactRequest(IncomingRequestManager *m, const QByteArray &h
@@ -119,7 +119,9 @@ public:
     QList<IncomingContactRequest*> requests() const { return m_requests; }
 
     /* Hostname is an onion address, including the '.onion' suffix */
-    IncomingContactRequest *requestFromHostname(const QByteArray &hostname);
+    IncomingContactRequest *requestFromHostname(const QByteArray &hostname) const;
+    /* Service id is the lower-case onion address without the suffix */
+    IncomingContactRequest *requestFromServiceId(const QByteArray &serviceId) const;
 
     /* Called by ContactsManager to trigger loading past requests from the
      * configuration. */
@@ -130,6 +132,7 @@ public:
     /* Blacklist a host for immediate rejection in the future */
     void addRejectedHost(const QByteArray &hostname);
     bool isHostnameRejected(const QByteArray &hostname) const;
+    bool isServiceIdRejected(const QByteArray &serviceId) const;
     QList<QByteArray> getRejectedHostnames() const;
 
 signals:
@@ -142,8 +145,11 @@ private slots:
 
 private:
     QList<IncomingContactRequest*> m_requests;
+    // Requests and blocked hosts by service id, see ContactsManager::serviceIdKey
+    QHash<QByteArray, IncomingContactRequest*> m_requestIndex;
     QSet<QByteArray> rejectedHosts;
 
+    void insertRequest(IncomingContactRequest *request);
     void removeRequest(IncomingContactRequest *request);
 };
 
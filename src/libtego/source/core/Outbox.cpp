@@ -0,0 +1,138 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2026, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Outbox.h"
+
+/* Records are a little endian qint64: the sequence of a message added to the
+ * outbox, or its complement (always negative) for a message removed from it.
+ * A record cut short by a crash is ignored and overwritten. */
+
+Outbox::Outbox(const QString &filePath)
+    : m_filePath(filePath)
+    , m_file(filePath)
+    , m_records(0)
+{
+    if (!m_file.open(QIODevice::ReadWrite)) {
+        qWarning() << "Cannot open outbox" << m_filePath << ":" << m_file.errorString();
+        return;
+    }
+
+    const QByteArray data = m_file.readAll();
+    m_records = data.size() / RecordSize;
+    const uchar *p = reinterpret_cast<const uchar*>(data.constData());
+    for (qint64 i = 0; i < m_records; i++, p += RecordSize) {
+        const qint64 record = qFromLittleEndian<qint64>(p);
+        if (record >= 0)
+            m_pending.insert(record);
+        else
+            m_pending.erase(~record);
+    }
+
+    if (m_pending.empty() && m_records > 0) {
+        // Nothing is pending, so the whole journal is stale
+        m_records = 0;
+        m_file.resize(0);
+    } else if (m_records - qint64(m_pending.size()) >= CompactThreshold)
+        compact();
+    else if (data.size() != m_records * RecordSize)
+        m_file.resize(m_records * RecordSize);
+    m_file.seek(m_file.size());
+}
+
+bool Outbox::hasPending(const QString &filePath)
+{
+    return QFileInfo(filePath).size() > 0;
+}
+
+bool Outbox::add(qint64 sequence)
+{
+    if (sequence < 0 || !m_pending.insert(sequence).second)
+        return false;
+    return write(sequence);
+}
+
+bool Outbox::remove(qint64 sequence)
+{
+    if (m_pending.erase(sequence) == 0)
+        return false;
+
+    if (m_pending.empty()) {
+        // Nothing is pending, so the whole journal is stale
+        m_records = 0;
+        return m_file.resize(0) && m_file.seek(0);
+    }
+
+    if (!write(~sequence))
+        return false;
+    if (m_records - qint64(m_pending.size()) >= CompactThreshold)
+        compact();
+    return true;
+}
+
+bool Outbox::write(qint64 record)
+{
+    if (!m_file.isOpen())
+        return false;
+
+    uchar data[RecordSize];
+    qToLittleEndian<qint64>(record, data);
+    if (m_file.write(reinterpret_cast<const char*>(data), RecordSize) != RecordSize || !m_file.flush()) {
+        qWarning() << "Cannot write to outbox" << m_filePath << ":" << m_file.errorString();
+        return false;
+    }
+
+    m_records++;
+    return true;
+}
+
+void Outbox::compact()
+{
+    QByteArray data(int(m_pending.size()) * RecordSize, Qt::Uninitialized);
+    uchar *p = reinterpret_cast<uchar*>(data.data());
+    for (qint64 sequence : m_pending) {
+        qToLittleEndian<qint64>(sequence, p);
+        p += RecordSize;
+    }
+
+    // The journal is replaced atomically, so a crash leaves either the old or the new one
+    m_file.close();
+    QSaveFile file(m_filePath);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit())
+        qWarning() << "Cannot rewrite outbox" << m_filePath << ":" << file.errorString();
+
+    if (!m_file.open(QIODevice::ReadWrite)) {
+        qWarning() << "Cannot open outbox" << m_filePath << ":" << m_file.errorString();
+        return;
+    }
+    m_records = m_file.size() / RecordSize;
+    m_file.seek(m_file.size());
+}
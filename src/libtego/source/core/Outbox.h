@@ -0,0 +1,80 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2026, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+/* Write-ahead journal of a conversation's undelivered outgoing messages
+ *
+ * Messages are identified by their sequence in the ConversationStore. A
+ * message is added to the outbox just before it is stored, and removed once
+ * it is delivered or given up on, so the outbox names every message a
+ * restart must send again. Records for sequences the store never reached are
+ * discarded when the outbox is opened alongside the store.
+ *
+ * The journal is a file of 8 byte records, appended and flushed on every
+ * change. It is rewritten with just the pending messages once it holds
+ * enough records for messages that are no longer pending, and truncated
+ * whenever nothing is pending.
+ */
+class Outbox
+{
+    Q_DISABLE_COPY(Outbox)
+
+public:
+    explicit Outbox(const QString &filePath);
+
+    /* Sequences of undelivered messages, oldest first */
+    const std::set<qint64> &pending() const { return m_pending; }
+
+    /* Whether the journal at filePath may name undelivered messages, without
+     * opening it; an empty or missing journal has none */
+    static bool hasPending(const QString &filePath);
+
+    bool add(qint64 sequence);
+    bool remove(qint64 sequence);
+
+private:
+    static constexpr int RecordSize = 8;
+    // Stale records tolerated before the journal is rewritten
+    static constexpr qint64 CompactThreshold = 1024;
+
+    QString m_filePath;
+    QFile m_file;
+    std::set<qint64> m_pending;
+    qint64 m_records;
+
+    bool write(qint64 record);
+    void compact();
+};
+
+#endif // OUTBOX_H
@@ -0,0 +1,329 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2026, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "SearchIndex.h"
+
+SearchIndex::SearchIndex(const QString &filePath, const QByteArray &key)
+    : m_filePath(filePath)
+    , m_key(key)
+    , m_loaded(false)
+    , m_documentCount(0)
+    , m_totalLength(0)
+{
+}
+
+void SearchIndex::add(qint64 sequence, const QString &text)
+{
+    const QHash<QString, int> counts = words(text);
+    if (counts.isEmpty() || sequence < 0 || sequence > std::numeric_limits<quint32>::max())
+        return;
+
+    if (!m_file.isOpen()) {
+        m_file.setFileName(m_filePath);
+        if (!m_file.open(QIODevice::ReadWrite | QIODevice::Append)) {
+            qWarning() << "Cannot open search index" << m_filePath << m_file.errorString();
+            return;
+        }
+        // Drop a partially written posting, which would misalign everything after it
+        m_file.resize(m_file.size() - m_file.size() % PostingSize);
+    }
+
+    const qint64 first = m_file.size() / PostingSize;
+    if (first + counts.size() >= NoPrevious) {
+        qWarning() << "Search index" << m_filePath << "is full";
+        return;
+    }
+
+    int length = 0;
+    for (int count : counts)
+        length += count;
+
+    Posting posting;
+    posting.sequence = static_cast<quint32>(sequence);
+    posting.length = static_cast<quint16>(qMin(length, 0xFFFF));
+
+    /* Postings are 20 bytes, little endian:
+     *   0: word hash, quint64
+     *   8: message sequence, quint32
+     *  12: occurrences of the word in the message, quint16
+     *  14: length of the message in words, quint16
+     *  16: index of the previous posting of the word, quint32, or NoPrevious
+     * All postings for a message are written together. Until the index is
+     * loaded the previous postings aren't known, so they are written as
+     * NoPrevious and linked by load(). */
+    QByteArray data(counts.size() * PostingSize, Qt::Uninitialized);
+    std::vector<std::pair<quint64, quint32>> added;
+    uchar *p = reinterpret_cast<uchar*>(data.data());
+    quint32 index = static_cast<quint32>(first);
+    for (auto it = counts.constBegin(); it != counts.constEnd(); ++it, p += PostingSize, index++) {
+        const quint64 hash = wordHash(it.key());
+        posting.frequency = static_cast<quint16>(qMin(it.value(), 0xFFFF));
+        posting.previous = m_loaded ? m_terms.value(hash).newest : NoPrevious;
+
+        qToLittleEndian<quint64>(hash, p);
+        qToLittleEndian<quint32>(posting.sequence, p + 8);
+        qToLittleEndian<quint16>(posting.frequency, p + 12);
+        qToLittleEndian<quint16>(posting.length, p + 14);
+        qToLittleEndian<quint32>(posting.previous, p + 16);
+        added.push_back({hash, index});
+    }
+
+    if (m_file.write(data) != data.size() || !m_file.flush()) {
+        qWarning() << "Failed writing search index" << m_filePath << m_file.errorString();
+        return;
+    }
+
+    if (m_loaded) {
+        for (const auto &word : added) {
+            Term &term = m_terms[word.first];
+            term.newest = word.second;
+            term.count++;
+        }
+        m_documentCount++;
+        m_totalLength += posting.length;
+    }
+}
+
+std::vector<SearchIndex::Result> SearchIndex::search(const QString &query, int limit)
+{
+    std::vector<Result> results;
+    const QHash<QString, int> queryWords = words(query);
+    if (queryWords.isEmpty() || limit <= 0)
+        return results;
+
+    if (!m_loaded)
+        load();
+
+    std::vector<std::pair<quint64, Term>> terms;
+    for (auto it = queryWords.constBegin(); it != queryWords.constEnd(); ++it) {
+        const quint64 hash = wordHash(it.key());
+        auto found = m_terms.constFind(hash);
+        if (found == m_terms.constEnd())
+            return results;
+        terms.push_back({hash, found.value()});
+    }
+
+    // Candidates come from the rarest word, and are looked for among the others
+    std::sort(terms.begin(), terms.end(), [](const auto &a, const auto &b) { return a.second.count < b.second.count; });
+
+    constexpr double k1 = 1.2;
+    constexpr double b = 0.75;
+    const double documentCount = static_cast<double>(m_documentCount);
+    const double averageLength = m_documentCount > 0 ? static_cast<double>(m_totalLength) / documentCount : 1.0;
+
+    auto idf = [&](const Term &term) -> double {
+        const double frequency = static_cast<double>(term.count);
+        return std::log(1.0 + (documentCount - frequency + 0.5) / (frequency + 0.5));
+    };
+    auto weight = [&](const Posting &posting, double wordIdf) -> double {
+        const double tf = posting.frequency;
+        return wordIdf * tf * (k1 + 1.0) / (tf + k1 * (1.0 - b + b * posting.length / averageLength));
+    };
+
+    Reader reader;
+    reader.file.setFileName(m_filePath);
+    if (!reader.file.open(QIODevice::ReadOnly)) {
+        qWarning() << "Cannot open search index" << m_filePath << reader.file.errorString();
+        return results;
+    }
+
+    // Postings are linked newest first, so the candidates are in descending sequence order
+    std::vector<quint32> candidates;
+    std::vector<double> scores;
+    Posting posting;
+    const double rarestIdf = idf(terms.front().second);
+    for (quint32 index = terms.front().second.newest;
+         candidates.size() < static_cast<size_t>(MaxCandidates) && readPosting(reader, terms.front().first, index, posting);
+         index = posting.previous) {
+        candidates.push_back(posting.sequence);
+        scores.push_back(weight(posting, rarestIdf));
+    }
+
+    std::vector<bool> matches(candidates.size(), true);
+    for (size_t i = 1; i < terms.size(); i++) {
+        // Postings of the other words are only read as far back as the oldest candidate
+        const double wordIdf = idf(terms[i].second);
+        size_t c = 0;
+        for (quint32 index = terms[i].second.newest;
+             c < candidates.size() && readPosting(reader, terms[i].first, index, posting);
+             index = posting.previous) {
+            for (; c < candidates.size() && candidates[c] > posting.sequence; c++)
+                matches[c] = false;
+            if (c < candidates.size() && candidates[c] == posting.sequence)
+                scores[c++] += weight(posting, wordIdf);
+        }
+        for (; c < candidates.size(); c++)
+            matches[c] = false;
+    }
+
+    for (size_t c = 0; c < candidates.size(); c++) {
+        if (matches[c])
+            results.push_back({static_cast<qint64>(candidates[c]), scores[c]});
+    }
+
+    // Most relevant first, and newest first among equals
+    auto better = [](const Result &a, const Result &b) {
+        return a.score != b.score ? a.score > b.score : a.sequence > b.sequence;
+    };
+    if (results.size() > static_cast<size_t>(limit)) {
+        std::partial_sort(results.begin(), results.begin() + limit, results.end(), better);
+        results.resize(static_cast<size_t>(limit));
+    } else {
+        std::sort(results.begin(), results.end(), better);
+    }
+
+    return results;
+}
+
+QHash<QString, int> SearchIndex::words(const QString &text)
+{
+    QHash<QString, int> counts;
+    const QString folded = text.toCaseFolded();
+
+    int start = -1;
+    for (int i = 0; i <= folded.size(); i++) {
+        const bool isWordCharacter = i < folded.size() && folded.at(i).isLetterOrNumber();
+        if (isWordCharacter && start < 0) {
+            start = i;
+        } else if (!isWordCharacter && start >= 0) {
+            const int length = i - start;
+            if (length >= MinimumWordLength && length <= MaximumWordLength)
+                counts[folded.mid(start, length)]++;
+            start = -1;
+        }
+    }
+
+    return counts;
+}
+
+quint64 SearchIndex::wordHash(const QString &word) const
+{
+    const QByteArray utf8 = word.toUtf8();
+    const QByteArray digest = m_key.isEmpty()
+        ? QCryptographicHash::hash(utf8, QCryptographicHash::Sha256)
+        : QMessageAuthenticationCode::hash(utf8, m_key, QCryptographicHash::Sha256);
+    return qFromLittleEndian<quint64>(digest.constData());
+}
+
+void SearchIndex::load()
+{
+    m_loaded = true;
+
+    QFile file(m_filePath);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+
+    // Postings whose link to the previous posting of their word is missing or
+    // wrong, and what it should be
+    std::vector<std::pair<quint32, quint32>> unlinked;
+
+    bool isFirst = true;
+    quint32 previousSequence = 0;
+    quint32 index = 0;
+    const qint64 blockSize = qint64(ReadBlockPostings) * PostingSize;
+    for (;;) {
+        const QByteArray data = file.read(blockSize);
+        for (int i = 0; i + PostingSize <= data.size(); i += PostingSize, index++) {
+            const uchar *p = reinterpret_cast<const uchar*>(data.constData()) + i;
+            const quint32 sequence = qFromLittleEndian<quint32>(p + 8);
+            const quint16 length = qFromLittleEndian<quint16>(p + 14);
+
+            Term &term = m_terms[qFromLittleEndian<quint64>(p)];
+            if (qFromLittleEndian<quint32>(p + 16) != term.newest)
+                unlinked.push_back({index, term.newest});
+            term.newest = index;
+            term.count++;
+
+            if (isFirst || sequence != previousSequence) {
+                m_documentCount++;
+                m_totalLength += length;
+                previousSequence = sequence;
+                isFirst = false;
+            }
+        }
+        if (data.size() < blockSize)
+            break;
+    }
+    file.close();
+
+    if (unlinked.empty())
+        return;
+
+    if (!file.open(QIODevice::ReadWrite)) {
+        qWarning() << "Cannot link postings in search index" << m_filePath << file.errorString();
+        return;
+    }
+    for (const auto &link : unlinked) {
+        uchar data[4];
+        qToLittleEndian<quint32>(link.second, data);
+        if (!file.seek(qint64(link.first) * PostingSize + 16) ||
+            file.write(reinterpret_cast<const char*>(data), 4) != 4) {
+            qWarning() << "Cannot link postings in search index" << m_filePath << file.errorString();
+            return;
+        }
+    }
+}
+
+bool SearchIndex::readPosting(Reader &reader, quint64 hash, quint32 index, Posting &posting) const
+{
+    if (index == NoPrevious)
+        return false;
+
+    const qint64 offset = qint64(index) * PostingSize;
+    if (offset < reader.blockStart || offset + PostingSize > reader.blockStart + reader.block.size()) {
+        // Postings are followed towards the start of the file, so the block ends with this one
+        reader.blockStart = qMax<qint64>(0, offset + PostingSize - qint64(ReadBlockPostings) * PostingSize);
+        const qint64 size = offset + PostingSize - reader.blockStart;
+        if (!reader.file.seek(reader.blockStart) || (reader.block = reader.file.read(size)).size() != size) {
+            qWarning() << "Cannot read search index" << m_filePath << reader.file.errorString();
+            reader.block.clear();
+            return false;
+        }
+    }
+
+    const uchar *p = reinterpret_cast<const uchar*>(reader.block.constData()) + (offset - reader.blockStart);
+    if (qFromLittleEndian<quint64>(p) != hash) {
+        qWarning() << "Search index" << m_filePath << "has a broken link to posting" << index;
+        return false;
+    }
+
+    posting.sequence = qFromLittleEndian<quint32>(p + 8);
+    posting.frequency = qFromLittleEndian<quint16>(p + 12);
+    posting.length = qFromLittleEndian<quint16>(p + 14);
+    posting.previous = qFromLittleEndian<quint32>(p + 16);
+    // Links only point back, so a corrupt file can't make a search loop
+    if (posting.previous != NoPrevious && posting.previous >= index) {
+        qWarning() << "Search index" << m_filePath << "has a broken link from posting" << index;
+        posting.previous = NoPrevious;
+    }
+    return true;
+}
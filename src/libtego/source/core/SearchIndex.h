@@ -0,0 +1,119 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2026, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SEARCHINDEX_H
+#define SEARCHINDEX_H
+
+/* Inverted index over the text of a conversation's stored messages
+ *
+ * Each word of a message adds a posting of the message's sequence, the
+ * number of times the word occurs and the length of the message in words.
+ * Postings are appended to a file as messages are added, each linked to the
+ * previous posting of the same word. Words are case-folded runs of letters
+ * and digits, and are kept as 64-bit hashes; when a key is set they are
+ * keyed, so the file does not reveal the words of encrypted history.
+ *
+ * The first search reads through the file once to find the newest posting
+ * and the number of postings of each word; only that table is kept in
+ * memory, and the postings of the words in a query are read from the file
+ * as the query is scored.
+ *
+ * Searches return the messages containing every word of the query, ranked
+ * by BM25. Only the newest MaxCandidates messages containing the rarest
+ * word of the query are scored, so older matches of a query made only of
+ * very common words are not found.
+ */
+class SearchIndex
+{
+    Q_DISABLE_COPY(SearchIndex)
+
+public:
+    struct Result
+    {
+        qint64 sequence;
+        double score;
+    };
+
+    SearchIndex(const QString &filePath, const QByteArray &key);
+
+    void add(qint64 sequence, const QString &text);
+    /* Up to limit results, most relevant first */
+    std::vector<Result> search(const QString &query, int limit);
+
+private:
+    static constexpr int PostingSize = 20;
+    static constexpr int MinimumWordLength = 2;
+    static constexpr int MaximumWordLength = 64;
+    static constexpr int MaxCandidates = 10000;
+    // Postings read from the file at once while scoring a query
+    static constexpr int ReadBlockPostings = 4096;
+    // Previous posting of a word's first posting
+    static constexpr quint32 NoPrevious = 0xFFFFFFFF;
+
+    struct Posting
+    {
+        quint32 sequence;
+        quint16 frequency;
+        quint16 length;
+        quint32 previous;
+    };
+
+    struct Term
+    {
+        quint32 newest = NoPrevious;
+        quint32 count = 0;
+    };
+
+    // Postings of the file being read by a search
+    struct Reader
+    {
+        QFile file;
+        QByteArray block;
+        qint64 blockStart = 0;
+    };
+
+    QString m_filePath;
+    QByteArray m_key;
+    QFile m_file;
+
+    bool m_loaded;
+    QHash<quint64, Term> m_terms;
+    quint64 m_documentCount;
+    quint64 m_totalLength;
+
+    static QHash<QString, int> words(const QString &text);
+    quint64 wordHash(const QString &word) const;
+    void load();
+    bool readPosting(Reader &reader, quint64 hash, quint32 index, Posting &posting) const;
+};
+
+#endif // SEARCHINDEX_H
@@ -33,9 +33,6 @@
 #include "signals.hpp"
 #include "context.hpp"
 #include "ed25519.hpp"
-#include "globals.hpp"
-
-using tego::g_globals;
 
 #include "UserIdentity.h"
 #include "tor/TorControl.h"
@@ -43,28 +40,35 @@ using tego::g_globals;
 #include "core/ContactIDValidator.h"
 #include "core/ContactUser.h"
 #include "protocol/Connection.h"
+#include "protocol/Connection_p.h"
 #include "utils/Useful.h"
 
 using namespace Protocol;
 
-UserIdentity::UserIdentity(int id, const QString& serviceID, QObject *parent)
+UserIdentity::UserIdentity(tego_context *c, int id, const QString& serviceID, QObject *parent)
     : QObject(parent)
+    , context(c)
     , uniqueID(id)
     , contacts(this)
     , m_hiddenService(0)
     , m_incomingServer(0)
+    , m_maxPendingIncomingConnections(qMax(1, c->incomingMaxPending))
+    , m_incomingAcceptLimiter(c->incomingAcceptRate, c->incomingAcceptBurst)
 {
     setupService(serviceID);
 }
 
-UserIdentity *UserIdentity::createIdentity(int uniqueID)
+UserIdentity::~UserIdentity()
 {
-    // There is actually no support for multiple identities currently.
-    Q_ASSERT(uniqueID == 0);
-    if (uniqueID != 0)
-        return 0;
+    if (m_hiddenService && context->torControl)
+        context->torControl->removeHiddenService(m_hiddenService);
+}
+
+const int UserIdentity::MaxIncomingHandshakeTimeout = Protocol::ConnectionPrivate::UnknownPurposeTimeout;
 
-    return new UserIdentity(uniqueID, "", {});
+UserIdentity *UserIdentity::createIdentity(tego_context *context, int uniqueID, QObject *parent)
+{
+    return new UserIdentity(context, uniqueID, "", parent);
 }
 
 // TODO: Handle the error cases of this function in a useful way
@@ -94,7 +98,7 @@ void UserIdentity::setupService(const QString& serviceID)
                     static_cast<size_t>(rawKey.size()),
                     tego::throw_on_error());
 
-                g_globals.context->callback_registry_.emit_new_identity_created(privateKey.release());
+                context->callback_registry_.emit_new_identity_created(privateKey.release());
             }
         );
     }
@@ -112,8 +116,13 @@ void UserIdentity::setupService(const QString& serviceID)
 
     m_hiddenService->addTarget(9878, m_incomingServer->serverAddress(), m_incomingServer->serverPort());
 
-    g_globals.context->torControl->setHiddenService(m_hiddenService);
-    g_globals.context->torControl->publishHiddenService();
+    connect(m_hiddenService, &Tor::HiddenService::stateChanged, this,
+        [this]() {
+            context->set_identity_onion_service_state(this, m_hiddenService->state());
+        }
+    );
+
+    context->torControl->addHiddenService(m_hiddenService);
 }
 
 QString UserIdentity::hostname() const
@@ -126,6 +135,51 @@ QString UserIdentity::contactID() const
     return ContactIDValidator::idFromHostname(hostname());
 }
 
+std::unique_ptr<tego_user_id_t> UserIdentity::toTegoUserId() const
+{
+    auto serviceIdString = hostname().left(TEGO_V3_ONION_SERVICE_ID_LENGTH).toUtf8();
+    tego_v3_onion_service_id serviceId(serviceIdString.data(), static_cast<size_t>(serviceIdString.size()));
+
+    return std::make_unique<tego_user_id_t>(serviceId);
+}
+
+std::unique_ptr<tego_user_id_t> UserIdentity::toTegoUserId(const QString &userHostname) const
+{
+    auto serviceIdString = userHostname.left(TEGO_V3_ONION_SERVICE_ID_LENGTH).toUtf8();
+    tego_v3_onion_service_id serviceId(serviceIdString.data(), static_cast<size_t>(serviceIdString.size()));
+
+    auto identityString = hostname().left(TEGO_V3_ONION_SERVICE_ID_LENGTH).toUtf8();
+    tego_v3_onion_service_id identityServiceId(identityString.data(), static_cast<size_t>(identityString.size()));
+
+    return std::make_unique<tego_user_id_t>(serviceId, identityServiceId);
+}
+
+void UserIdentity::setIncomingConnectionLimits(int maxPending, int acceptRate, int acceptBurst)
+{
+    m_maxPendingIncomingConnections = qMax(1, maxPending);
+    m_incomingAcceptLimiter.setLimits(acceptRate, acceptBurst);
+}
+
+/* Decide whether another incoming connection can be accepted
+ *
+ * All incoming connections arrive from the local tor instance, so there
+ * is no peer address to limit by; the limits apply to the service as a whole.
+ */
+bool UserIdentity::admitIncomingConnection()
+{
+    if (m_incomingConnections.size() >= m_maxPendingIncomingConnections) {
+        qDebug() << "Refusing incoming connection;" << m_incomingConnections.size() << "connections are already pending";
+        return false;
+    }
+
+    if (!m_incomingAcceptLimiter.take()) {
+        qDebug() << "Refusing incoming connection; accept rate limit exceeded";
+        return false;
+    }
+
+    return true;
+}
+
 /* Handle an incoming connection to this service
  *
  * A Protocol::Connection is created to handle this socket. The
@@ -136,12 +190,22 @@ QString UserIdentity::contactID() const
  * If the connection successfully completes authentication,
  * handleIncomingAuthedConnection is called to link it to a ContactUser
  * (if applicable) and set the purpose.
+ *
+ * Connections beyond the limits of admitIncomingConnection are closed
+ * without creating a Connection, and a connection which hasn't negotiated
+ * and authenticated within the context's incomingHandshakeTimeout seconds is closed.
  */
 void UserIdentity::onIncomingConnection()
 {
     while (m_incomingServer->hasPendingConnections()) {
         QTcpSocket *socket = m_incomingServer->nextPendingConnection();
 
+        if (!admitIncomingConnection()) {
+            socket->abort();
+            socket->deleteLater();
+            continue;
+        }
+
         /* The localHostname property is used by Connection to determine the
          * server onion hostname that this socket is connected to, which is
          * used by the serverHostname() method.
@@ -149,7 +213,7 @@ void UserIdentity::onIncomingConnection()
         socket->setProperty("localHostname", m_hiddenService->hostname());
 
         qDebug() << "Accepted new incoming connection";
-        QSharedPointer<Connection> conn(new Connection(socket, Connection::ServerSide), &QObject::deleteLater);
+        QSharedPointer<Connection> conn(new Connection(socket, Connection::ServerSide, context), &QObject::deleteLater);
         Q_ASSERT(socket->parent());
 
         m_incomingConnections.append(conn);
@@ -166,10 +230,22 @@ void UserIdentity::onIncomingConnection()
             }
         );
 
+        QTimer *handshakeTimer = new QTimer(connPtr);
+        handshakeTimer->setSingleShot(true);
+        connect(handshakeTimer, &QTimer::timeout, connPtr,
+            [connPtr]() {
+                qDebug() << "Closing incoming connection" << connPtr << "which did not authenticate in time";
+                connPtr->close();
+            }
+        );
+        handshakeTimer->start(qBound(1, context->incomingHandshakeTimeout, MaxIncomingHandshakeTimeout) * 1000);
+
         connect(connPtr, &Connection::authenticated, this,
-            [this,connPtr](Connection::AuthenticationType type) {
-                if (type == Connection::HiddenServiceAuth)
+            [this,connPtr,handshakeTimer](Connection::AuthenticationType type) {
+                if (type == Connection::HiddenServiceAuth) {
+                    handshakeTimer->stop();
                     handleIncomingAuthedConnection(connPtr);
+                }
             }
         );
 
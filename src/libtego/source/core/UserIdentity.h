@@ -34,6 +34,7 @@
 #define USERIDENTITY_H
 
 #include "ContactsManager.h"
+#include "utils/TokenBucket.h"
 
 namespace Tor
 {
@@ -47,14 +48,13 @@ namespace Protocol
 
 class QTcpServer;
 
-/* UserIdentity represents the local identity offered by the user.
+/* UserIdentity represents a local identity offered by the user.
  *
  * In particular, it represents the published hidden service, and
- * theoretically holds the list of contacts.
- *
- * At present, implementation (and settings) assumes that there is
- * only one identity, but some code is confusingly written to allow
- * for several.
+ * holds the list of contacts. A context may host several identities,
+ * each with its own service and contacts, published through the same
+ * tor instance; the identity with uniqueID 0 is the one started by
+ * tego_context_start_service.
  */
 class UserIdentity : public QObject
 {
@@ -63,10 +63,17 @@ class UserIdentity : public QObject
 
     friend class IdentityManager;
 public:
+    // the context hosting this identity; its contacts reach it through here
+    tego_context * const context;
     const int uniqueID;
     ContactsManager contacts;
 
-    explicit UserIdentity(int uniqueID, const QString& serviceID, QObject *parent = 0);
+    // Longest time in seconds an incoming connection may take to negotiate a
+    // version and authenticate; connections without a purpose are closed after this anyway
+    static const int MaxIncomingHandshakeTimeout;
+
+    UserIdentity(tego_context *context, int uniqueID, const QString& serviceID, QObject *parent = 0);
+    ~UserIdentity();
 
     /* Properties */
     int getUniqueID() const { return uniqueID; }
@@ -76,6 +83,11 @@ public:
 
     ContactsManager *getContacts() { return &contacts; }
 
+    /* User id of this identity, and of another user as seen by this identity;
+     * the latter is scoped to this identity so that it can be passed back */
+    std::unique_ptr<tego_user_id_t> toTegoUserId() const;
+    std::unique_ptr<tego_user_id_t> toTegoUserId(const QString &hostname) const;
+
     /* State */
     Tor::HiddenService *hiddenService() const { return m_hiddenService; }
 
@@ -83,6 +95,17 @@ public:
      * the connection, and releases the reference held by UserIdentity. */
     QSharedPointer<Protocol::Connection> takeIncomingConnection(Protocol::Connection *connection);
 
+    /* Admission control for incoming connections
+     *
+     * At most maxPending incoming connections may be open without having been
+     * claimed by a contact, and new connections are accepted at a sustained
+     * rate of acceptRate per second with bursts of up to acceptBurst. Sockets
+     * beyond these limits are closed immediately.
+     *
+     * Initially set from the context, which applies changes to every identity.
+     */
+    void setIncomingConnectionLimits(int maxPending, int acceptRate, int acceptBurst);
+
 signals:
     void incomingConnection(Protocol::Connection *connection);
 
@@ -93,8 +116,12 @@ private:
     Tor::HiddenService *m_hiddenService;
     QTcpServer *m_incomingServer;
     QVector<QSharedPointer<Protocol::Connection>> m_incomingConnections;
+    int m_maxPendingIncomingConnections;
+    TokenBucket m_incomingAcceptLimiter;
+
+    bool admitIncomingConnection();
 
-    static UserIdentity *createIdentity(int uniqueID);
+    static UserIdentity *createIdentity(tego_context *context, int uniqueID, QObject *parent);
 
     void handleIncomingAuthedConnection(Protocol::Connection *connection);
     void setupService(const QString& serviceID);
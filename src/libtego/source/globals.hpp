@@ -1,17 +1,18 @@
 #pragma once
 
-#include "context.hpp"
-
 namespace tego
 {
-    // dumping ground for global flags and variables
+    // dumping ground for process-wide flags; all other state
+    // belongs to a tego_context so several can coexist
     struct globals
     {
         globals() = default;
 
+        // guards the one-time initialization below, as contexts
+        // may be created from different threads
+        std::mutex mutex;
         bool opensslAllocatorInited = false;
         bool secureRNGSeeded = false;
-        std::unique_ptr<tego_context> context = nullptr;
 
         static globals instance;
     };
@@ -18,29 +18,31 @@ extern "C"
             logger::println("init");
 
             TEGO_THROW_IF_NULL(out_context);
-            TEGO_THROW_IF_FALSE(tego::g_globals.context.get() == nullptr);
 
-            // initialize OpenSSL's allocator
-            if (!g_globals.opensslAllocatorInited) {
-            #if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
-                CRYPTO_malloc_init();
-            #else
-                OPENSSL_malloc_init();
-            #endif
-
-                g_globals.opensslAllocatorInited = true;
-            }
-
-            // seed our secure RNG
-            if (!g_globals.secureRNGSeeded)
             {
-                TEGO_THROW_IF_FALSE_MSG(SecureRNG::seed(), "Failed to initialize RNG");
-                g_globals.secureRNGSeeded = true;
+                std::lock_guard<std::mutex> lock(g_globals.mutex);
+
+                // initialize OpenSSL's allocator
+                if (!g_globals.opensslAllocatorInited) {
+                #if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
+                    CRYPTO_malloc_init();
+                #else
+                    OPENSSL_malloc_init();
+                #endif
+
+                    g_globals.opensslAllocatorInited = true;
+                }
+
+                // seed our secure RNG
+                if (!g_globals.secureRNGSeeded)
+                {
+                    TEGO_THROW_IF_FALSE_MSG(SecureRNG::seed(), "Failed to initialize RNG");
+                    g_globals.secureRNGSeeded = true;
+                }
             }
 
-            // create and save off singleton context
-            g_globals.context = std::make_unique<tego_context>();
-            *out_context = g_globals.context.get();
+            // each context owns its own tor and identity state
+            *out_context = new tego_context();
 
         }, error);
     }
@@ -51,7 +53,8 @@ extern "C"
         {
             if (context)
             {
-                tego::g_globals.context.reset(nullptr);
+                TEGO_THROW_IF_FALSE(context->threadId == std::this_thread::get_id());
+                delete context;
             }
         }, error);
     }
@@ -45,6 +45,7 @@ extern "C" {
 #ifdef __cplusplus
 
 // standard library
+#include <algorithm>
 #include <array>
 #include <string_view>
 #include <cstdio>
@@ -55,12 +56,15 @@ extern "C" {
 #include <iostream>
 #include <filesystem>
 #include <fstream>
+#include <map>
 #include <set>
 #include <sstream>
 #include <optional>
 #include <tuple>
 #include <type_traits>
 #include <chrono>
+#include <cmath>
+#include <vector>
 
 // fmt
 #include <fmt/format.h>
@@ -77,9 +81,11 @@ extern "C" {
 #include <QClipboard>
 #include <QCoreApplication>
 #include <QDateTime>
+#include <QDir>
 #include <QDebug>
 #include <QElapsedTimer>
 #include <QExplicitlySharedDataPointer>
+#include <QFile>
 #include <QFileInfo>
 #include <QFlags>
 #include <QGuiApplication>
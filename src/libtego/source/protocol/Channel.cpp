@@ -113,6 +113,36 @@ bool Channel::isOpened() const
     return d->isOpened;
 }
 
+bool Channel::isOpenPending() const
+{
+    Q_D(const Channel);
+    return d->direction == Outbound && !d->isOpened && d->identifier >= 0 && !d->isInvalidated;
+}
+
+quint64 Channel::bytesReceived() const
+{
+    Q_D(const Channel);
+    return d->bytesReceived;
+}
+
+quint64 Channel::bytesSent() const
+{
+    Q_D(const Channel);
+    return d->bytesSent;
+}
+
+quint64 Channel::packetsReceived() const
+{
+    Q_D(const Channel);
+    return d->packetsReceived;
+}
+
+quint64 Channel::packetsSent() const
+{
+    Q_D(const Channel);
+    return d->packetsSent;
+}
+
 bool Channel::openChannel()
 {
     Q_D(Channel);
@@ -295,6 +325,10 @@ ChannelPrivate::ChannelPrivate(Channel *q, const QString &c_type, Channel::Direc
     , isOpened(false)
     , hasSentClose(false)
     , isInvalidated(false)
+    , bytesReceived(0)
+    , bytesSent(0)
+    , packetsReceived(0)
+    , packetsSent(0)
 {
 }
 
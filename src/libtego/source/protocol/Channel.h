@@ -89,6 +89,20 @@ public:
     Direction direction() const;
     Connection *connection();
     bool isOpened() const;
+    /* True for an outbound channel whose OpenChannel request has been sent,
+     * but not yet answered
+     *
+     * Packets may be sent on a pending channel; the peer handles the
+     * request before any data that follows it. If the request is rejected,
+     * the channel is invalidated and the peer discards the data.
+     */
+    bool isOpenPending() const;
+
+    /* Traffic on this channel, including packet headers */
+    quint64 bytesReceived() const;
+    quint64 bytesSent() const;
+    quint64 packetsReceived() const;
+    quint64 packetsSent() const;
 
     /* Send the OpenChannel request for this channel
      *
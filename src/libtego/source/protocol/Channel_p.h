@@ -59,6 +59,12 @@ public:
     bool hasSentClose;
     bool isInvalidated;
 
+    // Traffic counters, maintained by ConnectionPrivate
+    quint64 bytesReceived;
+    quint64 bytesSent;
+    quint64 packetsReceived;
+    quint64 packetsSent;
+
     void invalidate();
 
     // Called by ControlChannel to act on valid channel request/result messages
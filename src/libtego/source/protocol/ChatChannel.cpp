@@ -33,19 +33,46 @@
 #include "ChatChannel.h"
 #include "Channel_p.h"
 #include "Connection.h"
+#include "context.hpp"
+#include "utils/StringUtil.h"
 #include "utils/Useful.h"
 
 using namespace Protocol;
 
 ChatChannel::ChatChannel(Direction direction, Connection *connection)
     : Channel(QStringLiteral("im.ricochet.chat"), direction, connection)
+    , nextSequence(1)
+    , peerAcknowledgesCumulatively(false)
+    , peerAcceptsBatches(false)
+    , batchDepth(0)
+    , batchBytes(0)
+    , batchTimer(nullptr)
+    , peerMaxCharacters(MessageMaxCharacters)
+    , cumulativeAcknowledge(false)
+    , receivedSequence(0)
+    , acknowledgedSequence(0)
+    , acknowledgeTimer(nullptr)
+    , maxCharacters(MessageMaxCharacters)
 {
+    if (direction == Outbound)
+        connect(this, &Channel::channelOpened, this, &ChatChannel::sendHeldMessages);
+
+    // Held messages are requeued by the conversation when the channel closes or
+    // is rejected, so a pending batch must not be sent afterwards
+    connect(this, &Channel::invalidated, this,
+        [this]() {
+            heldUntilOpen.clear();
+            if (batchTimer)
+                batchTimer->stop();
+            batch.Clear();
+            batchMessages.clear();
+            batchBytes = 0;
+        }
+    );
 }
 
 bool ChatChannel::allowInboundChannelRequest(const Data::Control::OpenChannel *request, Data::Control::ChannelResult *result)
 {
-    Q_UNUSED(request);
-
     if (connection()->purpose() != Connection::Purpose::KnownContact) {
         qDebug() << "Rejecting request for" << type() << "channel from connection with purpose" << int(connection()->purpose());
         result->set_common_error(Data::Control::ChannelResult::UnauthorizedError);
@@ -57,13 +84,26 @@ bool ChatChannel::allowInboundChannelRequest(const Data::Control::OpenChannel *r
         return false;
     }
 
+    result->SetExtension(Data::Chat::message_batches, true);
+    maxCharacters = maxMessageCharacters();
+    if (maxCharacters > MessageMaxCharacters)
+        result->SetExtension(Data::Chat::max_message_characters, static_cast<quint32>(maxCharacters));
+
+    if (request->GetExtension(Data::Chat::sequenced_messages)) {
+        cumulativeAcknowledge = true;
+        result->SetExtension(Data::Chat::cumulative_acknowledge, true);
+
+        acknowledgeTimer = new QTimer(this);
+        acknowledgeTimer->setSingleShot(true);
+        acknowledgeTimer->setInterval(AcknowledgeDelay);
+        connect(acknowledgeTimer, &QTimer::timeout, this, &ChatChannel::sendCumulativeAcknowledge);
+    }
+
     return true;
 }
 
 bool ChatChannel::allowOutboundChannelRequest(Data::Control::OpenChannel *request)
 {
-    Q_UNUSED(request);
-
     if (connection()->findChannel<ChatChannel>(Channel::Outbound)) {
         TEGO_BUG() << "Rejecting outbound request for" << type() << "channel because one is already open on this connection";
         return false;
@@ -74,9 +114,53 @@ bool ChatChannel::allowOutboundChannelRequest(Data::Control::OpenChannel *reques
         return false;
     }
 
+    request->SetExtension(Data::Chat::sequenced_messages, true);
+    return true;
+}
+
+bool ChatChannel::processChannelOpenResult(const Data::Control::ChannelResult *result)
+{
+    peerAcknowledgesCumulatively = result->GetExtension(Data::Chat::cumulative_acknowledge);
+    peerAcceptsBatches = result->GetExtension(Data::Chat::message_batches);
+    if (result->HasExtension(Data::Chat::max_message_characters)) {
+        const quint32 characters = result->GetExtension(Data::Chat::max_message_characters);
+        peerMaxCharacters = static_cast<int>(qBound<quint32>(MessageMaxCharacters, characters, std::numeric_limits<int>::max()));
+    }
+
+    if (peerAcceptsBatches) {
+        batchTimer = new QTimer(this);
+        batchTimer->setSingleShot(true);
+        connect(batchTimer, &QTimer::timeout, this, &ChatChannel::flushBatch);
+    }
     return true;
 }
 
+int ChatChannel::batchDelay()
+{
+    return connection()->context()->messageBatchDelay;
+}
+
+int ChatChannel::maxMessageCharacters()
+{
+    return qMax(int(MessageMaxCharacters), connection()->context()->maxMessageCharacters);
+}
+
+void ChatChannel::beginBatch()
+{
+    batchDepth++;
+}
+
+void ChatChannel::endBatch()
+{
+    if (batchDepth <= 0) {
+        TEGO_BUG() << "Unbalanced call to ChatChannel::endBatch";
+        return;
+    }
+
+    if (--batchDepth == 0)
+        flushBatch();
+}
+
 void ChatChannel::receivePacket(const QByteArray &packet)
 {
     Data::Chat::Packet message;
@@ -85,8 +169,24 @@ void ChatChannel::receivePacket(const QByteArray &packet)
         return;
     }
 
-    if (message.has_chat_message()) {
-        handleChatMessage(message.chat_message());
+    if (message.has_chat_message() || message.chat_message_batch_size() > 0) {
+        // An acknowledgement attached to a message is for our channel in the other direction
+        if (message.has_chat_acknowledge()) {
+            ChatChannel *outbound = connection()->findChannel<ChatChannel>(Outbound);
+            if (direction() != Inbound) {
+                qWarning() << "Rejected attached acknowledgement on an outbound chat channel";
+                closeChannel();
+                return;
+            } else if (outbound) {
+                outbound->handleChatAcknowledge(message.chat_acknowledge());
+            } else {
+                qDebug() << "Ignoring attached chat acknowledgement without an outbound chat channel";
+            }
+        }
+        if (message.has_chat_message())
+            handleChatMessage(message.chat_message());
+        for (const auto &chatMessage : message.chat_message_batch())
+            handleChatMessage(chatMessage);
     } else if (message.has_chat_acknowledge()) {
         handleChatAcknowledge(message.chat_acknowledge());
     } else {
@@ -96,36 +196,162 @@ void ChatChannel::receivePacket(const QByteArray &packet)
 }
 
 
-bool ChatChannel::sendChatMessageWithId(QString text, QDateTime time, MessageId id)
+bool ChatChannel::sendChatMessageWithId(QByteArray text, QDateTime time, MessageId id)
 {
     if (direction() != Outbound) {
         TEGO_BUG() << "Chat channels are unidirectional, and this is not an outbound channel";
         return false;
     }
 
-    QScopedPointer<Data::Chat::ChatMessage> message(new Data::Chat::ChatMessage);
-    message->set_message_id(id);
-
+    int length = utf16Length(text);
     if (text.isEmpty()) {
         TEGO_BUG() << "Chat message is empty, and it should've been discarded";
         return false;
-    } else if (text.size() > MessageMaxCharacters) {
-        TEGO_BUG() << "Chat message is too long (" << text.size() << "characters), and it should've been limited already. Truncated.";
-        text.truncate(MessageMaxCharacters);
     }
 
-    // Also converts to UTF-8
-    message->set_message_text(text.toStdString());
+    // The peer's limit isn't known until the channel opens, and later messages must stay behind
+    if (!isOpened() && (length > MessageMaxCharacters || !heldUntilOpen.isEmpty())) {
+        heldUntilOpen.append(HeldMessage{text, time, id});
+        return true;
+    }
+
+    if (length > peerMaxCharacters) {
+        qWarning() << "Chat message is too long (" << length << "characters) for the peer, which accepts" << peerMaxCharacters << ". Truncated.";
+        truncateUtf8(text, peerMaxCharacters);
+        // Truncating can't split a surrogate pair, so it may end up shorter than the limit
+        length = utf16Length(text);
+    }
+
+    if (length <= MessageMaxCharacters)
+        return sendMessagePart(text, time, id, 0, 1);
+
+    const QList<QByteArray> parts = splitUtf8(text, MessageMaxCharacters);
+    bool ok = true;
+    beginBatch();
+    for (int i = 0; i < parts.size() && ok; i++)
+        ok = sendMessagePart(parts[i], time, id, static_cast<quint32>(i), static_cast<quint32>(parts.size()));
+    endBatch();
+    return ok;
+}
+
+void ChatChannel::sendHeldMessages()
+{
+    const QList<HeldMessage> held = heldUntilOpen;
+    heldUntilOpen.clear();
+
+    for (const HeldMessage &message : held) {
+        if (!sendChatMessageWithId(message.text, message.time, message.id))
+            emit messageAcknowledged(message.id, false);
+    }
+}
+
+/* Send a message, or one fragment of a long message; fragmentCount is 1 for a whole message */
+bool ChatChannel::sendMessagePart(const QByteArray &text, const QDateTime &time, MessageId id, quint32 fragment, quint32 fragmentCount)
+{
+    QScopedPointer<Data::Chat::ChatMessage> message(new Data::Chat::ChatMessage);
+    message->set_message_id(id);
+    message->set_message_text(text.constData(), static_cast<size_t>(text.size()));
+
+    if (fragmentCount > 1) {
+        message->set_fragment(fragment);
+        message->set_fragment_count(fragmentCount);
+    }
 
     if (!time.isNull())
         message->set_time_delta(qMin(QDateTime::currentDateTime().secsTo(time), qint64(0)));
 
+    const quint64 sequence = nextSequence;
+    message->set_sequence(sequence);
+
+    const int delay = batchDelay();
+    if (peerAcceptsBatches && (batchDepth > 0 || delay > 0)) {
+        // Each message costs a field tag and length prefix in the batch, and room
+        // is left for an attached acknowledgement
+        const int size = int(message->ByteSizeLong()) + 4;
+        if (batchBytes + size > ConnectionPrivate::PacketMaxDataSize - 64)
+            flushBatch();
+
+        batch.mutable_chat_message_batch()->AddAllocated(message.take());
+        batchMessages.append(id);
+        batchBytes += size;
+        nextSequence++;
+        trackPendingMessage(id, sequence);
+
+        if (batchBytes >= BatchMaxBytes)
+            flushBatch();
+        else if (batchDepth == 0 && !batchTimer->isActive())
+            batchTimer->start(delay);
+        return true;
+    }
+
+    // Keep messages in order behind anything still held
+    flushBatch();
+
     Data::Chat::Packet packet;
     packet.set_allocated_chat_message(message.take());
+    if (!sendPacketWithAcknowledge(packet))
+        return false;
+
+    nextSequence++;
+    trackPendingMessage(id, sequence);
+    return true;
+}
+
+void ChatChannel::trackPendingMessage(MessageId id, quint64 sequence)
+{
+    // A message sent again replaces its earlier attempt
+    auto it = pendingMessages.constFind(id);
+    if (it != pendingMessages.constEnd())
+        pendingSequences.remove(*it);
+    pendingMessages.insert(id, sequence);
+    pendingSequences.insert(sequence, id);
+}
+
+void ChatChannel::flushBatch()
+{
+    if (batchTimer)
+        batchTimer->stop();
+    if (batchMessages.isEmpty())
+        return;
+
+    const QList<MessageId> ids = batchMessages;
+    batchMessages.clear();
+    batchBytes = 0;
+
+    const bool sent = sendPacketWithAcknowledge(batch);
+    batch.Clear();
+
+    // As when sending a single message fails, the messages are marked as failed
+    if (!sent) {
+        for (MessageId id : ids) {
+            auto it = pendingMessages.find(id);
+            if (it == pendingMessages.end())
+                continue;
+            pendingSequences.remove(*it);
+            pendingMessages.erase(it);
+            emit messageAcknowledged(id, false);
+        }
+    }
+}
+
+bool ChatChannel::sendPacketWithAcknowledge(Data::Chat::Packet &packet)
+{
+    // Save the peer a packet by acknowledging its messages along with ours
+    ChatChannel *inbound = nullptr;
+    quint64 acknowledge = 0;
+    if (peerAcknowledgesCumulatively) {
+        inbound = connection()->findChannel<ChatChannel>(Inbound);
+        if (inbound)
+            acknowledge = inbound->unacknowledgedSequence();
+        if (acknowledge)
+            packet.mutable_chat_acknowledge()->set_cumulative_sequence(acknowledge);
+    }
+
     if (!Channel::sendMessage(packet))
         return false;
 
-    pendingMessages.insert(id);
+    if (acknowledge)
+        inbound->markAcknowledged(acknowledge);
     return true;
 }
 
@@ -133,9 +359,42 @@ void ChatChannel::handleChatMessage(const Data::Chat::ChatMessage &message)
 {
     QScopedPointer<Data::Chat::ChatAcknowledge> response(new Data::Chat::ChatAcknowledge);
 
-    // QString::fromStdString decodes the string as UTF-8, replacing all invalid sequences and
-    // codepoints with the unicode replacement character.
-    QString text = QString::fromStdString(message.message_text());
+    // Validated once here and kept as UTF-8 from here on. Invalid sequences and codepoints
+    // are replaced with the unicode replacement character.
+    const std::string &messageText = message.message_text();
+    QByteArray text = validUtf8(messageText.data(), messageText.size());
+
+    // Sequences make duplicates on this channel exact to detect. They are already acknowledged,
+    // or will be.
+    const bool sequenced = cumulativeAcknowledge && message.has_sequence();
+    if (sequenced && message.sequence() <= receivedSequence) {
+        qDebug() << "Ignoring duplicate chat message with sequence" << message.sequence();
+        return;
+    }
+
+    // A long message is handled once its last fragment has arrived
+    bool oversize = utf16Length(text) > MessageMaxCharacters;
+    if (direction() == Inbound && message.fragment_count() > 1) {
+        switch (addFragment(message, text)) {
+        case FragmentInvalid:
+            closeChannel();
+            return;
+        case FragmentIncomplete:
+        case FragmentIgnored:
+            if (sequenced)
+                receivedSequence = message.sequence();
+            return;
+        case FragmentRejected:
+            oversize = true;
+            break;
+        case FragmentComplete:
+            oversize = false;
+            break;
+        }
+    } else if (fragments.inProgress) {
+        qWarning() << "Discarding incomplete fragmented chat message" << fragments.id;
+        fragments = Fragments();
+    }
 
     if (direction() != Inbound) {
         qWarning() << "Rejected inbound message on an outbound chat channel";
@@ -143,16 +402,35 @@ void ChatChannel::handleChatMessage(const Data::Chat::ChatMessage &message)
     } else if (text.isEmpty()) {
         qWarning() << "Rejected empty chat message";
         response->set_accepted(false);
-    } else if (text.size() > MessageMaxCharacters) {
-        qWarning() << "Rejected oversize chat message of" << text.size() << "characters";
+    } else if (oversize) {
+        qWarning() << "Rejected oversize chat message";
         response->set_accepted(false);
     } else {
         QDateTime time = QDateTime::currentDateTime();
         if (message.has_time_delta() && message.time_delta() <= 0)
             time = time.addSecs(message.time_delta());
 
+        if (sequenced)
+            receivedSequence = message.sequence();
+
         emit messageReceived(text, time, message.message_id());
         response->set_accepted(true);
+
+        if (sequenced) {
+            if (unacknowledgedSequence() == 0)
+                return;
+            if (receivedSequence - acknowledgedSequence >= quint64(AcknowledgeBatch))
+                sendCumulativeAcknowledge();
+            else if (!acknowledgeTimer->isActive())
+                acknowledgeTimer->start();
+            return;
+        }
+    }
+
+    // Rejections are acknowledged individually and immediately, after anything accepted before them
+    if (sequenced) {
+        sendCumulativeAcknowledge();
+        receivedSequence = acknowledgedSequence = message.sequence();
     }
 
     if (message.has_message_id()) {
@@ -163,6 +441,50 @@ void ChatChannel::handleChatMessage(const Data::Chat::ChatMessage &message)
     }
 }
 
+ChatChannel::FragmentResult ChatChannel::addFragment(const Data::Chat::ChatMessage &message, QByteArray &text)
+{
+    if (message.fragment() == 0) {
+        if (fragments.inProgress)
+            qWarning() << "Discarding incomplete fragmented chat message" << fragments.id;
+        fragments = Fragments();
+        fragments.inProgress = true;
+        fragments.id = message.message_id();
+        fragments.count = message.fragment_count();
+    } else if (!fragments.inProgress || message.message_id() != fragments.id
+               || message.fragment_count() != fragments.count || message.fragment() != fragments.received) {
+        qWarning() << "Received chat message fragment" << message.fragment() << "out of order";
+        return FragmentInvalid;
+    }
+
+    fragments.received++;
+    const bool last = fragments.received == fragments.count;
+
+    // The rest of a rejected message is discarded without another acknowledgement
+    if (fragments.rejected) {
+        if (last)
+            fragments = Fragments();
+        return FragmentIgnored;
+    }
+
+    const int length = utf16Length(text);
+    fragments.length += length;
+    if (length > MessageMaxCharacters || fragments.length > maxCharacters) {
+        fragments.rejected = true;
+        fragments.text.clear();
+        if (last)
+            fragments = Fragments();
+        return FragmentRejected;
+    }
+
+    fragments.text.append(text);
+    if (!last)
+        return FragmentIncomplete;
+
+    text = std::move(fragments.text);
+    fragments = Fragments();
+    return FragmentComplete;
+}
+
 void ChatChannel::handleChatAcknowledge(const Data::Chat::ChatAcknowledge &message)
 {
     if (direction() != Outbound) {
@@ -171,6 +493,22 @@ void ChatChannel::handleChatAcknowledge(const Data::Chat::ChatAcknowledge &messa
         return;
     }
 
+    if (message.has_cumulative_sequence()) {
+        if (!peerAcknowledgesCumulatively || message.cumulative_sequence() >= nextSequence) {
+            qWarning() << "Rejected invalid cumulative chat acknowledgement for sequence" << message.cumulative_sequence();
+            closeChannel();
+            return;
+        }
+
+        // Checked on every pass, in case a handler sends another message
+        while (!pendingSequences.isEmpty() && pendingSequences.firstKey() <= message.cumulative_sequence()) {
+            MessageId id = pendingSequences.take(pendingSequences.firstKey());
+            pendingMessages.remove(id);
+            emit messageAcknowledged(id, true);
+        }
+        return;
+    }
+
     if (!message.has_message_id()) {
         qDebug() << "Chat acknowledgement doesn't have a message ID we understand";
         closeChannel();
@@ -178,10 +516,39 @@ void ChatChannel::handleChatAcknowledge(const Data::Chat::ChatAcknowledge &messa
     }
 
     MessageId id = message.message_id();
-    if (pendingMessages.remove(id)) {
+    auto it = pendingMessages.find(id);
+    if (it != pendingMessages.end()) {
+        pendingSequences.remove(*it);
+        pendingMessages.erase(it);
         emit messageAcknowledged(id, message.accepted());
     } else {
         qDebug() << "Received chat acknowledgement for unknown message" << id;
     }
 }
 
+void ChatChannel::sendCumulativeAcknowledge()
+{
+    quint64 sequence = unacknowledgedSequence();
+    if (sequence == 0)
+        return;
+
+    Data::Chat::Packet packet;
+    packet.mutable_chat_acknowledge()->set_cumulative_sequence(sequence);
+    if (Channel::sendMessage(packet))
+        markAcknowledged(sequence);
+}
+
+quint64 ChatChannel::unacknowledgedSequence() const
+{
+    if (!cumulativeAcknowledge || receivedSequence <= acknowledgedSequence)
+        return 0;
+    return receivedSequence;
+}
+
+void ChatChannel::markAcknowledged(quint64 sequence)
+{
+    acknowledgedSequence = qMax(acknowledgedSequence, sequence);
+    if (acknowledgedSequence >= receivedSequence)
+        acknowledgeTimer->stop();
+}
+
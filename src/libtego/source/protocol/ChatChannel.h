@@ -39,6 +39,26 @@
 namespace Protocol
 {
 
+/* Chat messages in one direction, with acknowledgements in the other
+ *
+ * Outbound messages are numbered with a sequence, and the sender offers
+ * cumulative acknowledgement when opening the channel. A recipient that
+ * agrees acknowledges all accepted messages up to a sequence at once,
+ * after AcknowledgeDelay or AcknowledgeBatch messages, or sooner by
+ * attaching the acknowledgement to a message of its own. Rejections are
+ * always acknowledged individually and immediately. Peers that don't
+ * know about sequences ignore them and acknowledge every message.
+ *
+ * If the recipient accepts batches, outbound messages may be held briefly
+ * and sent several to a packet: for up to batchDelay() milliseconds, or
+ * between beginBatch() and endBatch(), or until BatchMaxBytes are waiting.
+ *
+ * A recipient may also advertise a limit above MessageMaxCharacters. Longer
+ * messages are then sent as consecutive fragments sharing one identifier,
+ * reassembled by the recipient and acknowledged once, as a single message.
+ * Until the channel is open and the limit is known, long messages and any
+ * sent after them are held.
+ */
 class ChatChannel : public Channel
 {
     Q_OBJECT
@@ -46,26 +66,124 @@ class ChatChannel : public Channel
 
 public:
     typedef quint32 MessageId;
+    // Limit on message length in UTF-16 code units, as peers have always counted it
     static const int MessageMaxCharacters = 2000;
+    // Longest time an accepted message waits for a cumulative acknowledgement, in milliseconds
+    static const int AcknowledgeDelay = 200;
+    // Number of accepted messages that are acknowledged without waiting
+    static const int AcknowledgeBatch = 16;
+    // Encoded size of held messages at which a batch is sent without waiting
+    static const int BatchMaxBytes = 16384;
+    // Default limit on the length of fragmented messages accepted from peers
+    static const int DefaultMaxMessageCharacters = 65536;
 
     explicit ChatChannel(Direction direction, Connection *connection);
 
-    bool sendChatMessageWithId(QString text, QDateTime time, MessageId id);
+    // text must be well-formed UTF-8
+    bool sendChatMessageWithId(QByteArray text, QDateTime time, MessageId id);
+
+    /* Hold messages sent until the matching endBatch, and send them together
+     *
+     * Calls may be nested; messages are sent by the outermost endBatch. Has
+     * no effect if the peer doesn't accept batches.
+     */
+    void beginBatch();
+    void endBatch();
+
+    /* Time in milliseconds that outbound messages may be held to batch them
+     * with later messages, as configured on the connection's context
+     *
+     * The default of 0 sends messages immediately, outside of beginBatch.
+     */
+    int batchDelay();
+
+    /* Longest message, in UTF-16 code units, accepted from peers, as configured
+     * on the connection's context when the channel is opened
+     *
+     * Messages longer than MessageMaxCharacters are received in fragments.
+     * A limit of MessageMaxCharacters disables fragmented messages.
+     */
+    int maxMessageCharacters();
 
 signals:
     void messageAcknowledged(MessageId id, bool accepted);
-    void messageReceived(const QString &text, const QDateTime &time, MessageId id);
+    // text is well-formed UTF-8
+    void messageReceived(const QByteArray &text, const QDateTime &time, MessageId id);
 
 protected:
     virtual bool allowInboundChannelRequest(const Data::Control::OpenChannel *request, Data::Control::ChannelResult *result);
     virtual bool allowOutboundChannelRequest(Data::Control::OpenChannel *request);
+    virtual bool processChannelOpenResult(const Data::Control::ChannelResult *result);
     virtual void receivePacket(const QByteArray &packet);
 
 private:
-    QSet<MessageId> pendingMessages;
+    // Outbound: unacknowledged messages by identifier, and identifiers by sequence
+    QHash<MessageId,quint64> pendingMessages;
+    QMap<quint64,MessageId> pendingSequences;
+    quint64 nextSequence;
+    bool peerAcknowledgesCumulatively;
+
+    // Outbound: messages held for the next batch
+    bool peerAcceptsBatches;
+    int batchDepth;
+    Data::Chat::Packet batch;
+    QList<MessageId> batchMessages;
+    int batchBytes;
+    QTimer *batchTimer;
+
+    // Outbound: longest message the peer accepts, and messages held until the channel is open
+    struct HeldMessage
+    {
+        QByteArray text;
+        QDateTime time;
+        MessageId id;
+    };
+    int peerMaxCharacters;
+    QList<HeldMessage> heldUntilOpen;
+
+    // Inbound: highest sequence received, and how much of it is still unacknowledged
+    bool cumulativeAcknowledge;
+    quint64 receivedSequence;
+    quint64 acknowledgedSequence;
+    QTimer *acknowledgeTimer;
+
+    // Inbound: fragmented message being reassembled
+    struct Fragments
+    {
+        bool inProgress = false;
+        bool rejected = false;
+        MessageId id = 0;
+        quint32 count = 0;
+        quint32 received = 0;
+        int length = 0;
+        QByteArray text;
+    };
+    Fragments fragments;
+    // Inbound: longest message accepted, fixed when the channel is opened
+    int maxCharacters;
+
+    enum FragmentResult
+    {
+        FragmentIncomplete,
+        FragmentComplete,
+        FragmentRejected,
+        FragmentIgnored,
+        FragmentInvalid
+    };
 
+    bool sendMessagePart(const QByteArray &text, const QDateTime &time, MessageId id, quint32 fragment, quint32 fragmentCount);
+    void sendHeldMessages();
     void handleChatMessage(const Data::Chat::ChatMessage &message);
+    FragmentResult addFragment(const Data::Chat::ChatMessage &message, QByteArray &text);
     void handleChatAcknowledge(const Data::Chat::ChatAcknowledge &message);
+    void trackPendingMessage(MessageId id, quint64 sequence);
+    void flushBatch();
+    // Send a packet, attaching any acknowledgement waiting on the inbound chat channel
+    bool sendPacketWithAcknowledge(Data::Chat::Packet &packet);
+    void sendCumulativeAcknowledge();
+    // Sequence to acknowledge cumulatively, or 0 if nothing is waiting for acknowledgement
+    quint64 unacknowledgedSequence() const;
+    void markAcknowledged(quint64 sequence);
 };
 
 }
@@ -31,30 +31,55 @@
  */
 
 #include "Connection_p.h"
+#include "Channel_p.h"
 #include "ControlChannel.h"
+#include "context.hpp"
 #include "utils/Useful.h"
 
 using namespace Protocol;
 
-Connection::Connection(QTcpSocket *socket, Direction direction)
+Connection::Connection(QTcpSocket *socket, Direction direction, tego_context *context)
     : QObject()
-    , d(new ConnectionPrivate(this))
+    , d(new ConnectionPrivate(this, context))
 {
     d->setSocket(socket, direction);
 }
 
-ConnectionPrivate::ConnectionPrivate(Connection *qq)
+ConnectionPrivate::ConnectionPrivate(Connection *qq, tego_context *c)
     : QObject(qq)
     , q(qq)
+    , context(c)
     , socket(0)
     , direction(Connection::ClientSide)
     , purpose(Connection::Purpose::Unknown)
     , wasClosed(false)
     , handshakeDone(false)
+    , keepAliveTimer(new QTimer(this))
+    , keepAliveTimeout(new QTimer(this))
+    , missedKeepAlives(0)
+    , roundTripTime(-1)
+    , peerSupportsHibernate(false)
+    , unknownChannelReplyLimiter(UnknownChannelReplyRate, UnknownChannelReplyBurst)
+    , protocolErrorLimiter(ProtocolErrorRate, ProtocolErrorBurst)
+    , unknownChannelAbuseLimiter(UnknownChannelAbuseRate, UnknownChannelAbuseBurst)
     , nextOutboundChannelId(-1)
 {
     ageTimer.start();
 
+    keepAliveTimeout->setSingleShot(true);
+    connect(keepAliveTimer, &QTimer::timeout, this, &ConnectionPrivate::sendKeepAlive);
+    connect(keepAliveTimeout, &QTimer::timeout, this, &ConnectionPrivate::keepAliveTimedOut);
+    connect(q, &Connection::ready, this,
+        [this]() {
+            // Sent even with keepalives disabled, so the peer learns which
+            // extensions we support
+            sendKeepAlive();
+            const int interval = q->keepAliveInterval();
+            if (interval > 0)
+                keepAliveTimer->start(interval * 1000);
+        }
+    );
+
     QTimer *timeout = new QTimer(this);
     timeout->setSingleShot(true);
     timeout->setInterval(UnknownPurposeTimeout * 1000);
@@ -98,6 +123,11 @@ ConnectionPrivate::~ConnectionPrivate()
     q = 0;
 }
 
+tego_context *Connection::context() const
+{
+    return d->context;
+}
+
 Connection::Direction Connection::direction() const
 {
     return d->direction;
@@ -139,6 +169,50 @@ int Connection::age() const
     return qRound(static_cast<double>(d->ageTimer.elapsed()) / 1000.0);
 }
 
+int Connection::roundTripTime() const
+{
+    return d->roundTripTime;
+}
+
+int Connection::missedKeepAlives() const
+{
+    return d->missedKeepAlives;
+}
+
+Connection::Statistics Connection::statistics() const
+{
+    Statistics re = d->stats;
+    re.writeBufferSize = d->socket ? d->socket->bytesToWrite() : 0;
+    re.age = age();
+    re.roundTripTime = d->roundTripTime;
+    re.missedKeepAlives = d->missedKeepAlives;
+    return re;
+}
+
+int Connection::keepAliveInterval() const
+{
+    return qMax(0, d->context->keepAliveInterval);
+}
+
+bool Connection::peerSupportsHibernate() const
+{
+    return d->peerSupportsHibernate;
+}
+
+void Connection::hibernate()
+{
+    if (!isConnected())
+        return;
+
+    if (!d->peerSupportsHibernate) {
+        TEGO_BUG() << "Hibernating connection" << this << "to a peer which doesn't support it";
+    } else if (ControlChannel *control = qobject_cast<ControlChannel*>(channel(0))) {
+        control->sendHibernate();
+    }
+
+    close();
+}
+
 void ConnectionPrivate::setSocket(QTcpSocket *s, Connection::Direction d)
 {
     if (socket) {
@@ -157,9 +231,11 @@ void ConnectionPrivate::setSocket(QTcpSocket *s, Connection::Direction d)
         TEGO_BUG() << "Connection created with socket in a non-connected state" << socket->state();
     }
 
-    Channel *control = new ControlChannel(direction == Connection::ClientSide ? Channel::Outbound : Channel::Inbound, q);
+    ControlChannel *control = new ControlChannel(direction == Connection::ClientSide ? Channel::Outbound : Channel::Inbound, q);
     // Closing the control channel must also close the connection
     connect(control, &Channel::invalidated, q, &Connection::close);
+    connect(control, &ControlChannel::keepAliveResponse, this, &ConnectionPrivate::keepAliveResponse);
+    connect(control, &ControlChannel::hibernateRequested, q, &Connection::peerHibernating);
     insertChannel(control);
 
     if (!control->isOpened() || control->identifier() != 0 || q->channel(0) != control) {
@@ -222,9 +298,75 @@ void ConnectionPrivate::closeImmediately()
     }
 }
 
+void ConnectionPrivate::sendKeepAlive()
+{
+    if (!q->isConnected()) {
+        keepAliveTimer->stop();
+        keepAliveTimeout->stop();
+        return;
+    }
+
+    // A probe is still outstanding; its response timeout decides what happens
+    if (keepAliveTimeout->isActive())
+        return;
+
+    ControlChannel *control = qobject_cast<ControlChannel*>(q->channel(0));
+    if (!control) {
+        TEGO_BUG() << "Connection has no control channel for keepalive";
+        return;
+    }
+
+    // Only the time of the most recent probe is kept; a late response to an
+    // earlier probe will measure a shorter time than it really took, which is
+    // acceptable for detecting liveness.
+    keepAliveSent.start();
+    control->keepAlive();
+
+    // With keepalives disabled, the probe sent when the connection becomes
+    // ready isn't expected to be answered in time
+    if (q->keepAliveInterval() > 0) {
+        const int timeout = qMax(KeepAliveResponseTimeout * 1000, roundTripTime * KeepAliveResponseRttMultiple);
+        keepAliveTimeout->start(timeout);
+    }
+}
+
+void ConnectionPrivate::keepAliveTimedOut()
+{
+    if (!q->isConnected() || !keepAliveSent.isValid())
+        return;
+
+    missedKeepAlives++;
+    if (missedKeepAlives >= KeepAliveMaxMissed) {
+        qDebug() << "Closing connection" << q << "after" << missedKeepAlives << "unanswered keepalives";
+        keepAliveTimer->stop();
+        q->close();
+        return;
+    }
+
+    // Probe again right away rather than waiting for the next interval, so an
+    // unreachable peer is noticed within a few response timeouts
+    sendKeepAlive();
+}
+
+void ConnectionPrivate::keepAliveResponse()
+{
+    if (!keepAliveSent.isValid()) {
+        qDebug() << "Ignoring unsolicited keepalive response on connection" << q;
+        return;
+    }
+
+    roundTripTime = static_cast<int>(keepAliveSent.elapsed());
+    keepAliveSent.invalidate();
+    keepAliveTimeout->stop();
+    missedKeepAlives = 0;
+    emit q->roundTripTimeChanged(roundTripTime);
+}
+
 void ConnectionPrivate::socketDisconnected()
 {
     qDebug() << "Connection" << this << "disconnected";
+    keepAliveTimer->stop();
+    keepAliveTimeout->stop();
     // emit close signal first so FileChannel can bubble up errors
     if (!wasClosed) {
         wasClosed = true;
@@ -378,15 +520,27 @@ void ConnectionPrivate::socketReadable()
             return;
         }
 
+        stats.bytesReceived += static_cast<quint64>(packetSize);
+        stats.packetsReceived++;
+
         Channel *channel = q->channel(channelId);
         if (!channel) {
-            // XXX We should sanity-check and rate limit these responses better
+            // Both cases happen legitimately when a channel is closed by both sides
+            // at once, or data was written behind an OpenChannel that was rejected.
+            // Only a sustained stream for channels that were never there is abuse.
+            if (!wasRecentlyClosed(channelId) && !unknownChannelAbuseLimiter.take()) {
+                qWarning() << "Too many packets for non-existent channels; disconnecting";
+                socket->abort();
+                return;
+            }
+
             if (data.isEmpty()) {
                 qDebug() << "Ignoring channel close message for non-existent channel" << channelId;
             } else {
                 qDebug() << "Ignoring" << data.size() << "byte packet for non-existent channel" << channelId;
-                // Send channel close message
-                writePacket(channelId, QByteArray());
+                // Send channel close message, unless too many have been sent recently
+                if (unknownChannelReplyLimiter.take())
+                    writePacket(channelId, QByteArray());
             }
             continue;
         }
@@ -400,6 +554,10 @@ void ConnectionPrivate::socketReadable()
             return;
         }
 
+        stats.packetsReceivedByType[channel->type()]++;
+        channel->d_ptr->bytesReceived += static_cast<quint64>(packetSize);
+        channel->d_ptr->packetsReceived++;
+
         if (data.isEmpty()) {
             channel->closeChannel();
         } else {
@@ -418,7 +576,13 @@ bool ConnectionPrivate::writePacket(Channel *channel, const QByteArray &data)
         return false;
     }
 
-    return writePacket(channel->identifier(), data);
+    if (!writePacket(channel->identifier(), data))
+        return false;
+
+    stats.packetsSentByType[channel->type()]++;
+    channel->d_ptr->bytesSent += static_cast<quint64>(PacketHeaderSize + data.size());
+    channel->d_ptr->packetsSent++;
+    return true;
 }
 
 bool ConnectionPrivate::writePacket(int channelId, const QByteArray &data)
@@ -458,9 +622,37 @@ bool ConnectionPrivate::writePacket(int channelId, const QByteArray &data)
         return false;
     }
 
+    stats.bytesSent += static_cast<quint64>(PacketHeaderSize + data.size());
+    stats.packetsSent++;
     return true;
 }
 
+bool ConnectionPrivate::reportProtocolError()
+{
+    return protocolErrorLimiter.take();
+}
+
+void ConnectionPrivate::channelIdClosed(int channelId)
+{
+    const qint64 now = ageTimer.elapsed();
+    // Pruned as it grows, so a peer cycling through channels can't make this large
+    if (recentlyClosedChannels.size() >= 64) {
+        for (auto it = recentlyClosedChannels.begin(); it != recentlyClosedChannels.end(); ) {
+            if (now - it.value() >= RecentlyClosedTimeout * 1000)
+                it = recentlyClosedChannels.erase(it);
+            else
+                ++it;
+        }
+    }
+    recentlyClosedChannels.insert(channelId, now);
+}
+
+bool ConnectionPrivate::wasRecentlyClosed(int channelId)
+{
+    auto it = recentlyClosedChannels.constFind(channelId);
+    return it != recentlyClosedChannels.constEnd() && ageTimer.elapsed() - it.value() < RecentlyClosedTimeout * 1000;
+}
+
 int ConnectionPrivate::availableOutboundChannelId()
 {
     // Server opens even-nubmered channels, client opens odd-numbered
@@ -541,6 +733,8 @@ bool ConnectionPrivate::insertChannel(Channel *channel)
     }
 
     channels.insert(channel->identifier(), channel);
+    recentlyClosedChannels.remove(channel->identifier());
+    stats.channelsOpened++;
     return true;
 }
 
@@ -554,10 +748,13 @@ void ConnectionPrivate::removeChannel(Channel *channel)
     // Out of caution, find the channel by pointer instead of identifier. This will make sure
     // it's always removed from the list, even if the identifier was somehow reset or lost.
     for (auto it = channels.begin(); it != channels.end(); ) {
-        if (*it == channel)
+        if (*it == channel) {
+            channelIdClosed(it.key());
             it = channels.erase(it);
-        else
+            stats.channelsClosed++;
+        } else {
             it++;
+        }
     }
 }
 
@@ -91,9 +91,12 @@ public:
      * becomes invalid (but is not automatically deleted) once
      * the socket has disconnected.
      */
-    explicit Connection(QTcpSocket *socket, Direction direction);
+    Connection(QTcpSocket *socket, Direction direction, tego_context *context);
     virtual ~Connection();
 
+    // The context this connection belongs to, which holds its settings
+    tego_context *context() const;
+
     Direction direction() const;
     bool isConnected() const;
 
@@ -118,6 +121,59 @@ public:
     /* Age of the connection in seconds */
     int age() const;
 
+    /* Round trip time of the most recent keepalive in milliseconds
+     *
+     * Keepalives are sent periodically once the connection is ready. Each
+     * must be answered within a response timeout, after which another is
+     * sent right away. If too many consecutive keepalives go unanswered, the
+     * peer is assumed to be unreachable and the connection is closed.
+     *
+     * Returns -1 if no keepalive response has been received yet.
+     */
+    int roundTripTime() const;
+    /* Number of consecutive keepalives which have not been answered */
+    int missedKeepAlives() const;
+
+    /* Interval in seconds between keepalives, as configured on the context
+     *
+     * Takes effect for connections which become ready after it is set.
+     * An interval of 0 disables periodic keepalives; one is still sent
+     * when the connection becomes ready.
+     */
+    int keepAliveInterval() const;
+
+    /* Whether the peer understands hibernate notices
+     *
+     * Learned from the peer's keepalives, so this is false until the first
+     * keepalive or response from the peer has arrived.
+     */
+    bool peerSupportsHibernate() const;
+
+    /* Traffic counters for the lifetime of the connection
+     *
+     * Byte counts include packet headers, but not the version negotiation
+     * handshake. Packet counts per channel type are keyed by the channel's
+     * type string (e.g. "im.ricochet.chat").
+     */
+    struct Statistics
+    {
+        quint64 bytesReceived = 0;
+        quint64 bytesSent = 0;
+        quint64 packetsReceived = 0;
+        quint64 packetsSent = 0;
+        QHash<QString,quint64> packetsReceivedByType;
+        QHash<QString,quint64> packetsSentByType;
+        // Bytes written to the socket but not yet sent
+        qint64 writeBufferSize = 0;
+        int channelsOpened = 0;
+        int channelsClosed = 0;
+        int age = 0;
+        int roundTripTime = -1;
+        int missedKeepAlives = 0;
+    };
+
+    Statistics statistics() const;
+
     /* Assigned purpose of this connection
      *
      * A purpose is assigned to the connection after the peer has
@@ -165,6 +221,12 @@ public slots:
      * The closed signal is emitted when the socket and all channels have closed.
      */
     void close();
+    /* Close this connection after telling the peer it's only idle
+     *
+     * A peer that supports hibernate treats the contact as still reachable
+     * and doesn't reconnect until it needs to; see peerSupportsHibernate.
+     */
+    void hibernate();
 
 signals:
     /* Emitted when the socket is closed. All channels will be closed
@@ -214,6 +276,15 @@ signals:
      * opened. At this point, the channel can be used or closed normally.
      */
     void channelOpened(Channel *channel);
+    /* Emitted when a keepalive response is received, with the measured
+     * round trip time in milliseconds.
+     */
+    void roundTripTimeChanged(int msecs);
+    /* Emitted when the peer is about to close this connection for being idle
+     *
+     * The closed signal follows once the peer has closed the socket.
+     */
+    void peerHibernating();
 
 private:
     ConnectionPrivate *d;
@@ -34,6 +34,7 @@
 #define PROTOCOL_CONNECTION_P_H
 
 #include "Connection.h"
+#include "utils/TokenBucket.h"
 
 namespace Protocol
 {
@@ -50,11 +51,30 @@ public:
     static const int PacketMaxDataSize = UINT16_MAX - PacketHeaderSize;
     // Time in seconds before a connection with a purpose of Unknown is killed
     static const int UnknownPurposeTimeout = 15;
-
-    explicit ConnectionPrivate(Connection *q);
+    // Maximum number of consecutive unanswered keepalives before the connection is killed
+    static const int KeepAliveMaxMissed = 3;
+    // Time in seconds to wait for a keepalive response before it counts as
+    // missed, or this multiple of the round trip time if that is longer
+    static const int KeepAliveResponseTimeout = 30;
+    static const int KeepAliveResponseRttMultiple = 4;
+    // Rate and burst of close replies to packets on channels which don't exist
+    static const int UnknownChannelReplyRate = 2;
+    static const int UnknownChannelReplyBurst = 10;
+    // Rate and burst of tolerated protocol errors, such as rejected channel requests
+    static const int ProtocolErrorRate = 1;
+    static const int ProtocolErrorBurst = 20;
+    // Rate and burst of packets for channels which don't exist and weren't
+    // recently closed, beyond which the peer is abusive and the connection is killed
+    static const int UnknownChannelAbuseRate = 10;
+    static const int UnknownChannelAbuseBurst = 500;
+    // Time in seconds that packets for a closed or rejected channel are expected
+    static const int RecentlyClosedTimeout = 60;
+
+    ConnectionPrivate(Connection *q, tego_context *context);
     virtual ~ConnectionPrivate();
 
     Connection *q;
+    tego_context *context;
     QTcpSocket *socket;
     QHash<int,Channel*> channels;
     QMap<Connection::AuthenticationType,QString> authentication;
@@ -64,6 +84,21 @@ public:
     bool wasClosed;
     bool handshakeDone;
 
+    QTimer *keepAliveTimer;
+    QTimer *keepAliveTimeout;
+    QElapsedTimer keepAliveSent;
+    int missedKeepAlives;
+    int roundTripTime;
+    // Set once the peer has sent a keepalive with hibernate_supported
+    bool peerSupportsHibernate;
+    Connection::Statistics stats;
+    TokenBucket unknownChannelReplyLimiter;
+    TokenBucket protocolErrorLimiter;
+    TokenBucket unknownChannelAbuseLimiter;
+    // Identifiers of channels closed or rejected recently, and the age of the
+    // connection in milliseconds when that happened
+    QHash<int,qint64> recentlyClosedChannels;
+
     void setSocket(QTcpSocket *socket, Connection::Direction direction);
 
     int availableOutboundChannelId();
@@ -77,8 +112,26 @@ public:
     bool writePacket(Channel *channel, const QByteArray &data);
     bool writePacket(int channelId, const QByteArray &data);
 
+    /* Record a recoverable protocol error by the peer
+     *
+     * Returns false if the peer has exceeded the allowed rate of errors, in
+     * which case the caller must stop processing and close the connection.
+     */
+    bool reportProtocolError();
+
+    /* Remember that a channel identifier was closed or rejected
+     *
+     * Packets the peer wrote before learning of it are still in flight, and
+     * aren't counted against the peer; see wasRecentlyClosed.
+     */
+    void channelIdClosed(int channelId);
+    bool wasRecentlyClosed(int channelId);
+
 public slots:
     void closeImmediately();
+    void sendKeepAlive();
+    void keepAliveTimedOut();
+    void keepAliveResponse();
 
 private slots:
     void socketReadable();
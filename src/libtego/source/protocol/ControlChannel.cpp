@@ -97,12 +97,25 @@ void ControlChannel::keepAlive()
 {
     Data::Control::KeepAlive *request = new Data::Control::KeepAlive;
     request->set_response_requested(true);
+    request->SetExtension(Data::Control::hibernate_supported, true);
 
     Data::Control::Packet packet;
     packet.set_allocated_keep_alive(request);
     sendMessage(packet);
 }
 
+void ControlChannel::sendHibernate()
+{
+    Data::Control::KeepAlive *notice = new Data::Control::KeepAlive;
+    notice->set_response_requested(false);
+    notice->SetExtension(Data::Control::hibernate_supported, true);
+    notice->SetExtension(Data::Control::hibernate, true);
+
+    Data::Control::Packet packet;
+    packet.set_allocated_keep_alive(notice);
+    sendMessage(packet);
+}
+
 bool ControlChannel::allowInboundChannelRequest(const Data::Control::OpenChannel *request, Data::Control::ChannelResult *result)
 {
     Q_UNUSED(request);
@@ -206,14 +219,20 @@ void ControlChannel::handleOpenChannel(const Data::Control::OpenChannel &message
         // Clean up channel instance
         delete channel;
         channel = 0;
+        // The peer may already have written packets for it
+        connection()->d->channelIdClosed(id);
     }
 
     Data::Control::Packet responseMessage;
     responseMessage.set_allocated_channel_result(response);
     sendMessage(responseMessage);
 
-    if (response->opened())
+    if (response->opened()) {
         emit connection()->channelOpened(channel);
+    } else if (!connection()->d->reportProtocolError()) {
+        qWarning() << "Too many rejected OpenChannel requests from peer; connection will be killed";
+        closeChannel();
+    }
 }
 
 void ControlChannel::handleChannelResult(const Data::Control::ChannelResult &message)
@@ -221,12 +240,19 @@ void ControlChannel::handleChannelResult(const Data::Control::ChannelResult &mes
     int id = message.channel_identifier();
     Channel *channel = connection()->channel(id);
     if (!channel) {
+        // Expected if we closed the channel before the peer's result arrived
+        if (connection()->d->wasRecentlyClosed(id))
+            return;
         qWarning() << "Received ChannelResult for unknown identifier, ignoring:" << QString::fromStdString(message.DebugString());
+        if (!connection()->d->reportProtocolError())
+            closeChannel();
         return;
     }
 
     if (channel->direction() != Outbound || channel->isOpened()) {
         qWarning() << "Received (duplicate?) ChannelResult for existing channel in an unexpected state:" << QString::fromStdString(message.DebugString());
+        if (!connection()->d->reportProtocolError())
+            closeChannel();
         return;
     }
 
@@ -254,9 +280,18 @@ void ControlChannel::handleChannelResult(const Data::Control::ChannelResult &mes
 
 void ControlChannel::handleKeepAlive(const Data::Control::KeepAlive &message)
 {
+    if (message.GetExtension(Data::Control::hibernate_supported))
+        connection()->d->peerSupportsHibernate = true;
+
+    if (message.GetExtension(Data::Control::hibernate)) {
+        emit hibernateRequested();
+        return;
+    }
+
     if (message.response_requested()) {
         Data::Control::KeepAlive *pong = new Data::Control::KeepAlive;
         pong->set_response_requested(false);
+        pong->SetExtension(Data::Control::hibernate_supported, true);
         Data::Control::Packet response;
         response.set_allocated_keep_alive(pong);
         sendMessage(response);
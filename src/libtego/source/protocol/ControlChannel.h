@@ -49,9 +49,12 @@ class ControlChannel : public Channel
 public:
     bool sendOpenChannel(Channel *channel);
     void keepAlive();
+    // Tell the peer this connection is about to be closed for being idle
+    void sendHibernate();
 
 signals:
     void keepAliveResponse();
+    void hibernateRequested();
 
 protected:
     explicit ControlChannel(Direction direction, Connection *connection);
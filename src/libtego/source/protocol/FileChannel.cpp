@@ -38,9 +38,7 @@
 
 #include "context.hpp"
 #include "error.hpp"
-#include "globals.hpp"
 #include "file_hash.hpp"
-using tego::g_globals;
 
 using namespace Protocol;
 
@@ -53,6 +53,7 @@ public:
     void acceptFile(tego_file_transfer_id_t id, const std::string& dest);
     void rejectFile(tego_file_transfer_id_t id);
     bool cancelTransfer(tego_file_transfer_id_t id);
+    bool hasActiveTransfers() const { return !outgoingTransfers.empty() || !incomingTransfers.empty(); }
     // signals bubble up to the ConversationModel object that owns this FileChannel
 signals:
     void fileTransferRequestReceived(tego_file_transfer_id_t id, QString fileName, tego_file_size_t fileSize, tego_file_hash_t);
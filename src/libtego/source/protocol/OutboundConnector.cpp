@@ -36,6 +36,8 @@
 #include "ControlChannel.h"
 #include "AuthHiddenServiceChannel.h"
 
+#include "context.hpp"
+
 using namespace Protocol;
 
 namespace Protocol
@@ -47,6 +49,7 @@ class OutboundConnectorPrivate : public QObject
 
 public:
     OutboundConnector *q;
+    tego_context *context;
     Tor::TorSocket *socket;
     QSharedPointer<Connection> connection;
     QString hostname;
@@ -56,18 +59,26 @@ public:
     QString errorMessage;
     QTimer errorRetryTimer;
     int errorRetryCount;
+    int errorRetryInterval;
+    Tor::ConnectScheduler::Priority connectPriority;
 
-    OutboundConnectorPrivate(OutboundConnector *oc)
+    OutboundConnectorPrivate(OutboundConnector *oc, tego_context *c)
         : QObject(oc)
         , q(oc)
+        , context(c)
         , socket(0)
         , port(0)
         , status(OutboundConnector::Inactive)
         , errorRetryCount(0)
+        , errorRetryInterval(0)
+        , connectPriority(Tor::ConnectScheduler::NormalPriority)
     {
         connect(&errorRetryTimer, &QTimer::timeout, this, &OutboundConnectorPrivate::retryAfterError);
     }
 
+    static const int ErrorRetryMinSeconds = 30;
+    static const int ErrorRetryMaxSeconds = 300;
+
     void setStatus(OutboundConnector::Status status);
     void setError(const QString &errorMessage);
 
@@ -80,8 +91,8 @@ public slots:
 
 }
 
-OutboundConnector::OutboundConnector(QObject *parent)
-    : QObject(parent), d(new OutboundConnectorPrivate(this))
+OutboundConnector::OutboundConnector(tego_context *context, QObject *parent)
+    : QObject(parent), d(new OutboundConnectorPrivate(this, context))
 {
 }
 
@@ -99,6 +110,13 @@ void OutboundConnector::setAuthPrivateKey(const CryptoKey &key)
     d->authPrivateKey = key;
 }
 
+void OutboundConnector::setConnectPriority(Tor::ConnectScheduler::Priority priority)
+{
+    d->connectPriority = priority;
+    if (d->socket)
+        d->socket->setConnectPriority(priority);
+}
+
 bool OutboundConnector::connectToHost(const QString &hostname, quint16 port)
 {
     if (port <= 0 || hostname.isEmpty()) {
@@ -129,8 +147,9 @@ bool OutboundConnector::connectToHost(const QString &hostname, quint16 port)
     d->hostname = hostname;
     d->port = port;
 
-    d->socket = new Tor::TorSocket(this);
+    d->socket = new Tor::TorSocket(d->context->torControl, d->context->connectScheduler, this);
     connect(d->socket, &Tor::TorSocket::connected, d, &OutboundConnectorPrivate::onConnected);
+    d->socket->setConnectPriority(d->connectPriority);
     d->setStatus(Connecting);
     d->socket->connectToHost(d->hostname, d->port);
     return true;
@@ -142,6 +161,7 @@ void OutboundConnector::abort()
     d->hostname.clear();
     d->port = 0;
     d->errorRetryCount = 0;
+    d->errorRetryInterval = 0;
     d->errorRetryTimer.stop();
     d->errorMessage.clear();
     d->setStatus(Inactive);
@@ -216,9 +236,11 @@ void OutboundConnectorPrivate::setError(const QString &message)
         return;
     }
 
+    // Jittered, so that peers failing together don't all retry together
+    errorRetryInterval = Tor::ConnectScheduler::backoffDelay(ErrorRetryMinSeconds, ErrorRetryMaxSeconds, errorRetryInterval);
     errorRetryTimer.setSingleShot(true);
-    errorRetryTimer.start(60 * 1000);
-    qDebug() << "Retrying outbound connection attempt in 60 seconds after an error";
+    errorRetryTimer.start(errorRetryInterval * 1000);
+    qDebug() << "Retrying outbound connection attempt in" << errorRetryInterval << "seconds after an error";
 }
 
 void OutboundConnectorPrivate::retryAfterError()
@@ -234,6 +256,12 @@ void OutboundConnectorPrivate::retryAfterError()
         return;
     }
 
+    auto scheduler = context->connectScheduler;
+    if (scheduler && !scheduler->takeRetryToken()) {
+        errorRetryTimer.start(Tor::ConnectScheduler::backoffDelay(1, ErrorRetryMinSeconds, 0) * 1000);
+        return;
+    }
+
     q->connectToHost(hostname, port);
 }
 
@@ -245,7 +273,7 @@ void OutboundConnectorPrivate::onConnected()
         return;
     }
 
-    connection = QSharedPointer<Connection>(new Connection(socket, Connection::ClientSide), &QObject::deleteLater);
+    connection = QSharedPointer<Connection>(new Connection(socket, Connection::ClientSide, context), &QObject::deleteLater);
 
     // Socket is now owned by connection
     Q_ASSERT(socket->parent() == connection);
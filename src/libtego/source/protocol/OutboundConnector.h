@@ -34,6 +34,7 @@
 #define PROTOCOL_OUTBOUNDCONNECTOR_H
 
 #include "Connection.h"
+#include "tor/ConnectScheduler.h"
 #include "utils/CryptoKey.h"
 
 namespace Protocol
@@ -62,7 +63,7 @@ public:
         Error
     };
 
-    explicit OutboundConnector(QObject *parent);
+    OutboundConnector(tego_context *context, QObject *parent);
     virtual ~OutboundConnector();
 
     Status status() const;
@@ -71,6 +72,8 @@ public:
 
     bool connectToHost(const QString &hostname, quint16 port);
     void setAuthPrivateKey(const CryptoKey &key);
+    // Priority of connection attempts among all outbound connections
+    void setConnectPriority(Tor::ConnectScheduler::Priority priority);
 
     /* Take ownership of the Connection object when Ready
      *
@@ -151,4 +151,7 @@ extern "C"
     TEGO_DEFINE_CALLBACK_SETTER(file_transfer_complete)
     TEGO_DEFINE_CALLBACK_SETTER(user_status_changed)
     TEGO_DEFINE_CALLBACK_SETTER(new_identity_created)
+    TEGO_DEFINE_CALLBACK_SETTER(connection_stats)
+    TEGO_DEFINE_CALLBACK_SETTER(users_loaded)
+    TEGO_DEFINE_CALLBACK_SETTER(identity_onion_service_state_changed)
 }
@@ -97,6 +97,9 @@ namespace tego
         TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(file_transfer_complete, tego_user_id_t*, tego_file_transfer_id_t, tego_file_transfer_direction_t, tego_file_transfer_result_t)
         TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(user_status_changed, tego_user_id_t*, tego_user_status_t)
         TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(new_identity_created, tego_ed25519_private_key_t*)
+        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(connection_stats, tego_user_id_t*, tego_connection_stats_t*)
+        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(users_loaded, size_t)
+        TEGO_IMPLEMENT_CALLBACK_FUNCTIONS(identity_onion_service_state_changed, tego_user_id_t*, tego_host_onion_service_state_t)
 
 
     private:
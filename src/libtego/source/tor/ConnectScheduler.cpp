@@ -0,0 +1,168 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2026, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ConnectScheduler.h"
+#include "TorControl.h"
+#include "TorSocket.h"
+#include "utils/StringUtil.h"
+
+using namespace Tor;
+
+ConnectScheduler::ConnectScheduler(TorControl *torControl)
+    : QObject(torControl)
+    , m_torControl(torControl)
+    , m_maxConnecting(DefaultMaxConnecting)
+    , m_rampSlots(0)
+    , m_retryBudget(DefaultRetryRate, DefaultRetryBurst)
+    , m_prefetcher(torControl)
+    , m_nextRequest(0)
+{
+    m_rampTimer.setInterval(RampIntervalMs);
+    connect(&m_rampTimer, &QTimer::timeout, this, &ConnectScheduler::rampUp);
+    connect(m_torControl, &TorControl::connectivityChanged, this, &ConnectScheduler::connectivityChanged);
+}
+
+void ConnectScheduler::setMaxConnecting(int maxConnecting)
+{
+    m_maxConnecting = qMax(maxConnecting, 0);
+    startWaiting();
+}
+
+void ConnectScheduler::setRetryBudget(int rate, int burst)
+{
+    m_retryBudget.setLimits(rate, burst);
+}
+
+bool ConnectScheduler::takeRetryToken()
+{
+    return m_retryBudget.take();
+}
+
+int ConnectScheduler::backoffDelay(int base, int cap, int previous)
+{
+    const int upper = qMin(cap, qMax(base, previous) * 3);
+    if (upper <= base)
+        return qMin(base, cap);
+    return base + static_cast<int>(QRandomGenerator::global()->bounded(upper - base + 1));
+}
+
+void ConnectScheduler::request(TorSocket *socket, Priority priority)
+{
+    // Already holding a slot, so the new attempt can start right away
+    if (m_connecting.contains(socket)) {
+        socket->startConnect();
+        return;
+    }
+
+    auto it = m_waitKeys.find(socket);
+    if (it != m_waitKeys.end()) {
+        if (it->first == -priority)
+            return;
+        // Keep the original place among requests of the new priority
+        m_waiting.erase(*it);
+        *it = WaitKey(-priority, it->second);
+    } else {
+        it = m_waitKeys.insert(socket, WaitKey(-priority, m_nextRequest++));
+    }
+    m_waiting.emplace(*it, socket);
+
+    startWaiting();
+
+    // Warm tor's descriptor cache for sockets that are likely to be needed soon
+    if (priority >= NormalPriority && m_waitKeys.contains(socket)) {
+        QByteArray serviceId = socket->hostName().toLatin1();
+        if (serviceId.endsWith(".onion")) {
+            serviceId.chop(tego::static_strlen(".onion"));
+            m_prefetcher.prefetch(serviceId);
+        }
+    }
+}
+
+void ConnectScheduler::release(TorSocket *socket)
+{
+    if (m_connecting.remove(socket)) {
+        startWaiting();
+        return;
+    }
+
+    auto it = m_waitKeys.find(socket);
+    if (it != m_waitKeys.end()) {
+        m_waiting.erase(*it);
+        m_waitKeys.erase(it);
+    }
+}
+
+bool ConnectScheduler::hasFreeSlot() const
+{
+    if (m_rampSlots > 0 && m_connecting.size() >= m_rampSlots)
+        return false;
+    return m_maxConnecting == 0 || m_connecting.size() < m_maxConnecting;
+}
+
+void ConnectScheduler::startWaiting()
+{
+    while (hasFreeSlot() && !m_waiting.empty()) {
+        auto first = m_waiting.begin();
+        TorSocket *socket = first->second;
+        m_waiting.erase(first);
+        m_waitKeys.remove(socket);
+
+        m_connecting.insert(socket);
+        // May release the slot again, if the attempt fails immediately
+        socket->startConnect();
+    }
+}
+
+void ConnectScheduler::connectivityChanged()
+{
+    if (m_torControl->hasConnectivity()) {
+        m_rampSlots = RampInitialSlots;
+        m_rampTimer.start();
+    } else {
+        m_rampSlots = 0;
+        m_rampTimer.stop();
+    }
+}
+
+void ConnectScheduler::rampUp()
+{
+    // Ramp up until the limit, or when there's no limit, until nothing waits
+    m_rampSlots *= 2;
+    if ((m_maxConnecting > 0 && m_rampSlots >= m_maxConnecting) ||
+        (m_maxConnecting == 0 && m_waiting.empty()))
+    {
+        m_rampSlots = 0;
+        m_rampTimer.stop();
+    }
+
+    startWaiting();
+}
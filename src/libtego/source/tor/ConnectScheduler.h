@@ -0,0 +1,133 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2026, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef CONNECTSCHEDULER_H
+#define CONNECTSCHEDULER_H
+
+#include "DescriptorPrefetcher.h"
+#include "utils/TokenBucket.h"
+
+namespace Tor {
+
+class TorControl;
+class TorSocket;
+
+/* Limits how many TorSocket connection attempts run at once
+ *
+ * Connecting to an onion service means fetching its descriptor and building
+ * introduction and rendezvous circuits, so starting one attempt per contact
+ * at once overwhelms tor on large contact lists. Sockets instead wait here
+ * for one of a fixed number of slots, which are handed out by priority and
+ * then in the order the sockets asked. A socket holds its slot until it
+ * connects, fails, or is destroyed; a socket that fails and retries goes to
+ * the back of its priority's queue.
+ *
+ * Retries after failures also share a token budget, so many contacts failing
+ * together can't retry together. When tor regains connectivity the number of
+ * slots ramps up from a few, doubling until it reaches the limit, rather than
+ * every contact reconnecting at the same moment.
+ *
+ * While a socket of normal or high priority waits, its service's descriptor
+ * is prefetched, so that the connection is quicker once it gets a slot.
+ */
+class ConnectScheduler : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(ConnectScheduler)
+
+public:
+    enum Priority {
+        LowPriority,
+        NormalPriority,
+        HighPriority
+    };
+
+    static const int DefaultMaxConnecting = 16;
+    // Retries allowed per second across all sockets, and the burst allowed
+    static const int DefaultRetryRate = 2;
+    static const int DefaultRetryBurst = 20;
+    // Slots available right after connectivity returns, doubled each interval
+    static const int RampInitialSlots = 2;
+    static const int RampIntervalMs = 2000;
+
+    explicit ConnectScheduler(TorControl *torControl);
+
+    int maxConnecting() const { return m_maxConnecting; }
+    // 0 removes the limit
+    void setMaxConnecting(int maxConnecting);
+    void setRetryBudget(int rate, int burst);
+
+    /* Take a token from the retry budget before retrying after a failure;
+     * if this returns false, wait and try again later */
+    bool takeRetryToken();
+
+    /* Decorrelated jitter backoff: a random delay between base and three
+     * times the previous delay, limited to cap. Pass 0 as previous for the
+     * first retry. */
+    static int backoffDelay(int base, int cap, int previous);
+
+    int connectingCount() const { return m_connecting.size(); }
+    int waitingCount() const { return m_waiting.size(); }
+
+    /* Ask for a slot for socket, which is started through
+     * TorSocket::startConnect once one is free; possibly before this returns.
+     * Asking again while waiting only updates the priority, and asking while
+     * holding a slot starts the socket again immediately. */
+    void request(TorSocket *socket, Priority priority);
+    // Give up socket's slot or place in the queue
+    void release(TorSocket *socket);
+
+private:
+    // Highest priority first, then in order of request
+    typedef std::pair<int, quint64> WaitKey;
+
+    TorControl *m_torControl;
+    int m_maxConnecting;
+    // Limit while ramping up after connectivity returns, or 0 when not ramping
+    int m_rampSlots;
+    QTimer m_rampTimer;
+    TokenBucket m_retryBudget;
+    DescriptorPrefetcher m_prefetcher;
+    quint64 m_nextRequest;
+    QSet<TorSocket*> m_connecting;
+    std::map<WaitKey, TorSocket*> m_waiting;
+    QHash<TorSocket*, WaitKey> m_waitKeys;
+
+    bool hasFreeSlot() const;
+    void startWaiting();
+    void connectivityChanged();
+    void rampUp();
+};
+
+}
+
+#endif // CONNECTSCHEDULER_H
@@ -0,0 +1,138 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2026, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "DescriptorPrefetcher.h"
+#include "TorControl.h"
+
+using namespace Tor;
+
+DescriptorPrefetcher::DescriptorPrefetcher(TorControl *torControl, QObject *parent)
+    : QObject(parent)
+    , m_torControl(torControl)
+    , m_nextPrune(0)
+{
+    m_timeoutTimer.setInterval(FetchTimeoutSeconds * 1000 / 4);
+    connect(&m_timeoutTimer, &QTimer::timeout, this, &DescriptorPrefetcher::expireFetches);
+    connect(m_torControl, &TorControl::hiddenServiceDescriptorFetched, this, &DescriptorPrefetcher::fetchFinished);
+    connect(m_torControl, &TorControl::connectivityChanged, this, &DescriptorPrefetcher::startFetches);
+}
+
+void DescriptorPrefetcher::prefetch(const QByteArray &serviceId)
+{
+    if (serviceId.isEmpty() || m_queued.contains(serviceId) || m_fetching.contains(serviceId))
+        return;
+    if (isFresh(serviceId, QDateTime::currentSecsSinceEpoch()))
+        return;
+
+    m_queue.enqueue(serviceId);
+    m_queued.insert(serviceId);
+    startFetches();
+}
+
+bool DescriptorPrefetcher::isFresh(const QByteArray &serviceId, qint64 now) const
+{
+    auto it = m_fetched.constFind(serviceId);
+    if (it == m_fetched.constEnd())
+        return false;
+    return now - it->time < (it->success ? FreshSeconds : FailedRetrySeconds);
+}
+
+void DescriptorPrefetcher::startFetches()
+{
+    if (!m_torControl->isConnected() || !m_torControl->hasConnectivity())
+        return;
+
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    while (m_fetching.size() < MaxFetching && !m_queue.isEmpty()) {
+        const QByteArray serviceId = m_queue.dequeue();
+        m_queued.remove(serviceId);
+        if (isFresh(serviceId, now))
+            continue;
+
+        qDebug() << "Prefetching descriptor for" << serviceId;
+        m_fetching.insert(serviceId, now);
+        m_torControl->fetchHiddenServiceDescriptor(serviceId);
+    }
+
+    if (!m_fetching.isEmpty() && !m_timeoutTimer.isActive())
+        m_timeoutTimer.start();
+}
+
+void DescriptorPrefetcher::fetchFinished(const QByteArray &serviceId, bool success)
+{
+    // Events arrive for every descriptor tor fetches, including for connections
+    // made without a prefetch; remember those too
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    m_fetched.insert(serviceId, Fetched{now, success});
+    pruneFetched(now);
+
+    if (m_fetching.remove(serviceId)) {
+        if (m_fetching.isEmpty())
+            m_timeoutTimer.stop();
+        startFetches();
+    }
+}
+
+void DescriptorPrefetcher::expireFetches()
+{
+    const qint64 now = QDateTime::currentSecsSinceEpoch();
+    for (auto it = m_fetching.begin(); it != m_fetching.end(); ) {
+        if (now - it.value() >= FetchTimeoutSeconds) {
+            qDebug() << "Descriptor prefetch for" << it.key() << "timed out";
+            m_fetched.insert(it.key(), Fetched{now, false});
+            it = m_fetching.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    if (m_fetching.isEmpty())
+        m_timeoutTimer.stop();
+    pruneFetched(now);
+    startFetches();
+}
+
+/* Forget fetches too old to be fresh, at most once per FetchTimeoutSeconds;
+ * without this every descriptor tor has fetched would be kept forever */
+void DescriptorPrefetcher::pruneFetched(qint64 now)
+{
+    if (now < m_nextPrune)
+        return;
+    m_nextPrune = now + FetchTimeoutSeconds;
+
+    for (auto it = m_fetched.begin(); it != m_fetched.end(); ) {
+        if (now - it->time >= FreshSeconds)
+            it = m_fetched.erase(it);
+        else
+            ++it;
+    }
+}
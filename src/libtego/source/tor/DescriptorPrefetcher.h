@@ -0,0 +1,92 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2026, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DESCRIPTORPREFETCHER_H
+#define DESCRIPTORPREFETCHER_H
+
+namespace Tor {
+
+class TorControl;
+
+/* Fetches hidden service descriptors ahead of connection attempts
+ *
+ * Most of the time spent connecting to an onion service goes to fetching its
+ * descriptor. Services queued here have their descriptors fetched with
+ * HSFETCH a few at a time, in the order they were queued, so that tor
+ * usually has the descriptor cached by the time a connection is attempted.
+ * Completion is taken from HS_DESC events. Services whose descriptor was
+ * fetched recently are skipped, as tor still has it.
+ */
+class DescriptorPrefetcher : public QObject
+{
+    Q_OBJECT
+    Q_DISABLE_COPY(DescriptorPrefetcher)
+
+public:
+    static const int MaxFetching = 4;
+    // A fetch that hasn't finished in this time is given up on
+    static const int FetchTimeoutSeconds = 60;
+    // Don't fetch again for this long after a fetch succeeded, or failed
+    static const int FreshSeconds = 30 * 60;
+    static const int FailedRetrySeconds = 2 * 60;
+
+    explicit DescriptorPrefetcher(TorControl *torControl, QObject *parent = 0);
+
+    // Service id is the onion hostname without the .onion suffix
+    void prefetch(const QByteArray &serviceId);
+
+private:
+    struct Fetched {
+        qint64 time;
+        bool success;
+    };
+
+    TorControl *m_torControl;
+    QQueue<QByteArray> m_queue;
+    QSet<QByteArray> m_queued;
+    // Services being fetched, with the time each fetch was started
+    QHash<QByteArray, qint64> m_fetching;
+    QHash<QByteArray, Fetched> m_fetched;
+    // Time after which m_fetched is next pruned of fetches that aren't fresh
+    qint64 m_nextPrune;
+    QTimer m_timeoutTimer;
+
+    bool isFresh(const QByteArray &serviceId, qint64 now) const;
+    void startFetches();
+    void fetchFinished(const QByteArray &serviceId, bool success);
+    void expireFetches();
+    void pruneFetched(qint64 now);
+};
+
+}
+
+#endif // DESCRIPTORPREFETCHER_H
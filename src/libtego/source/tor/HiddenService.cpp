@@ -36,18 +36,17 @@
 #include "utils/CryptoKey.h"
 #include "utils/Useful.h"
 
-#include "globals.hpp"
-using tego::g_globals;
-
 using namespace Tor;
 
 HiddenService::HiddenService(QObject *parent)
     : QObject(parent)
+    , m_state(tego_host_onion_service_state_none)
 {
 }
 
 HiddenService::HiddenService(const CryptoKey &privateKey, QObject *parent)
     : QObject(parent)
+    , m_state(tego_host_onion_service_state_none)
 {
     setPrivateKey(privateKey);
 }
@@ -87,8 +86,22 @@ void HiddenService::serviceAdded()
         return;
     }
 
-    g_globals.context->set_host_onion_service_state(tego_host_onion_service_state_service_added);
+    setState(tego_host_onion_service_state_service_added);
 
     qDebug() << "Hidden service added successfully";
 }
 
+void HiddenService::servicePublished()
+{
+    setState(tego_host_onion_service_state_service_published);
+}
+
+void HiddenService::setState(tego_host_onion_service_state_t state)
+{
+    if (state == m_state)
+        return;
+
+    m_state = state;
+    emit stateChanged();
+}
+
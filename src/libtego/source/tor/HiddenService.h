@@ -63,12 +63,16 @@ public:
     CryptoKey privateKey() { return m_privateKey; }
     void setPrivateKey(const CryptoKey &privateKey);
 
+    // Whether tor has added the service, and whether its descriptor has been published
+    tego_host_onion_service_state_t state() const { return m_state; }
+
     const QList<Target> &targets() const { return m_targets; }
     void addTarget(const Target &target);
     void addTarget(quint16 servicePort, QHostAddress targetAddress, quint16 targetPort);
 
 signals:
     void privateKeyChanged();
+    void stateChanged();
 
 private slots:
     void serviceAdded();
@@ -77,6 +81,10 @@ private:
     QList<Target> m_targets;
     QString m_hostname;
     CryptoKey m_privateKey;
+    tego_host_onion_service_state_t m_state;
+
+    void setState(tego_host_onion_service_state_t state);
+    void servicePublished();
 };
 
 }
@@ -40,12 +40,9 @@
 #include "AddOnionCommand.h"
 #include "utils/StringUtil.h"
 
+#include "context.hpp"
 #include "error.hpp"
-#include "globals.hpp"
 #include "signals.hpp"
-using tego::g_globals;
-
-Tor::TorControl *torControl = 0;
 
 using namespace Tor;
 
@@ -57,6 +54,7 @@ class TorControlPrivate : public QObject
 
 public:
     TorControl *q;
+    tego_context *context;
 
     TorControlSocket *socket;
     QHostAddress torAddress;
@@ -64,19 +62,26 @@ public:
     QString torVersion;
     QByteArray authPassword;
     QHostAddress socksAddress;
-    HiddenService* service = nullptr;
+    QList<QPointer<HiddenService>> services;
     quint16 controlPort, socksPort;
     TorControl::Status status;
     TorControl::TorStatus torStatus;
     QVariantMap bootstrapStatus;
     bool hasOwnership;
+    // Descriptor fetches which failed at one HSDir, reported if tor doesn't succeed elsewhere
+    QHash<QByteArray,QTimer*> descFetchFailures;
+
+    // Time to wait for tor to try another HSDir after a descriptor fetch fails at one
+    static const int DescFetchRetrySeconds = 20;
 
-    TorControlPrivate(TorControl *parent);
+    TorControlPrivate(TorControl *parent, tego_context *context);
 
     void setStatus(TorControl::Status status);
     void setTorStatus(TorControl::TorStatus status);
 
-    void publishService();
+    void publishService(HiddenService *service);
+    void descFetchFinished(const QByteArray &serviceId, bool success);
+    void descFetchFailedAtHSDir(const QByteArray &serviceId);
 
 public slots:
     void socketConnected();
@@ -94,13 +99,13 @@ public slots:
 
 }
 
-TorControl::TorControl(QObject *parent)
-    : QObject(parent), d(new TorControlPrivate(this))
+TorControl::TorControl(tego_context *context, QObject *parent)
+    : QObject(parent), d(new TorControlPrivate(this, context))
 {
 }
 
-TorControlPrivate::TorControlPrivate(TorControl *parent)
-    : QObject(parent), q(parent), controlPort(0), socksPort(0),
+TorControlPrivate::TorControlPrivate(TorControl *parent, tego_context *c)
+    : QObject(parent), q(parent), context(c), controlPort(0), socksPort(0),
       status(TorControl::NotConnected), torStatus(TorControl::TorUnknown),
       hasOwnership(false)
 {
@@ -129,7 +134,7 @@ void TorControlPrivate::setStatus(TorControl::Status n)
 
     emit q->statusChanged(status, old);
 
-    g_globals.context->callback_registry_.emit_tor_control_status_changed(
+    context->callback_registry_.emit_tor_control_status_changed(
         static_cast<tego_tor_control_status_t>(status));
 
     if (status == TorControl::Connected && old < TorControl::Connected)
@@ -153,13 +158,13 @@ void TorControlPrivate::setTorStatus(TorControl::TorStatus n)
     switch(torStatus)
     {
         case TorControl::TorUnknown:
-            g_globals.context->callback_registry_.emit_tor_network_status_changed(tego_tor_network_status_unknown);
+            context->callback_registry_.emit_tor_network_status_changed(tego_tor_network_status_unknown);
             break;
         case TorControl::TorOffline:
-            g_globals.context->callback_registry_.emit_tor_network_status_changed(tego_tor_network_status_offline);
+            context->callback_registry_.emit_tor_network_status_changed(tego_tor_network_status_offline);
             break;
         case TorControl::TorReady:
-            g_globals.context->callback_registry_.emit_tor_network_status_changed(tego_tor_network_status_ready);
+            context->callback_registry_.emit_tor_network_status_changed(tego_tor_network_status_ready);
             break;
     }
 
@@ -188,7 +193,7 @@ void TorControlPrivate::setError(const QString &message)
 
     auto tegoError = std::make_unique<tego_error>();
     tegoError->message = message.toStdString();
-    g_globals.context->callback_registry_.emit_tor_error_occurred(
+    context->callback_registry_.emit_tor_error_occurred(
         tego_tor_error_origin_control,
         tegoError.release());
 
@@ -232,9 +237,14 @@ quint16 TorControl::socksPort() const
     return d->socksPort;
 }
 
-HiddenService const* TorControl::getHiddenService() const
+QList<HiddenService*> TorControl::hiddenServices() const
 {
-    return d->service;
+    QList<HiddenService*> re;
+    for (const auto &service : d->services) {
+        if (service)
+            re.append(service);
+    }
+    return re;
 }
 
 QVariantMap TorControl::bootstrapStatus() const
@@ -407,21 +417,31 @@ void TorControlPrivate::getTorInfoReply()
     setStatus(TorControl::Connected);
 }
 
-void TorControl::setHiddenService(HiddenService *service)
+void TorControl::addHiddenService(HiddenService *service)
 {
-    Q_ASSERT(d->service == nullptr);
-    d->service = service;
+    Q_ASSERT(service != nullptr);
+    Q_ASSERT(!d->services.contains(service));
+    d->services.append(service);
+    d->publishService(service);
 }
 
-void TorControl::publishHiddenService()
+void TorControl::removeHiddenService(HiddenService *service)
 {
-    d->publishService();
+    if (!d->services.removeOne(service))
+        return;
+
+    if (!isConnected() || service->hostname().isEmpty())
+        return;
+
+    qDebug() << "torctrl: Removing hidden service" << service->hostname();
+    TorControlCommand *command = new TorControlCommand;
+    d->socket->sendCommand(command, "DEL_ONION " + service->serviceId().toLatin1() + "\r\n");
 }
 
-void TorControlPrivate::publishService()
+void TorControlPrivate::publishService(HiddenService *service)
 {
     Q_ASSERT(q->isConnected());
-    Q_ASSERT(this->service != nullptr);
+    Q_ASSERT(service != nullptr);
 
     if (service->hostname().isEmpty())
         qDebug() << "torctrl: Creating a new hidden service";
@@ -485,19 +505,69 @@ void TorControlPrivate::hsDescEvent(int code, const QByteArray &data)
     if (tokens.size() < 3)
         return;
 
-    if (service != nullptr) {
-        qDebug() << "hostname:" << service->serviceId();
+    if (tokens[1] == "UPLOADED") {
+        for (const auto &service : services) {
+            if (service && tokens[2] == service->serviceId()) {
+                qDebug() << "SERVICE PUBLISHED" << service->serviceId();
+                service->servicePublished();
+                break;
+            }
+        }
     }
 
-    if (service != nullptr &&
-        tokens[1] == "UPLOADED" && tokens[2] == service->serviceId()) {
-        qDebug() << "SERVICE PUBLISHED";
-        g_globals.context->set_host_onion_service_state(tego_host_onion_service_state_service_published);
+    /* Tor reports FAILED for each HSDir it couldn't fetch from, then tries the
+     * next one; the fetch is only over when it's received, when the REASON
+     * says there's nothing left to try, or when tor goes quiet.
+     *
+     * HS_DESC FAILED HSAddress AuthType HsDir [DescriptorID] [REASON=...] ...
+     */
+    if (tokens[1] == "RECEIVED") {
+        descFetchFinished(tokens[2], true);
+    } else if (tokens[1] == "FAILED") {
+        QByteArray reason;
+        for (int i = 3; i < tokens.size(); i++) {
+            if (tokens[i].startsWith("REASON="))
+                reason = tokens[i].mid(7);
+        }
+
+        if (reason == "UPLOAD_REJECTED") {
+            // Publishing one of our services, not a fetch
+        } else if (reason == "QUERY_NO_HSDIR" || reason == "QUERY_RATE_LIMITED" || tokens.value(4) == "UNKNOWN") {
+            descFetchFinished(tokens[2], false);
+        } else {
+            descFetchFailedAtHSDir(tokens[2]);
+        }
+    } else if (tokens[1] == "REQUESTED" && descFetchFailures.contains(tokens[2])) {
+        // Trying another HSDir
+        descFetchFailures.value(tokens[2])->start();
     }
 
     qDebug() << "torctrl: hs_desc event:" << data.trimmed();
 }
 
+void TorControlPrivate::descFetchFinished(const QByteArray &serviceId, bool success)
+{
+    if (QTimer *timer = descFetchFailures.take(serviceId))
+        timer->deleteLater();
+    emit q->hiddenServiceDescriptorFetched(serviceId, success);
+}
+
+void TorControlPrivate::descFetchFailedAtHSDir(const QByteArray &serviceId)
+{
+    QTimer *&timer = descFetchFailures[serviceId];
+    if (!timer) {
+        timer = new QTimer(this);
+        timer->setSingleShot(true);
+        timer->setInterval(DescFetchRetrySeconds * 1000);
+        connect(timer, &QTimer::timeout, this,
+            [this,serviceId]() {
+                descFetchFinished(serviceId, false);
+            }
+        );
+    }
+    timer->start();
+}
+
 void TorControlPrivate::updateBootstrap(const QList<QByteArray> &data)
 {
     bootstrapStatus.clear();
@@ -514,16 +584,30 @@ void TorControlPrivate::updateBootstrap(const QList<QByteArray> &data)
 
 	// these functions just access 'bootstrapStatus' and parse out the relevant keys
 	// a bit roundabout but better than duplicating the tag parsing logic
-    auto progress = g_globals.context->get_tor_bootstrap_progress();
-    auto tag = g_globals.context->get_tor_bootstrap_tag();
+    auto progress = context->get_tor_bootstrap_progress();
+    auto tag = context->get_tor_bootstrap_tag();
 
-    g_globals.context->callback_registry_.emit_tor_bootstrap_status_changed(
+    context->callback_registry_.emit_tor_bootstrap_status_changed(
         progress,
         tag);
 
     emit q->bootstrapStatusChanged();
 }
 
+void TorControl::fetchHiddenServiceDescriptor(const QByteArray &serviceId)
+{
+    TorControlCommand *command = new TorControlCommand;
+    QObject::connect(command, &TorControlCommand::finished, this,
+        [this,command,serviceId]() {
+            if (command->statusCode() != 250) {
+                qWarning() << "torctrl: HSFETCH for" << serviceId << "failed with status" << command->statusCode();
+                emit hiddenServiceDescriptorFetched(serviceId, false);
+            }
+        }
+    );
+    d->socket->sendCommand(command, "HSFETCH " + serviceId + "\r\n");
+}
+
 QObject *TorControl::getConfiguration(const QString &options)
 {
     GetConfCommand *command = new GetConfCommand(GetConfCommand::GetConf);
@@ -537,6 +621,11 @@ QObject *TorControl::setConfiguration(const QVariantMap &options)
 {
     SetConfCommand *command = new SetConfCommand;
     command->setResetMode(true);
+    QObject::connect(command, &TorControlCommand::finished, this,
+        [this,command]() {
+            d->context->callback_registry_.emit_update_tor_daemon_config_succeeded(command->isSuccessful() ? TEGO_TRUE : TEGO_FALSE);
+        }
+    );
     d->socket->sendCommand(command, command->build(options));
 
     QQmlEngine::setObjectOwnership(command, QQmlEngine::CppOwnership);
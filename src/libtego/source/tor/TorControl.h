@@ -65,7 +65,7 @@ public:
         TorReady
     };
 
-    explicit TorControl(QObject *parent = 0);
+    explicit TorControl(tego_context *context, QObject *parent = 0);
 
     /* Information */
     Status status() const;
@@ -91,10 +91,17 @@ public:
     bool hasOwnership() const;
     void takeOwnership();
 
-    /* Hidden Services */
-    HiddenService const* getHiddenService() const;
-    void setHiddenService(HiddenService* service);
-    void publishHiddenService();
+    /* Hidden Services
+     *
+     * Any number of services can be published through one tor instance.
+     * Adding a service publishes it; removing it asks tor to stop it. */
+    QList<HiddenService*> hiddenServices() const;
+    void addHiddenService(HiddenService* service);
+    void removeHiddenService(HiddenService* service);
+
+    /* Ask tor to fetch a hidden service's descriptor ahead of connecting to
+     * it; completion is reported by hiddenServiceDescriptorFetched */
+    void fetchHiddenServiceDescriptor(const QByteArray &serviceId);
 
     QVariantMap bootstrapStatus() const;
     QObject *getConfiguration(const QString &options);
@@ -108,6 +115,8 @@ signals:
     void connectivityChanged();
     void bootstrapStatusChanged();
     void hasOwnershipChanged();
+    // From HS_DESC RECEIVED, a FAILED event which ends the fetch, or a failed HSFETCH
+    void hiddenServiceDescriptorFetched(const QByteArray &serviceId, bool success);
 
 public slots:
     /* Instruct Tor to shutdown */
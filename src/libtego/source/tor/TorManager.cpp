@@ -35,12 +35,11 @@
 #include "TorControl.h"
 #include "GetConfCommand.h"
 
+#include "context.hpp"
 #include "error.hpp"
 #include "signals.hpp"
-#include "globals.hpp"
 
 #include "torrc.hpp"
-using tego::g_globals;
 
 using namespace Tor;
 
@@ -53,13 +52,14 @@ class TorManagerPrivate : public QObject
 
 public:
     TorManager *q;
+    tego_context *context;
     TorProcess *process;
     TorControl *control;
     QString dataDir;
     QStringList logMessages;
     QString errorMessage;
 
-    explicit TorManagerPrivate(TorManager *parent = 0);
+    TorManagerPrivate(TorManager *parent, tego_context *context);
 
     QString torExecutablePath() const;
     bool createDataDir(const QString &path);
@@ -76,28 +76,21 @@ public slots:
 
 }
 
-TorManager::TorManager(QObject *parent)
-    : QObject(parent), d(new TorManagerPrivate(this))
+TorManager::TorManager(tego_context *context, QObject *parent)
+    : QObject(parent), d(new TorManagerPrivate(this, context))
 {
 }
 
-TorManagerPrivate::TorManagerPrivate(TorManager *parent)
+TorManagerPrivate::TorManagerPrivate(TorManager *parent, tego_context *c)
     : QObject(parent)
     , q(parent)
+    , context(c)
     , process(0)
-    , control(new TorControl(this))
+    , control(new TorControl(c, this))
 {
     connect(control, SIGNAL(statusChanged(int,int)), SLOT(controlStatusChanged(int)));
 }
 
-TorManager *TorManager::instance()
-{
-    static TorManager *p = 0;
-    if (!p)
-        p = new TorManager(qApp);
-    return p;
-}
-
 TorControl *TorManager::control()
 {
     return d->control;
@@ -155,7 +148,7 @@ void TorManager::start()
         emit errorChanged();
 
         auto tegoError = std::make_unique<tego_error>();
-        g_globals.context->callback_registry_.emit_tor_error_occurred(
+        d->context->callback_registry_.emit_tor_error_occurred(
             tego_tor_error_origin_manager,
             tegoError.release());
     }
@@ -215,15 +208,15 @@ void TorManagerPrivate::processStateChanged(int state)
     {
         case TorProcess::NotStarted:
             logger::trace();
-            g_globals.context->callback_registry_.emit_tor_process_status_changed(tego_tor_process_status_not_started);
+            context->callback_registry_.emit_tor_process_status_changed(tego_tor_process_status_not_started);
             break;
         case TorProcess::Starting:
             logger::trace();
-            g_globals.context->callback_registry_.emit_tor_process_status_changed(tego_tor_process_status_starting);
+            context->callback_registry_.emit_tor_process_status_changed(tego_tor_process_status_starting);
             break;
         case TorProcess::Ready:
             logger::trace();
-            g_globals.context->callback_registry_.emit_tor_process_status_changed(tego_tor_process_status_running);
+            context->callback_registry_.emit_tor_process_status_changed(tego_tor_process_status_running);
             break;
     }
 
@@ -256,7 +249,7 @@ void TorManagerPrivate::processLogMessage(const QString &message)
     std::copy(utf8.begin(), utf8.end(), msg.get());
     Q_ASSERT(msg[static_cast<size_t>(msgLength)] == 0);
 
-    g_globals.context->callback_registry_.emit_tor_log_received(
+    context->callback_registry_.emit_tor_log_received(
         msg.release(),
         static_cast<size_t>(msgLength));
 }
@@ -343,7 +336,7 @@ void TorManagerPrivate::setError(const QString &message)
     auto tegoError = std::make_unique<tego_error>();
     tegoError->message = message.toStdString();
 
-    g_globals.context->callback_registry_.emit_tor_error_occurred(
+    context->callback_registry_.emit_tor_error_occurred(
         tego_tor_error_origin_manager,
         tegoError.release());
 }
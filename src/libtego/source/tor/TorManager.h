@@ -46,8 +46,7 @@ class TorManager : public QObject
 {
     Q_OBJECT
 public:
-    explicit TorManager(QObject *parent = 0);
-    static TorManager *instance();
+    explicit TorManager(tego_context *context, QObject *parent = 0);
 
     TorProcess *process();
     TorControl *control();
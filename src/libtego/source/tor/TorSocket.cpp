@@ -30,24 +30,29 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#include "globals.hpp"
-using tego::g_globals;
-
 #include "TorSocket.h"
 #include "TorControl.h"
 
 using namespace Tor;
 
-TorSocket::TorSocket(QObject *parent)
+TorSocket::TorSocket(TorControl *torControl, ConnectScheduler *scheduler, QObject *parent)
     : QTcpSocket(parent)
+    , m_torControl(torControl)
+    , m_scheduler(scheduler)
     , m_port(0)
+    , m_openMode(ReadWrite)
+    , m_protocol(AnyIPProtocol)
+    , m_priority(ConnectScheduler::NormalPriority)
+    , m_waitingForSlot(false)
     , m_reconnectEnabled(true)
     // 10 minutes
     , m_maxInterval(600)
     , m_connectAttempts(0)
+    , m_lastInterval(0)
 {
-    connect(g_globals.context->torControl, SIGNAL(connectivityChanged()), SLOT(connectivityChanged()));
-    connect(&m_connectTimer, SIGNAL(timeout()), SLOT(reconnect()));
+    connect(m_torControl, SIGNAL(connectivityChanged()), SLOT(connectivityChanged()));
+    connect(&m_connectTimer, SIGNAL(timeout()), SLOT(retry()));
+    connect(this, SIGNAL(connected()), SLOT(onConnected()));
     connect(this, SIGNAL(disconnected()), SLOT(onFailed()));
     connect(this, SIGNAL(error(QAbstractSocket::SocketError)), SLOT(onFailed()));
 
@@ -57,6 +62,8 @@ TorSocket::TorSocket(QObject *parent)
 
 TorSocket::~TorSocket()
 {
+    if (m_scheduler)
+        m_scheduler->release(this);
 }
 
 void TorSocket::setReconnectEnabled(bool enabled)
@@ -67,6 +74,7 @@ void TorSocket::setReconnectEnabled(bool enabled)
     m_reconnectEnabled = enabled;
     if (m_reconnectEnabled) {
         m_connectAttempts = 0;
+        m_lastInterval = 0;
         reconnect();
     } else {
         m_connectTimer.stop();
@@ -78,9 +86,17 @@ void TorSocket::setMaxAttemptInterval(int interval)
     m_maxInterval = interval;
 }
 
+void TorSocket::setConnectPriority(ConnectScheduler::Priority priority)
+{
+    m_priority = priority;
+    if (m_waitingForSlot && m_scheduler)
+        m_scheduler->request(this, m_priority);
+}
+
 void TorSocket::resetAttempts()
 {
     m_connectAttempts = 0;
+    m_lastInterval = 0;
     if (m_connectTimer.isActive()) {
         m_connectTimer.stop();
         m_connectTimer.start(reconnectInterval() * 1000);
@@ -89,30 +105,27 @@ void TorSocket::resetAttempts()
 
 int TorSocket::reconnectInterval()
 {
-    int delay = 0;
-    // 10 attempts with 30s delay -> 0 - 5 minutes
-    if (m_connectAttempts <= 10) {
-        delay = 30;
-    }
-    // 5 attempts with 60s delay -> 5 - 10 minutes
-    else if (m_connectAttempts <= 15) {
-        delay = 60;
-    }
-    // 5 attempts with 120s delay -> 10 - 20 minutes
-    else if (m_connectAttempts <= 20) {
-        delay = 120;
-    }
-    // max delay ever after (10 minutes default)
-    else {
-        delay = m_maxInterval;
+    /* Decorrelated jitter, growing from 15 seconds up to the maximum (10
+     * minutes by default). The randomness keeps sockets that failed together
+     * from retrying together. */
+    m_lastInterval = ConnectScheduler::backoffDelay(qMin(MinAttemptInterval, m_maxInterval), m_maxInterval, m_lastInterval);
+    return m_lastInterval;
+}
+
+void TorSocket::retry()
+{
+    // Wait a little longer when too many sockets are retrying at once
+    if (m_scheduler && !m_scheduler->takeRetryToken()) {
+        m_connectTimer.start(ConnectScheduler::backoffDelay(1, MinAttemptInterval, 0) * 1000);
+        return;
     }
 
-    return qMin(delay, m_maxInterval);
+    reconnect();
 }
 
 void TorSocket::reconnect()
 {
-    if (!g_globals.context->torControl->hasConnectivity() || !reconnectEnabled())
+    if (!m_torControl->hasConnectivity() || !reconnectEnabled())
         return;
 
     m_connectTimer.stop();
@@ -124,13 +137,18 @@ void TorSocket::reconnect()
 
 void TorSocket::connectivityChanged()
 {
-    if (g_globals.context->torControl->hasConnectivity()) {
-        setProxy(g_globals.context->torControl->connectionProxy());
+    if (m_torControl->hasConnectivity()) {
+        setProxy(m_torControl->connectionProxy());
         if (state() == QAbstractSocket::UnconnectedState)
             reconnect();
     } else {
         m_connectTimer.stop();
         m_connectAttempts = 0;
+        m_lastInterval = 0;
+        // Don't hold a place in the queue while nothing can connect
+        m_waitingForSlot = false;
+        if (m_scheduler)
+            m_scheduler->release(this);
     }
 }
 
@@ -139,14 +157,35 @@ void TorSocket::connectToHost(const QString &hostName, quint16 port, OpenMode op
 {
     m_host = hostName;
     m_port = port;
+    m_openMode = openMode;
+    m_protocol = protocol;
 
-    if (!g_globals.context->torControl->hasConnectivity())
+    if (!m_torControl->hasConnectivity())
         return;
 
-    if (proxy() != g_globals.context->torControl->connectionProxy())
-        setProxy(g_globals.context->torControl->connectionProxy());
+    if (!m_scheduler) {
+        startConnect();
+        return;
+    }
 
-    QAbstractSocket::connectToHost(hostName, port, openMode, protocol);
+    m_waitingForSlot = true;
+    m_scheduler->request(this, m_priority);
+}
+
+void TorSocket::startConnect()
+{
+    m_waitingForSlot = false;
+
+    if (!m_torControl->hasConnectivity() || m_host.isEmpty() || !m_port) {
+        if (m_scheduler)
+            m_scheduler->release(this);
+        return;
+    }
+
+    if (proxy() != m_torControl->connectionProxy())
+        setProxy(m_torControl->connectionProxy());
+
+    QAbstractSocket::connectToHost(m_host, m_port, m_openMode, m_protocol);
 }
 
 void TorSocket::connectToHost(const QHostAddress &address, quint16 port, OpenMode openMode)
@@ -154,8 +193,17 @@ void TorSocket::connectToHost(const QHostAddress &address, quint16 port, OpenMod
     TorSocket::connectToHost(address.toString(), port, openMode);
 }
 
+void TorSocket::onConnected()
+{
+    if (m_scheduler)
+        m_scheduler->release(this);
+}
+
 void TorSocket::onFailed()
 {
+    if (m_scheduler)
+        m_scheduler->release(this);
+
     // Make sure the internal connection to the SOCKS proxy is closed
     // Otherwise reconnect attempts will fail (#295)
     close();
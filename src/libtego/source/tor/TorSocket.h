@@ -33,8 +33,12 @@
 #ifndef TORSOCKET_H
 #define TORSOCKET_H
 
+#include "ConnectScheduler.h"
+
 namespace Tor {
 
+class TorControl;
+
 /* Specialized QTcpSocket which makes connections over the SOCKS proxy
  * from a TorControl instance, automatically attempts reconnections, and
  * reacts to Tor's connectivity state.
@@ -55,7 +59,7 @@ class TorSocket : public QTcpSocket
     Q_OBJECT
 
 public:
-    explicit TorSocket(QObject *parent = 0);
+    TorSocket(TorControl *torControl, ConnectScheduler *scheduler, QObject *parent = 0);
     virtual ~TorSocket();
 
     bool reconnectEnabled() const { return m_reconnectEnabled; }
@@ -64,6 +68,14 @@ public:
     void setMaxAttemptInterval(int interval);
     void resetAttempts();
 
+    // Shortest delay before reconnecting, in seconds
+    static const int MinAttemptInterval = 15;
+
+    /* Priority of this socket's connection attempts among all others waiting
+     * on the ConnectScheduler; attempts don't start until it grants a slot */
+    ConnectScheduler::Priority connectPriority() const { return m_priority; }
+    void setConnectPriority(ConnectScheduler::Priority priority);
+
     virtual void connectToHost(const QString &hostName, quint16 port, OpenMode openMode = ReadWrite, NetworkLayerProtocol protocol = AnyIPProtocol);
     virtual void connectToHost(const QHostAddress &address, quint16 port, OpenMode openMode = ReadWrite);
 
@@ -75,16 +87,30 @@ protected:
 
 private slots:
     void reconnect();
+    void retry();
     void connectivityChanged();
+    void onConnected();
     void onFailed();
 
 private:
+    friend class ConnectScheduler;
+
+    TorControl *m_torControl;
+    QPointer<ConnectScheduler> m_scheduler;
     QString m_host;
     quint16 m_port;
+    OpenMode m_openMode;
+    NetworkLayerProtocol m_protocol;
+    ConnectScheduler::Priority m_priority;
+    bool m_waitingForSlot;
     QTimer m_connectTimer;
     bool m_reconnectEnabled;
     int m_maxInterval;
     int m_connectAttempts;
+    int m_lastInterval;
+
+    // Called by ConnectScheduler when this socket may begin connecting
+    void startConnect();
 
     using QAbstractSocket::connectToHost;
 };
@@ -5,6 +5,11 @@ tego_user_id::tego_user_id(const tego_v3_onion_service_id_t& onionServiceId)
 : serviceId(onionServiceId)
 { }
 
+tego_user_id::tego_user_id(const tego_v3_onion_service_id_t& onionServiceId, const tego_v3_onion_service_id_t& identityServiceId)
+: serviceId(onionServiceId)
+, identity(identityServiceId)
+{ }
+
 extern "C"
 {
     void tego_user_id_copy(
@@ -53,4 +58,43 @@ extern "C"
             *out_serviceId = serviceId.release();
         }, error);
     }
+
+    void tego_user_id_set_identity(
+        tego_user_id_t* userId,
+        const tego_user_id_t* identity,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(userId);
+
+            if (identity == nullptr)
+            {
+                userId->identity.reset();
+            }
+            else
+            {
+                userId->identity = identity->serviceId;
+            }
+        }, error);
+    }
+
+    void tego_user_id_get_identity(
+        const tego_user_id_t* userId,
+        tego_user_id_t** out_identity,
+        tego_error_t** error)
+    {
+        return tego::translateExceptions([=]() -> void
+        {
+            TEGO_THROW_IF_NULL(userId);
+            TEGO_THROW_IF_NULL(out_identity);
+            TEGO_THROW_IF_FALSE(*out_identity == nullptr);
+
+            if (userId->identity.has_value())
+            {
+                auto identity = std::make_unique<tego_user_id>(userId->identity.value());
+                *out_identity = identity.release();
+            }
+        }, error);
+    }
 }
@@ -5,7 +5,11 @@
 struct tego_user_id
 {
     tego_user_id(const tego_v3_onion_service_id_t&);
+    tego_user_id(const tego_v3_onion_service_id_t&, const tego_v3_onion_service_id_t& identity);
     tego_user_id(const tego_user_id&) = default;
 
     tego_v3_onion_service_id_t serviceId;
+    // the hosted identity this user belongs to, or empty for the
+    // context's first identity
+    std::optional<tego_v3_onion_service_id_t> identity;
 };
\ No newline at end of file
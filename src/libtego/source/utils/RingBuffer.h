@@ -0,0 +1,175 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2026, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+/* Bounded FIFO kept in a single contiguous allocation
+ *
+ * Elements are ordered oldest to newest, and addressed by their offset from
+ * the oldest element. Every element also has a sequence number, counting up
+ * from the first element ever stored, which does not change when older
+ * elements are evicted; its offset is sequence - firstSequence().
+ *
+ * Inserting into a full buffer evicts the oldest element in constant time.
+ * The storage grows up to the capacity and is then reused in place.
+ */
+template<typename T>
+class RingBuffer
+{
+public:
+    explicit RingBuffer(int capacity)
+        : m_capacity(capacity)
+        , m_head(0)
+        , m_size(0)
+        , m_firstSequence(0)
+    {
+        Q_ASSERT(capacity > 0);
+    }
+
+    int capacity() const { return m_capacity; }
+    int size() const { return m_size; }
+    bool isEmpty() const { return m_size == 0; }
+    bool isFull() const { return m_size == m_capacity; }
+
+    // Sequence number of the oldest element
+    qint64 firstSequence() const { return m_firstSequence; }
+    // Sequence number of the next element to be appended
+    qint64 endSequence() const { return m_firstSequence + m_size; }
+
+    T &operator[](int offset)
+    {
+        Q_ASSERT(offset >= 0 && offset < m_size);
+        return m_data[slot(offset)];
+    }
+
+    const T &operator[](int offset) const
+    {
+        Q_ASSERT(offset >= 0 && offset < m_size);
+        return m_data[slot(offset)];
+    }
+
+    T &first() { return (*this)[0]; }
+    const T &first() const { return (*this)[0]; }
+    T &last() { return (*this)[m_size - 1]; }
+    const T &last() const { return (*this)[m_size - 1]; }
+
+    void append(T value)
+    {
+        insert(m_size, std::move(value));
+    }
+
+    /* Insert value at offset, moving each newer element up by one
+     *
+     * Inserting near the newest end is cheap. If the buffer is full the oldest
+     * element is evicted first, and a value inserted at offset 0 is discarded.
+     */
+    void insert(int offset, T value)
+    {
+        Q_ASSERT(offset >= 0 && offset <= m_size);
+        if (isFull()) {
+            if (offset == 0)
+                return;
+            removeFirst();
+            offset--;
+        }
+
+        // Until the storage reaches capacity, elements never wrap around and
+        // the free slot is always at the end
+        if (m_data.size() < size_t(m_capacity))
+            m_data.push_back(std::move(value));
+        else
+            m_data[slot(m_size)] = std::move(value);
+        m_size++;
+
+        for (int i = m_size - 1; i > offset; i--)
+            std::swap((*this)[i], (*this)[i - 1]);
+    }
+
+    void removeFirst()
+    {
+        Q_ASSERT(m_size > 0);
+        release(m_head);
+        m_head = (m_head + 1) % m_capacity;
+        m_size--;
+        m_firstSequence++;
+    }
+
+    void removeLast()
+    {
+        Q_ASSERT(m_size > 0);
+        if (m_data.size() < size_t(m_capacity))
+            m_data.pop_back();
+        else
+            release(slot(m_size - 1));
+        m_size--;
+    }
+
+    /* Remove the element at offset, moving each newer element down by one */
+    void removeAt(int offset)
+    {
+        Q_ASSERT(offset >= 0 && offset < m_size);
+        for (int i = offset; i < m_size - 1; i++)
+            (*this)[i] = std::move((*this)[i + 1]);
+        removeLast();
+    }
+
+    /* Remove all elements; sequence numbers continue from where they were */
+    void clear()
+    {
+        m_data.clear();
+        m_firstSequence += m_size;
+        m_head = 0;
+        m_size = 0;
+    }
+
+private:
+    int m_capacity;
+    int m_head;
+    int m_size;
+    qint64 m_firstSequence;
+    std::vector<T> m_data;
+
+    int slot(int offset) const
+    {
+        return (m_head + offset) % m_capacity;
+    }
+
+    // Free anything held by an unused slot
+    void release(int index)
+    {
+        T discarded(std::move(m_data[index]));
+        Q_UNUSED(discarded);
+    }
+};
+
+#endif // RINGBUFFER_H
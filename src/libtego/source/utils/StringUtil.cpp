@@ -116,3 +116,123 @@ QList<QByteArray> splitQuotedStrings(const QByteArray &input, char separator)
 
     return out;
 }
+
+bool isValidUtf8(const char *data, size_t size)
+{
+    auto p = reinterpret_cast<const unsigned char*>(data);
+    auto end = p + size;
+
+    while (p < end)
+    {
+        unsigned char c = *p;
+        if (c < 0x80)
+        {
+            ++p;
+            continue;
+        }
+
+        // Range of the second byte excludes overlong forms, surrogates, and values past U+10FFFF
+        size_t length;
+        unsigned char min = 0x80;
+        unsigned char max = 0xBF;
+        if (c >= 0xC2 && c <= 0xDF)
+        {
+            length = 2;
+        }
+        else if (c >= 0xE0 && c <= 0xEF)
+        {
+            length = 3;
+            if (c == 0xE0)
+                min = 0xA0;
+            else if (c == 0xED)
+                max = 0x9F;
+        }
+        else if (c >= 0xF0 && c <= 0xF4)
+        {
+            length = 4;
+            if (c == 0xF0)
+                min = 0x90;
+            else if (c == 0xF4)
+                max = 0x8F;
+        }
+        else
+        {
+            return false;
+        }
+
+        if (static_cast<size_t>(end - p) < length || p[1] < min || p[1] > max)
+            return false;
+        for (size_t i = 2; i < length; ++i)
+        {
+            if ((p[i] & 0xC0) != 0x80)
+                return false;
+        }
+        p += length;
+    }
+
+    return true;
+}
+
+QByteArray validUtf8(const char *data, size_t size)
+{
+    if (isValidUtf8(data, size))
+        return QByteArray(data, static_cast<int>(size));
+    return QString::fromUtf8(data, static_cast<int>(size)).toUtf8();
+}
+
+int utf16Length(const QByteArray &utf8)
+{
+    int length = 0;
+    for (char c : utf8)
+    {
+        auto byte = static_cast<unsigned char>(c);
+        // Every code point has one lead byte, and those past U+FFFF take a surrogate pair
+        if ((byte & 0xC0) != 0x80)
+            length += (byte >= 0xF0) ? 2 : 1;
+    }
+    return length;
+}
+
+void truncateUtf8(QByteArray &utf8, int maxLength)
+{
+    int length = 0;
+    for (int i = 0; i < utf8.size(); ++i)
+    {
+        auto byte = static_cast<unsigned char>(utf8[i]);
+        if ((byte & 0xC0) == 0x80)
+            continue;
+
+        length += (byte >= 0xF0) ? 2 : 1;
+        if (length > maxLength)
+        {
+            utf8.truncate(i);
+            return;
+        }
+    }
+}
+
+QList<QByteArray> splitUtf8(const QByteArray &utf8, int maxLength)
+{
+    QList<QByteArray> parts;
+    int start = 0;
+    int length = 0;
+    for (int i = 0; i < utf8.size(); ++i)
+    {
+        auto byte = static_cast<unsigned char>(utf8[i]);
+        if ((byte & 0xC0) == 0x80)
+            continue;
+
+        const int width = (byte >= 0xF0) ? 2 : 1;
+        if (length + width > maxLength && i > start)
+        {
+            parts.append(utf8.mid(start, i - start));
+            start = i;
+            length = 0;
+        }
+        length += width;
+    }
+
+    if (start < utf8.size())
+        parts.append(utf8.mid(start));
+    return parts;
+}
@@ -40,6 +40,22 @@ QByteArray unquotedString(const QByteArray &string);
 
 QList<QByteArray> splitQuotedStrings(const QByteArray &input, char separator);
 
+/* True if the string is well-formed UTF-8, without overlong forms, surrogates, or code points beyond U+10FFFF */
+bool isValidUtf8(const char *data, size_t size);
+
+/* Copy a string as well-formed UTF-8. Valid strings are copied as-is; otherwise
+ * malformed sequences are replaced with U+FFFD, as QString::fromUtf8 does. */
+QByteArray validUtf8(const char *data, size_t size);
+
+/* Length of well-formed UTF-8 text in UTF-16 code units, as QString::size() would count it */
+int utf16Length(const QByteArray &utf8);
+
+/* Shorten well-formed UTF-8 text to at most maxLength UTF-16 code units, without splitting a code point */
+void truncateUtf8(QByteArray &utf8, int maxLength);
+
+/* Split well-formed UTF-8 text into parts of at most maxLength UTF-16 code units, without splitting a code point */
+QList<QByteArray> splitUtf8(const QByteArray &utf8, int maxLength);
+
 template<size_t N>
 constexpr size_t static_strlen(const char (&str)[N])
 {
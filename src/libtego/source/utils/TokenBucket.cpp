@@ -0,0 +1,68 @@
+/* Ricochet Refresh - https://ricochetrefresh.net/
+ * Copyright (C) 2026, Blueprint For Free Speech <ricochet@blueprintforfreespeech.net>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ *    * Neither the names of the copyright owners nor the names of its
+ *      contributors may be used to endorse or promote products derived from
+ *      this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "TokenBucket.h"
+
+TokenBucket::TokenBucket(int rate, int burst)
+    : m_rate(qMax(1, rate))
+    , m_burst(qMax(1, burst))
+    , m_tokens(m_burst)
+    , m_last(-1)
+{
+}
+
+void TokenBucket::setLimits(int rate, int burst)
+{
+    m_rate = qMax(1, rate);
+    m_burst = qMax(1, burst);
+    m_tokens = qMin(m_tokens, double(m_burst));
+}
+
+bool TokenBucket::take()
+{
+    using namespace std::chrono;
+    return take(duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count());
+}
+
+bool TokenBucket::take(qint64 now)
+{
+    // Refill for the time elapsed since the last event; the bucket starts full
+    if (m_last >= 0 && now > m_last)
+        m_tokens = qMin(double(m_burst), m_tokens + static_cast<double>(now - m_last) * m_rate / 1000.0);
+    m_last = now;
+
+    if (m_tokens < 1.0)
+        return false;
+
+    m_tokens -= 1.0;
+    return true;
+}
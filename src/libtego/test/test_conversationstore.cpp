@@ -0,0 +1,130 @@
+#include <catch2/catch.hpp>
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <vector>
+#include "core/ConversationStore.h"
+
+namespace
+{
+    QByteArray messageText(qint64 sequence)
+    {
+        return QByteArray("message ") + QByteArray::number(sequence);
+    }
+
+    void appendMessages(ConversationStore &store, qint64 count)
+    {
+        for (qint64 i = 0; i < count; i++) {
+            const qint64 sequence = store.count();
+            REQUIRE(store.append(1000 + sequence, static_cast<quint32>(sequence), 0, 0, (sequence % 2) == 0, messageText(sequence)) == sequence);
+        }
+    }
+}
+
+TEST_CASE(  "ConversationStore appends and reads back across segments",
+            "[libtego][history][conversationstore]")
+{
+    QTemporaryDir dir;
+    REQUIRE(dir.isValid());
+
+    const qint64 total = ConversationStore::SegmentLength + 10;
+    {
+        ConversationStore store(dir.path(), QByteArray());
+        appendMessages(store, total);
+        REQUIRE(store.count() == total);
+    }
+
+    // the count comes from the newest segment when reopening
+    ConversationStore store(dir.path(), QByteArray());
+    REQUIRE(store.count() == total);
+
+    // a page spanning the segment boundary, oldest first
+    const std::vector<ConversationStore::Entry> page = store.readBefore(ConversationStore::SegmentLength + 5, 20);
+    REQUIRE(page.size() == 20);
+    for (size_t i = 0; i < page.size(); i++) {
+        const qint64 sequence = ConversationStore::SegmentLength - 15 + static_cast<qint64>(i);
+        REQUIRE(page[i].sequence == sequence);
+        REQUIRE(page[i].time == 1000 + sequence);
+        REQUIRE(page[i].identifier == static_cast<quint32>(sequence));
+        REQUIRE(page[i].isOutgoing == ((sequence % 2) == 0));
+        REQUIRE(page[i].text == messageText(sequence));
+    }
+
+    // reading before the start is clamped
+    REQUIRE(store.readBefore(3, 10).size() == 3);
+    REQUIRE(store.readBefore(0, 10).empty());
+}
+
+TEST_CASE(  "ConversationStore finds and updates messages",
+            "[libtego][history][conversationstore]")
+{
+    QTemporaryDir dir;
+    REQUIRE(dir.isValid());
+
+    ConversationStore store(dir.path(), QByteArray());
+    appendMessages(store, ConversationStore::SegmentLength + 2);
+
+    REQUIRE(store.find(10, true) == 10);
+    REQUIRE(store.find(10, false) == -1);
+    REQUIRE(store.find(11, false) == 11);
+
+    // messages appended after the first lookup are found too, newest first
+    const qint64 repeated = store.append(0, 10, 0, 0, true, "again");
+    REQUIRE(store.find(10, true) == repeated);
+
+    // status in both a closed and the open segment
+    REQUIRE(store.setStatus(3, 7));
+    REQUIRE(store.setStatus(repeated, 9));
+    REQUIRE_FALSE(store.setStatus(store.count(), 1));
+
+    ConversationStore reopened(dir.path(), QByteArray());
+    REQUIRE(reopened.readBefore(4, 1).front().status == 7);
+    REQUIRE(reopened.readBefore(reopened.count(), 1).front().status == 9);
+    REQUIRE(reopened.find(10, true) == repeated);
+}
+
+TEST_CASE(  "ConversationStore finds messages by time",
+            "[libtego][history][conversationstore]")
+{
+    QTemporaryDir dir;
+    REQUIRE(dir.isValid());
+
+    ConversationStore store(dir.path(), QByteArray());
+    REQUIRE(store.findTime(1000) == 0);
+
+    // message times are 1000 + sequence
+    const qint64 total = ConversationStore::SegmentLength + 10;
+    appendMessages(store, total);
+    REQUIRE(store.findTime(0) == 0);
+    REQUIRE(store.findTime(1005) == 5);
+    REQUIRE(store.findTime(1000 + ConversationStore::SegmentLength) == ConversationStore::SegmentLength);
+    REQUIRE(store.findTime(1000 + total - 1) == total - 1);
+    REQUIRE(store.findTime(1000 + total) == total);
+}
+
+TEST_CASE(  "ConversationStore encrypts message text",
+            "[libtego][history][conversationstore]")
+{
+    QTemporaryDir dir;
+    REQUIRE(dir.isValid());
+
+    const QByteArray key(ConversationStore::KeySize, 'k');
+    const QByteArray secret("a secret message");
+    {
+        ConversationStore store(dir.path(), key);
+        REQUIRE(store.append(1, 1, 0, 0, true, secret) == 0);
+    }
+
+    QFile log(QDir(dir.path()).filePath("00000000.log"));
+    REQUIRE(log.open(QIODevice::ReadOnly));
+    REQUIRE_FALSE(log.readAll().contains(secret));
+
+    ConversationStore store(dir.path(), key);
+    REQUIRE(store.readBefore(1, 1).front().text == secret);
+
+    // the wrong key can't decrypt it
+    ConversationStore wrongKey(dir.path(), QByteArray(ConversationStore::KeySize, 'x'));
+    REQUIRE(wrongKey.readBefore(1, 1).front().text.isEmpty());
+}
@@ -15,21 +15,32 @@ TEST_CASE(  "Context can be created/destroyed, with valid inputs",
     REQUIRE_NOTHROW(tego_uninitialize(context, tego::throw_on_error()));
 }
 
-TEST_CASE(  "Libtego refuses to create multiple contexts",
-            "[libtego][context][init][invalid_input]")
+TEST_CASE(  "Multiple independent contexts can be created/destroyed",
+            "[libtego][context][init][deinit][valid_input]")
 {
     tego_context* context = nullptr;
+    tego_context* context2 = nullptr;
 
-    // the first context should be created successfully
+    // both contexts should be created successfully
     REQUIRE_NOTHROW(tego_initialize(&context, tego::throw_on_error()));
     REQUIRE(context != nullptr);
+    REQUIRE_NOTHROW(tego_initialize(&context2, tego::throw_on_error()));
+    REQUIRE(context2 != nullptr);
+    REQUIRE(context != context2);
 
-    // the second time should throw
-    tego_context* context2 = nullptr;
-    REQUIRE_THROWS(tego_initialize(&context2, tego::throw_on_error()));
+    // destroying one must leave the other usable
+    REQUIRE_NOTHROW(tego_uninitialize(context, tego::throw_on_error()));
+    REQUIRE_NOTHROW(tego_context_set_keepalive_interval(context2, 30, tego::throw_on_error()));
+    size_t logsSize = 1;
+    REQUIRE_NOTHROW(logsSize = tego_context_get_tor_logs_size(context2, tego::throw_on_error()));
+    REQUIRE(logsSize == 0);
 
-    // clean up
-    tego_uninitialize(context, nullptr);
+    REQUIRE_NOTHROW(tego_initialize(&context, tego::throw_on_error()));
+    REQUIRE(context != nullptr);
+
+    // clean up in the opposite order
+    REQUIRE_NOTHROW(tego_uninitialize(context2, tego::throw_on_error()));
+    REQUIRE_NOTHROW(tego_uninitialize(context, tego::throw_on_error()));
 }
 
 TEST_CASE(  "Libtego refuses to create/destroy a context when passed nullptr",
@@ -0,0 +1,56 @@
+#include <catch2/catch.hpp>
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <set>
+#include "core/Outbox.h"
+
+TEST_CASE(  "Outbox persists pending messages",
+            "[libtego][history][outbox]")
+{
+    QTemporaryDir dir;
+    REQUIRE(dir.isValid());
+    const QString path = dir.filePath("outbox");
+
+    {
+        Outbox outbox(path);
+        REQUIRE(outbox.add(1));
+        REQUIRE(outbox.add(2));
+        REQUIRE(outbox.add(3));
+        REQUIRE_FALSE(outbox.add(2));
+        REQUIRE(outbox.remove(2));
+        REQUIRE_FALSE(outbox.remove(2));
+    }
+
+    REQUIRE(Outbox::hasPending(path));
+    Outbox outbox(path);
+    REQUIRE(outbox.pending() == std::set<qint64>{1, 3});
+
+    // removing the last pending message empties the journal
+    REQUIRE(outbox.remove(1));
+    REQUIRE(outbox.remove(3));
+    REQUIRE_FALSE(Outbox::hasPending(path));
+}
+
+TEST_CASE(  "Outbox compacts stale records",
+            "[libtego][history][outbox]")
+{
+    QTemporaryDir dir;
+    REQUIRE(dir.isValid());
+    const QString path = dir.filePath("outbox");
+
+    Outbox outbox(path);
+    // one message stays pending so the journal is never simply truncated
+    REQUIRE(outbox.add(0));
+    for (qint64 sequence = 1; sequence <= 2000; sequence++) {
+        REQUIRE(outbox.add(sequence));
+        REQUIRE(outbox.remove(sequence));
+    }
+
+    // 8 byte records; without compaction there would be 4001
+    REQUIRE(QFileInfo(path).size() < 2048 * 8);
+    REQUIRE(outbox.pending() == std::set<qint64>{0});
+
+    Outbox reopened(path);
+    REQUIRE(reopened.pending() == std::set<qint64>{0});
+}
@@ -0,0 +1,61 @@
+#include <catch2/catch.hpp>
+#include <QtGlobal>
+#include <utility>
+#include <vector>
+#include "utils/RingBuffer.h"
+
+TEST_CASE(  "RingBuffer evicts the oldest element when full",
+            "[libtego][utils][ringbuffer]")
+{
+    RingBuffer<int> buffer(3);
+    for (int i = 0; i < 5; i++)
+        buffer.append(i);
+
+    REQUIRE(buffer.isFull());
+    REQUIRE(buffer.size() == 3);
+    REQUIRE(buffer.first() == 2);
+    REQUIRE(buffer.last() == 4);
+
+    // sequences count every element ever stored
+    REQUIRE(buffer.firstSequence() == 2);
+    REQUIRE(buffer.endSequence() == 5);
+    for (int offset = 0; offset < buffer.size(); offset++)
+        REQUIRE(buffer[offset] == buffer.firstSequence() + offset);
+}
+
+TEST_CASE(  "RingBuffer inserts and removes by offset after wrapping",
+            "[libtego][utils][ringbuffer]")
+{
+    RingBuffer<int> buffer(4);
+    for (int i = 0; i < 6; i++)
+        buffer.append(i * 10);
+    // holds 20 30 40 50, wrapped around the storage
+
+    buffer.insert(2, 35);
+    // full, so 20 is evicted first
+    REQUIRE(buffer.size() == 4);
+    REQUIRE(buffer.firstSequence() == 3);
+    REQUIRE(buffer[0] == 30);
+    REQUIRE(buffer[1] == 35);
+    REQUIRE(buffer[2] == 40);
+    REQUIRE(buffer[3] == 50);
+
+    // inserting before the oldest element of a full buffer is a no-op
+    buffer.insert(0, 1);
+    REQUIRE(buffer[0] == 30);
+    REQUIRE(buffer.firstSequence() == 3);
+
+    buffer.removeAt(1);
+    REQUIRE(buffer.size() == 3);
+    REQUIRE(buffer[1] == 40);
+
+    buffer.removeLast();
+    REQUIRE(buffer.last() == 40);
+
+    buffer.clear();
+    REQUIRE(buffer.isEmpty());
+    REQUIRE(buffer.firstSequence() == 5);
+    buffer.append(60);
+    REQUIRE(buffer.first() == 60);
+    REQUIRE(buffer.endSequence() == 6);
+}
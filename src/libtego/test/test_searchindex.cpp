@@ -0,0 +1,82 @@
+#include <catch2/catch.hpp>
+#include <QByteArray>
+#include <QFile>
+#include <QHash>
+#include <QTemporaryDir>
+#include <vector>
+#include "core/SearchIndex.h"
+
+namespace
+{
+    std::vector<qint64> sequences(const std::vector<SearchIndex::Result> &results)
+    {
+        std::vector<qint64> found;
+        for (const auto &result : results)
+            found.push_back(result.sequence);
+        return found;
+    }
+}
+
+TEST_CASE(  "SearchIndex finds messages containing every word",
+            "[libtego][history][searchindex]")
+{
+    QTemporaryDir dir;
+    REQUIRE(dir.isValid());
+
+    SearchIndex index(dir.filePath("search.idx"), QByteArray());
+    index.add(0, "the quick brown fox");
+    index.add(1, "a slow brown dog");
+    index.add(2, "Quick thinking, quick fox!");
+
+    REQUIRE(sequences(index.search("fox", 10)) == std::vector<qint64>{2, 0});
+    REQUIRE(sequences(index.search("brown fox", 10)) == std::vector<qint64>{0});
+    REQUIRE(index.search("fox cat", 10).empty());
+    REQUIRE(sequences(index.search("brown", 1)) == std::vector<qint64>{1});
+
+    // added after the first search
+    index.add(3, "another fox");
+    REQUIRE(sequences(index.search("another fox", 10)) == std::vector<qint64>{3});
+}
+
+TEST_CASE(  "SearchIndex links postings added before it was loaded",
+            "[libtego][history][searchindex]")
+{
+    QTemporaryDir dir;
+    REQUIRE(dir.isValid());
+    const QString path = dir.filePath("search.idx");
+
+    {
+        SearchIndex index(path, QByteArray());
+        for (qint64 sequence = 0; sequence < 10; sequence++)
+            index.add(sequence, sequence % 2 ? "odd word" : "even word");
+        REQUIRE(index.search("odd", 10).size() == 5);
+    }
+
+    // a new session adds messages before searching
+    {
+        SearchIndex index(path, QByteArray());
+        for (qint64 sequence = 10; sequence < 20; sequence++)
+            index.add(sequence, sequence % 2 ? "odd word" : "even word");
+        REQUIRE(sequences(index.search("even word", 20)).size() == 10);
+    }
+
+    SearchIndex index(path, QByteArray());
+    REQUIRE(index.search("word", 30).size() == 20);
+    REQUIRE(sequences(index.search("odd", 3)) == std::vector<qint64>{19, 17, 15});
+}
+
+TEST_CASE(  "SearchIndex keys words when a key is set",
+            "[libtego][history][searchindex]")
+{
+    QTemporaryDir dir;
+    REQUIRE(dir.isValid());
+    const QString path = dir.filePath("search.idx");
+
+    SearchIndex index(path, QByteArray(32, 'k'));
+    index.add(0, "secret words");
+    REQUIRE(sequences(index.search("secret", 10)) == std::vector<qint64>{0});
+
+    // the same words under another key aren't found
+    SearchIndex other(path, QByteArray(32, 'x'));
+    REQUIRE(other.search("secret", 10).empty());
+}
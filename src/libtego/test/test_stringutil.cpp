@@ -0,0 +1,56 @@
+#include <catch2/catch.hpp>
+#include <QByteArray>
+#include <QList>
+#include <QString>
+#include "utils/StringUtil.h"
+
+namespace
+{
+    // 'a', U+00E9, U+20AC and U+1F600: 1, 2, 3 and 4 bytes, and 1, 1, 1 and 2 UTF-16 code units
+    const QByteArray mixed = QByteArray("a\xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80");
+}
+
+TEST_CASE(  "utf16Length counts UTF-16 code units",
+            "[libtego][utils][utf8]")
+{
+    REQUIRE(utf16Length(mixed) == 5);
+    REQUIRE(utf16Length(mixed) == QString::fromUtf8(mixed).size());
+}
+
+TEST_CASE(  "truncateUtf8 never splits a code point",
+            "[libtego][utils][utf8]")
+{
+    for (int maxLength = 0; maxLength <= 6; maxLength++) {
+        QByteArray text = mixed;
+        truncateUtf8(text, maxLength);
+
+        REQUIRE(isValidUtf8(text.constData(), static_cast<size_t>(text.size())));
+        REQUIRE(utf16Length(text) <= maxLength);
+        REQUIRE(mixed.startsWith(text));
+    }
+
+    // the surrogate pair doesn't fit in 4, so it's dropped whole
+    QByteArray text = mixed;
+    truncateUtf8(text, 4);
+    REQUIRE(text == QByteArray("a\xC3\xA9\xE2\x82\xAC"));
+}
+
+TEST_CASE(  "splitUtf8 splits on code point boundaries",
+            "[libtego][utils][utf8]")
+{
+    for (int maxLength = 2; maxLength <= 6; maxLength++) {
+        const QList<QByteArray> parts = splitUtf8(mixed, maxLength);
+
+        QByteArray joined;
+        for (const QByteArray &part : parts) {
+            REQUIRE(isValidUtf8(part.constData(), static_cast<size_t>(part.size())));
+            REQUIRE(utf16Length(part) <= maxLength);
+            joined += part;
+        }
+        REQUIRE(joined == mixed);
+    }
+
+    const QList<QByteArray> parts = splitUtf8(mixed, 2);
+    REQUIRE(parts.size() == 3);
+    REQUIRE(parts[2] == QByteArray("\xF0\x9F\x98\x80"));
+}
@@ -0,0 +1,38 @@
+#include <catch2/catch.hpp>
+#include <QtGlobal>
+#include "utils/TokenBucket.h"
+
+TEST_CASE(  "TokenBucket allows a burst, then the sustained rate",
+            "[libtego][utils][tokenbucket]")
+{
+    TokenBucket bucket(20, 5);
+    for (int i = 0; i < 5; i++)
+        REQUIRE(bucket.take(0));
+    REQUIRE_FALSE(bucket.take(0));
+
+    // 20 per second refills one token every 50ms
+    REQUIRE_FALSE(bucket.take(25));
+    REQUIRE(bucket.take(50));
+    REQUIRE_FALSE(bucket.take(50));
+
+    // refilling stops at the burst
+    for (int i = 0; i < 5; i++)
+        REQUIRE(bucket.take(10000));
+    REQUIRE_FALSE(bucket.take(10000));
+}
+
+TEST_CASE(  "TokenBucket limits can be lowered",
+            "[libtego][utils][tokenbucket]")
+{
+    TokenBucket bucket(1, 10);
+    bucket.setLimits(1, 2);
+    REQUIRE(bucket.take(0));
+    REQUIRE(bucket.take(0));
+    REQUIRE_FALSE(bucket.take(0));
+
+    // limits below one are treated as one
+    bucket.setLimits(0, 0);
+    REQUIRE_FALSE(bucket.take(500));
+    REQUIRE(bucket.take(1000));
+    REQUIRE_FALSE(bucket.take(1000));
+}
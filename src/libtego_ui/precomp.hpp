@@ -19,6 +19,7 @@
 #include <iterator>
 #include <set>
 #include <random>
+#include <vector>
 
 // fmt
 #include <fmt/format.h>
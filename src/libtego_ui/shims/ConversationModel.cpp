@@ -8,7 +8,7 @@ namespace shims
     ConversationModel::ConversationModel(QObject *parent)
     : QAbstractListModel(parent)
     , contactUser(nullptr)
-    , messages({})
+    , messages(HistoryLimit)
     , unreadCount(0)
     {
         connect(this, &ConversationModel::unreadCountChanged, [self=this](int prevCount, int currentCount) -> void
@@ -51,7 +51,7 @@ namespace shims
         if (!index.isValid() || index.row() >= messages.size())
             return QVariant();
 
-        const MessageData &message = messages[index.row()];
+        const MessageData &message = messageAt(index.row());
 
         switch (role) {
             case Qt::DisplayRole:
@@ -72,19 +72,19 @@ namespace shims
                 if (contact()->getStatus() == ContactUser::Online)
                     return QString();
                 if (index.row() < messages.size() - 1) {
-                    const MessageData &next = messages[index.row()+1];
+                    const MessageData &next = messageAt(index.row()+1);
                     if (next.status != Received && next.status != Delivered)
                         return QString();
                 }
                 for (int i = 0; i <= index.row(); i++) {
-                    if (messages[i].status == Received || messages[i].status == Delivered)
+                    if (messageAt(i).status == Received || messageAt(i).status == Delivered)
                         return QString();
                 }
                 return QStringLiteral("offline");
             }
             case TimespanRole: {
                 if (index.row() < messages.size() - 1)
-                    return messages[index.row() + 1].time.secsTo(messages[index.row()].time);
+                    return messageAt(index.row() + 1).time.secsTo(messageAt(index.row()).time);
                 else
                     return -1;
             }
@@ -209,9 +209,7 @@ namespace shims
         md.identifier = messageId;
         md.status = Queued;
 
-        this->beginInsertRows(QModelIndex(), 0, 0);
-        this->messages.prepend(std::move(md));
-        this->endInsertRows();
+        this->prependMessage(std::move(md));
         this->addEventFromMessage(indexOfOutgoingMessage(messageId));
     }
 
@@ -260,9 +258,7 @@ namespace shims
                 md.transferStatus = Pending;
                 md.transferDirection = Uploading;
 
-                this->beginInsertRows(QModelIndex(), 0, 0);
-                this->messages.prepend(std::move(md));
-                this->endInsertRows();
+                this->prependMessage(std::move(md));
 
                 this->addEventFromMessage(indexOfOutgoingMessage(id));
             }
@@ -275,7 +271,12 @@ namespace shims
 
     void ConversationModel::deserializeTextMessageEventToFile(const EventData &event, std::ofstream &ofile) const
     {
-        auto &md = this->messages[this->messages.size() - safe_cast<int>(event.messageData.reverseIndex)];
+        // the message may have been evicted from the history since
+        const auto offset = event.messageData.sequence - this->messages.firstSequence();
+        if (offset < 0)
+            return;
+
+        auto &md = this->messages[safe_cast<int>(offset)];
         switch (md.status)
         {
             case Received:
@@ -300,7 +301,11 @@ namespace shims
 
     void ConversationModel::deserializeTransferMessageEventToFile(const EventData &event, std::ofstream &ofile) const
     {
-        auto &md = this->messages[this->messages.size() - safe_cast<int>(event.transferData.reverseIndex)];
+        const auto offset = event.transferData.sequence - this->messages.firstSequence();
+        if (offset < 0)
+            return;
+
+        auto &md = this->messages[safe_cast<int>(offset)];
 
         if (md.transferDirection == InvalidDirection)
             return;
@@ -432,7 +437,7 @@ namespace shims
             return;
         }
 
-        auto& data = messages[row];
+        auto& data = messageAt(row);
 
         auto proposedDest = QString("%1/%2").arg(QStandardPaths::writableLocation(QStandardPaths::DownloadLocation)).arg(data.fileName);
 
@@ -480,7 +485,7 @@ namespace shims
             return;
         }
 
-        MessageData &data = messages[row];
+        MessageData &data = messageAt(row);
         if (data.transferStatus != Cancelled)
         {
             data.transferStatus = Cancelled;
@@ -514,7 +519,7 @@ namespace shims
             return;
         }
 
-        auto& data = messages[row];
+        auto& data = messageAt(row);
 
         auto userIdentity = shims::UserIdentity::userIdentity;
         auto context = userIdentity->getContext();
@@ -555,9 +560,7 @@ namespace shims
         md.transferDirection = Downloading;
         md.transferStatus = Pending;
 
-        this->beginInsertRows(QModelIndex(), 0, 0);
-        this->messages.prepend(std::move(md));
-        this->endInsertRows();
+        this->prependMessage(std::move(md));
 
         this->setUnreadCount(this->unreadCount + 1);
         this->addEventFromMessage(indexOfIncomingMessage(id));
@@ -566,9 +569,13 @@ namespace shims
     void ConversationModel::fileTransferRequestAcknowledged(tego_file_transfer_id_t id, bool accepted)
     {
         auto row = this->indexOfOutgoingMessage(id);
-        Q_ASSERT(row >= 0);
+        if (row < 0)
+        {
+            // evicted from the history
+            return;
+        }
 
-        MessageData &data = messages[row];
+        MessageData &data = messageAt(row);
         data.status = accepted ? Delivered : Error;
         emitDataChanged(row);
     }
@@ -576,9 +583,13 @@ namespace shims
     void ConversationModel::fileTransferRequestResponded(tego_file_transfer_id_t id, tego_file_transfer_response_t response)
     {
         auto row = this->indexOfOutgoingMessage(id);
-        Q_ASSERT(row >= 0);
+        if (row < 0)
+        {
+            // evicted from the history
+            return;
+        }
 
-        MessageData &data = messages[row];
+        MessageData &data = messageAt(row);
         switch(response)
         {
             case tego_file_transfer_response_accept:
@@ -600,7 +611,7 @@ namespace shims
         auto row = this->indexOfMessage(id);
         if (row >= 0)
         {
-            MessageData &data = messages[row];
+            MessageData &data = messageAt(row);
             data.bytesTransferred = bytesTransferred;
             data.transferStatus = InProgress;
 
@@ -614,7 +625,7 @@ namespace shims
         auto row = this->indexOfMessage(id);
         if (row >= 0)
         {
-            auto &data = messages[row];
+            auto &data = messageAt(row);
             switch(result)
             {
                 case tego_file_transfer_result_success:
@@ -656,6 +667,7 @@ namespace shims
 
         beginRemoveRows(QModelIndex(), 0, messages.size()-1);
         messages.clear();
+        messageIndex.clear();
         endRemoveRows();
 
         resetUnreadCount();
@@ -670,9 +682,7 @@ namespace shims
         md.identifier = messageId;
         md.status = Received;
 
-        this->beginInsertRows(QModelIndex(), 0, 0);
-        this->messages.prepend(std::move(md));
-        this->endInsertRows();
+        this->prependMessage(std::move(md));
 
         this->setUnreadCount(this->unreadCount + 1);
         this->addEventFromMessage(indexOfIncomingMessage(messageId));
@@ -688,9 +698,13 @@ namespace shims
         }
 
         auto row = this->indexOfOutgoingMessage(messageId);
-        Q_ASSERT(row >= 0);
+        if (row < 0)
+        {
+            // evicted from the history
+            return;
+        }
 
-        MessageData &data = messages[row];
+        MessageData &data = messageAt(row);
         data.status = accepted ? Delivered : Error;
         emitDataChanged(row);
     }
@@ -702,16 +716,16 @@ namespace shims
         if (row < 0)
             return;
 
-        auto &md = this->messages[row];
+        auto &md = this->messageAt(row);
         switch (md.type)
         {
             case TextMessage:
                 ed.type = TextMessageEvent;
-                ed.messageData.reverseIndex = static_cast<size_t>(this->messages.size() - row);
+                ed.messageData.sequence = this->sequenceForRow(row);
                 break;
             case TransferMessage:
                 ed.type = TransferMessageEvent;
-                ed.transferData.reverseIndex = static_cast<size_t>(this->messages.size() - row);
+                ed.transferData.sequence = this->sequenceForRow(row);
                 ed.transferData.status = md.transferStatus;
                 ed.transferData.bytesTransferred = safe_cast<qint64>(md.bytesTransferred);
                 break;
@@ -743,37 +757,81 @@ namespace shims
         emit dataChanged(index(row, 0), index(row, 0));
     }
 
-    int ConversationModel::indexOfMessage(quint32 identifier) const
+    quint64 ConversationModel::messageIndexKey(quint32 identifier, bool isIncoming)
     {
-        for (int i = 0; i < messages.size(); i++) {
-            const auto& currentMessage = messages[i];
+        return (quint64(isIncoming ? 1 : 0) << 32) | quint64(identifier);
+    }
 
-            if (currentMessage.identifier == identifier)
-                return i;
-        }
-        return -1;
+    // messages are stored oldest first, rows are newest first
+    ConversationModel::MessageData& ConversationModel::messageAt(int row)
+    {
+        return messages[messages.size() - 1 - row];
     }
 
-    int ConversationModel::indexOfOutgoingMessage(quint32 identifier) const
+    const ConversationModel::MessageData& ConversationModel::messageAt(int row) const
     {
-        for (int i = 0; i < messages.size(); i++) {
-            const auto& currentMessage = messages[i];
+        return messages[messages.size() - 1 - row];
+    }
 
-            if (currentMessage.identifier == identifier && (currentMessage.status != Received))
-                return i;
-        }
-        return -1;
+    qint64 ConversationModel::sequenceForRow(int row) const
+    {
+        return messages.endSequence() - 1 - row;
     }
 
-    int ConversationModel::indexOfIncomingMessage(quint32 identifier) const
+    int ConversationModel::rowForSequence(qint64 sequence) const
     {
-        for (int i = 0; i < messages.size(); i++) {
-            const auto& currentMessage = messages[i];
+        return static_cast<int>(messages.endSequence() - 1 - sequence);
+    }
 
-            if (currentMessage.identifier == identifier && (currentMessage.status == Received))
-                return i;
+    // add a message as the newest row, evicting the oldest if the history is full
+    void ConversationModel::prependMessage(MessageData&& md)
+    {
+        if (messages.isFull())
+        {
+            const auto last = messages.size() - 1;
+            this->beginRemoveRows(QModelIndex(), last, last);
+            const auto& oldest = messages.first();
+            auto it = messageIndex.find(messageIndexKey(oldest.identifier, oldest.status == Received));
+            if (it != messageIndex.end() && *it == messages.firstSequence())
+                messageIndex.erase(it);
+            messages.removeFirst();
+            this->endRemoveRows();
         }
-        return -1;
+
+        this->beginInsertRows(QModelIndex(), 0, 0);
+        messages.append(std::move(md));
+        const auto& message = messages.last();
+        messageIndex.insert(messageIndexKey(message.identifier, message.status == Received), messages.endSequence() - 1);
+        this->endInsertRows();
+    }
+
+    int ConversationModel::indexOfMessage(quint32 identifier) const
+    {
+        const auto outgoing = indexOfOutgoingMessage(identifier);
+        const auto incoming = indexOfIncomingMessage(identifier);
+
+        // prefer the newest (lowest row) match
+        if (outgoing < 0)
+            return incoming;
+        if (incoming < 0)
+            return outgoing;
+        return std::min(outgoing, incoming);
+    }
+
+    int ConversationModel::indexOfOutgoingMessage(quint32 identifier) const
+    {
+        auto it = messageIndex.constFind(messageIndexKey(identifier, false));
+        if (it == messageIndex.constEnd())
+            return -1;
+        return rowForSequence(*it);
+    }
+
+    int ConversationModel::indexOfIncomingMessage(quint32 identifier) const
+    {
+        auto it = messageIndex.constFind(messageIndexKey(identifier, true));
+        if (it == messageIndex.constEnd())
+            return -1;
+        return rowForSequence(*it);
     }
 
     const char* ConversationModel::getMessageStatusString(const MessageStatus status)
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "ContactUser.h"
+#include "utils/RingBuffer.h"
 
 namespace shims
 {
@@ -148,10 +149,10 @@ namespace shims
             EventType type = InvalidEvent;
             union {
                 struct {
-                    size_t reverseIndex = 0;
+                    qint64 sequence = 0;
                 } messageData;
                 struct {
-                    size_t reverseIndex = 0;
+                    qint64 sequence = 0;
                     TransferStatus status = InvalidTransfer;
                     qint64 bytesTransferred = 0; // we care about this for when a transfer is cancelled midway 
                 } transferData;
@@ -166,9 +167,24 @@ namespace shims
             EventData() {}
         };
 
-        QList<MessageData> messages;
+        static constexpr int HistoryLimit = 1000;
+
+        // stored oldest first; events refer to messages by their sequence
+        // number, which is unchanged as older messages are evicted
+        RingBuffer<MessageData> messages;
         QList<EventData> events;
 
+        // maps identifier and direction to the sequence number of the newest
+        // matching message
+        QHash<quint64, qint64> messageIndex;
+        static quint64 messageIndexKey(quint32 identifier, bool isIncoming);
+
+        MessageData& messageAt(int row);
+        const MessageData& messageAt(int row) const;
+        qint64 sequenceForRow(int row) const;
+        int rowForSequence(qint64 sequence) const;
+        void prependMessage(MessageData&& md);
+
         void addEventFromMessage(int row);
 
         void deserializeTextMessageEventToFile(const EventData &event, std::ofstream &ofile) const;
@@ -36,29 +36,41 @@
 #include "shims/ContactUser.h"
 #include "shims/UserIdentity.h"
 
-inline bool contactSort(const shims::ContactUser *c1, const shims::ContactUser *c2)
-{
-    if (c1->getStatus() != c2->getStatus())
-        return c1->getStatus() < c2->getStatus();
-    return c1->getNickname().localeAwareCompare(c2->getNickname()) < 0;
-}
-
 ContactsModel::ContactsModel(QObject *parent)
     : QAbstractListModel(parent)
     , m_identity(shims::UserIdentity::userIdentity)
 {
+    m_updateTimer.setSingleShot(true);
+    m_updateTimer.setInterval(UpdateInterval);
+    connect(&m_updateTimer, &QTimer::timeout, this, &ContactsModel::updatePendingUsers);
+
     this->setIdentity();
 }
 
+ContactsModel::Entry ContactsModel::makeEntry(shims::ContactUser *user)
+{
+    return Entry{user, user->getStatus(), user->getNickname()};
+}
+
+bool ContactsModel::entryLess(const Entry &e1, const Entry &e2)
+{
+    if (e1.status != e2.status)
+        return e1.status < e2.status;
+    return e1.nickname.localeAwareCompare(e2.nickname) < 0;
+}
+
 void ContactsModel::setIdentity()
 {
     Q_ASSERT(m_identity != nullptr);
 
     beginResetModel();
 
-    foreach (shims::ContactUser *user, contacts)
-        user->disconnect(this);
+    foreach (const Entry &entry, contacts)
+        entry.user->disconnect(this);
     contacts.clear();
+    m_rows.clear();
+    m_pendingUpdates.clear();
+    m_updateTimer.stop();
 
     if (m_identity) {
         disconnect(m_identity, 0, this, 0);
@@ -68,10 +80,15 @@ void ContactsModel::setIdentity()
     if (m_identity) {
         connect(&m_identity->contacts, &shims::ContactsManager::contactAdded, this, &ContactsModel::contactAdded);
 
-        contacts = m_identity->contacts.contacts();
-        std::sort(contacts.begin(), contacts.end(), contactSort);
+        const QList<shims::ContactUser*> users = m_identity->contacts.contacts();
+        contacts.reserve(users.size());
+        m_rows.reserve(users.size());
+        foreach (shims::ContactUser *user, users)
+            contacts.append(makeEntry(user));
+        std::sort(contacts.begin(), contacts.end(), entryLess);
+        indexRows(0, contacts.size() - 1);
 
-        foreach (shims::ContactUser *user, contacts)
+        foreach (shims::ContactUser *user, users)
             connectSignals(user);
     }
 
@@ -79,9 +96,16 @@ void ContactsModel::setIdentity()
     emit identityChanged();
 }
 
+// Record the rows of contacts from first to last after they have moved
+void ContactsModel::indexRows(int first, int last)
+{
+    for (int row = first; row <= last; row++)
+        m_rows[contacts[row].user] = row;
+}
+
 QModelIndex ContactsModel::indexOfContact(shims::ContactUser *user) const
 {
-    int row = contacts.indexOf(user);
+    int row = m_rows.value(user, -1);
     if (row < 0)
         return QModelIndex();
     return index(row, 0);
@@ -89,9 +113,13 @@ QModelIndex ContactsModel::indexOfContact(shims::ContactUser *user) const
 
 shims::ContactUser *ContactsModel::contact(int row) const
 {
-    return contacts.value(row);
+    if (row < 0 || row >= contacts.size())
+        return nullptr;
+    return contacts[row].user;
 }
 
+/* Status and nickname changes are applied together once per UpdateInterval,
+ * as many contacts may change status at once while connecting */
 void ContactsModel::updateUser(shims::ContactUser *user)
 {
     if (!user)
@@ -101,26 +129,86 @@ void ContactsModel::updateUser(shims::ContactUser *user)
             return;
     }
 
-    int row = contacts.indexOf(user);
-    if (row < 0)
+    if (!m_rows.contains(user))
     {
         user->disconnect(this);
         return;
     }
 
-    QList<shims::ContactUser*> sorted = contacts;
-    std::sort(sorted.begin(), sorted.end(), contactSort);
-    int newRow = sorted.indexOf(user);
+    m_pendingUpdates.insert(user);
+    if (!m_updateTimer.isActive())
+        m_updateTimer.start();
+}
+
+void ContactsModel::updatePendingUsers()
+{
+    if (m_pendingUpdates.isEmpty())
+        return;
+
+    const QSet<shims::ContactUser*> users = std::exchange(m_pendingUpdates, {});
+    if (users.size() >= BulkUpdateMinimum && users.size() * 8 >= contacts.size())
+    {
+        sortUsers(users);
+        return;
+    }
+
+    foreach (shims::ContactUser *user, users)
+        moveUser(user);
+}
+
+void ContactsModel::moveUser(shims::ContactUser *user)
+{
+    const int row = m_rows.value(user, -1);
+    if (row < 0)
+        return;
+
+    // The list is ordered by the old entry, which lower_bound counts if it comes first
+    const Entry entry = makeEntry(user);
+    int newRow = int(std::lower_bound(contacts.begin(), contacts.end(), entry, entryLess) - contacts.begin());
+    if (newRow > row)
+        newRow--;
 
     if (row != newRow)
     {
         beginMoveRows(QModelIndex(), row, row, QModelIndex(), (newRow > row) ? (newRow+1) : newRow);
-        contacts = sorted;
+        contacts.move(row, newRow);
+        contacts[newRow] = entry;
         endMoveRows();
+        indexRows(qMin(row, newRow), qMax(row, newRow));
+    }
+    else
+    {
+        contacts[row] = entry;
     }
     emit dataChanged(index(newRow, 0), index(newRow, 0));
 }
 
+// Re-sort the whole list as one layout change, when many contacts changed at once
+void ContactsModel::sortUsers(const QSet<shims::ContactUser*> &users)
+{
+    emit layoutAboutToBeChanged();
+
+    const QModelIndexList oldIndexes = persistentIndexList();
+    QList<shims::ContactUser*> persistentUsers;
+    persistentUsers.reserve(oldIndexes.size());
+    foreach (const QModelIndex &oldIndex, oldIndexes)
+        persistentUsers.append(contacts[oldIndex.row()].user);
+
+    foreach (shims::ContactUser *user, users)
+        contacts[m_rows.value(user)] = makeEntry(user);
+    std::stable_sort(contacts.begin(), contacts.end(), entryLess);
+    indexRows(0, contacts.size() - 1);
+
+    QModelIndexList newIndexes;
+    newIndexes.reserve(oldIndexes.size());
+    for (int i = 0; i < oldIndexes.size(); i++)
+        newIndexes.append(index(m_rows.value(persistentUsers[i]), oldIndexes[i].column()));
+    changePersistentIndexList(oldIndexes, newIndexes);
+
+    emit layoutChanged();
+    emit dataChanged(index(0, 0), index(contacts.size() - 1, 0));
+}
+
 void ContactsModel::connectSignals(shims::ContactUser *user)
 {
     connect(user, SIGNAL(statusChanged()), SLOT(updateUser()));
@@ -134,11 +222,13 @@ void ContactsModel::contactAdded(shims::ContactUser *user)
 
     connectSignals(user);
 
-    QList<shims::ContactUser*>::Iterator lp = std::lower_bound(contacts.begin(), contacts.end(), user, contactSort);
+    const Entry entry = makeEntry(user);
+    QList<Entry>::Iterator lp = std::lower_bound(contacts.begin(), contacts.end(), entry, entryLess);
     int row = lp - contacts.begin();
 
     beginInsertRows(QModelIndex(), row, row);
-    contacts.insert(lp, user);
+    contacts.insert(lp, entry);
+    indexRows(row, contacts.size() - 1);
     endInsertRows();
 }
 
@@ -147,9 +237,15 @@ void ContactsModel::contactRemoved(shims::ContactUser *user)
     if (!user && !(user = qobject_cast<shims::ContactUser*>(sender())))
         return;
 
-    int row = contacts.indexOf(user);
+    int row = m_rows.value(user, -1);
+    if (row < 0)
+        return;
+
     beginRemoveRows(QModelIndex(), row, row);
     contacts.removeAt(row);
+    m_rows.remove(user);
+    m_pendingUpdates.remove(user);
+    indexRows(row, contacts.size() - 1);
     endRemoveRows();
 
     disconnect(user, 0, this, 0);
@@ -176,7 +272,7 @@ QVariant ContactsModel::data(const QModelIndex &index, int role) const
     if (!index.isValid() || index.row() >= contacts.size())
         return QVariant();
 
-    shims::ContactUser *user = contacts[index.row()];
+    shims::ContactUser *user = contacts[index.row()].user;
 
     switch (role)
     {
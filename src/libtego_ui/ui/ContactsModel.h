@@ -69,16 +69,41 @@ signals:
 
 private slots:
     void updateUser(shims::ContactUser *user = 0);
+    void updatePendingUsers();
     void contactAdded(shims::ContactUser *user);
     void contactRemoved(shims::ContactUser *user);
 
 private:
     void setIdentity();
 
+    /* A contact with the status and nickname it is sorted by. These are
+     * only refreshed when the contact is moved, so that the list stays
+     * ordered while changes are waiting in m_pendingUpdates. */
+    struct Entry
+    {
+        shims::ContactUser *user;
+        int status;
+        QString nickname;
+    };
+
+    // Time in milliseconds over which changes are collected before rows move, about a frame
+    static const int UpdateInterval = 16;
+    // Least number of pending changes that re-sort the whole list instead of moving rows
+    static const int BulkUpdateMinimum = 32;
+
     shims::UserIdentity *m_identity;
-    QList<shims::ContactUser*> contacts;
+    QList<Entry> contacts;
+    QHash<shims::ContactUser*,int> m_rows;
+    QSet<shims::ContactUser*> m_pendingUpdates;
+    QTimer m_updateTimer;
+
+    static Entry makeEntry(shims::ContactUser *user);
+    static bool entryLess(const Entry &e1, const Entry &e2);
 
     void connectSignals(shims::ContactUser *user);
+    void moveUser(shims::ContactUser *user);
+    void sortUsers(const QSet<shims::ContactUser*> &users);
+    void indexRows(int first, int last);
 };
 
 #endif // CONTACTSMODEL_H